@@ -1,497 +1,370 @@
 #include "wmb.hpp"
+#include "wmb_format.hpp"
 
 #include <type_traits>
 #include <cstdint>
 #include <vector>
 #include <exception>
 #include <cstring>
+#include <algorithm>
 
 #include <iostream>
+#include <utility>
 
 #include <glm/gtc/matrix_transform.hpp>
 
 using namespace WMB;
+using namespace WMB::detail;
 
 namespace // anonymous namespace
 {
-	struct __attribute__((packed)) LIST
+	//! Decodes the records of a WMB file, shared by load() and reload().
+	struct Decoder
 	{
-		//! offset of the list from the start of the WMB file, in bytes
-		uint32_t offset;
-
-		//! length of the list, in bytes
-		uint32_t length;
-	};
-
-	struct WMB_HEADER
-	{
-		//! "WMB7"
-		std::array<char, 4> version;
-		LIST palettes;// WMB1..6 only
-		LIST legacy1; // WMB1..6 only
-		LIST textures;// textures list
-		LIST legacy2; // WMB1..6 only
-		LIST pvs;     // BSP only
-		LIST bsp_nodes; // BSP only
-		LIST materials; // material names
-		LIST legacy3; // WMB1..6 only
-		LIST legacy4; // WMB1..6 only
-		LIST aabb_hulls; // WMB1..6 only
-		LIST bsp_leafs;  // BSP only
-		LIST bsp_blocks; // BSP only
-		LIST legacy5; // WMB1..6 only
-		LIST legacy6; // WMB1..6 only
-		LIST legacy7; // WMB1..6 only
-		LIST objects; // entities, paths, sounds, etc.
-		LIST lightmaps; // lightmaps for blocks
-		LIST blocks;  // block meshes
-		LIST legacy8; // WMB1..6 only
-		LIST lightmaps_terrain; // lightmaps for terrains
-	};
-
-	struct __attribute__((packed)) TEXTURE
-	{
-		std::array<char, 16> name;   // texture name, max. 16 characters
-		uint32_t width,height; // texture size
-		uint32_t type;	    // texture type: 5 = 8888 RGBA; 4 = 888 RGB; 2 = 565 RGB; 6 = DDS; +8 = mipmaps
-		uint32_t legacy[3]; // always 0
-	};
-
-	struct MATERIAL_INFO
-	{
-		std::array<char, 44> legacy;   // always 0
-		std::array<char, 20> material; // material name from the script, max. 20 characters
-	};
-
-	static_assert(sizeof(MATERIAL_INFO) == 64);
-
-	////////////////////////////////////////////////////////////////////////////////
-
-	enum class OBJECT_TYPE : uint32_t
-	{
-		Position = 1,
-		Light = 2,
-		OldEntity = 3,
-		Sound = 4,
-		Info = 5,
-		Path = 6,
-		Entity = 7,
-		Region = 8,
-	};
-
-
-	struct __attribute__((packed)) WMB_INFO
-	{
-		// uint32_t  type;      // 5 = INFO
-		std::array<float, 3> origin; // not used
-		float azimuth;   // sun azimuth
-		float elevation; // sun elevation
-		uint32_t  flags;     // always 127 (0x7F)
-		float version;	 // compiler version
-		std::uint8_t  gamma;     // light level at black
-		std::uint8_t  LMapSize;	 // 0,1,2 for lightmap sizes 256x256, 512x512, or 1024x1024
-		uint32_t  unused[2];
-		uint32_t dwSunColor, dwAmbientColor; // color double word, ARGB
-		uint32_t dwFogColor[4];
-	};
-
-	struct __attribute__((packed)) WMB_POSITION
-	{
-		// long  type;      // 1 = POSITION
-		std::array<float, 3> origin;
-		std::array<float, 3> angle;
-		uint32_t  unused[2];
-		std::array<char, 20>  name;
-	};
-
-	struct __attribute__((packed)) WMB_LIGHT
-	{
-		// long  type;      // 2 = LIGHT
-		std::array<float, 3> origin;
-		float red,green,blue; // color in percent, 0..100
-		float range;
-		uint32_t  flags;     // 0 = static, 2 = dynamic
-	};
-
-	struct __attribute__((packed)) WMB_SOUND
-	{
-		// long  type;      // 4 = Sound
-		std::array<float, 3> origin;
-		float volume;
-		float unused[2];
-		uint32_t  range;
-		uint32_t  flags;    // always 0
-		std::array<char,33> filename;
-	};
-
-	struct __attribute__((packed)) WMB_PATH
-	{
-		// long  type;		 // 6 = PATH
-		std::array<char, 20> name;	 // Path name
-		float fNumPoints;// number of nodes
-		uint32_t  unused[3]; // always 0
-		uint32_t  num_edges;
-	};
-
-	struct __attribute__((packed)) PATH_EDGE
-	{
-		float fNode1,fNode2; // node numbers of the edge, starting with 1
-		float fLength;
-		float fBezier;
-		float fWeight;
-		float fSkill;
-	};
-
-	struct __attribute__((packed)) WMB_ENTITY
-	{
-		// long  type;     // 7 = ENTITY
-		std::array<float, 3> origin;
-		std::array<float, 3> angle;
-		std::array<float, 3> scale;
-		std::array<char, 33>  name;
-		std::array<char, 33>  filename;
-		std::array<char, 33>  action;
-		uint8_t unused1;
-		std::array<float, 20> skill;
-		uint32_t  flags;
-		float ambient;
-		float albedo;
-		int32_t  path;    // attached path index, starting with 1, or 0 for no path
-		uint32_t  entity2; // attached entity index, starting with 1, or 0 for no attached entity
-		std::array<char, 33> material;
-		std::array<char, 33> string1;
-		std::array<char, 33> string2;
-		char  unused2[33];
-	};
-
-	struct __attribute__((packed)) WMB_OLD_ENTITY
-	{
-		// long  type;     // 3 = OLD ENTITY
-		std::array<float, 3> origin;
-		std::array<float, 3> angle;
-		std::array<float, 3> scale;
-		std::array<char, 20> name;
-		std::array<char, 13> filename;
-		std::array<char, 20> action;
-		std::array<float, 8> skill;
-		uint32_t  flags;
-		float ambient;
-	};
-
-	////////////////////////////////////////////////////////////////////////////////
-
-	struct __attribute__((packed)) BLOCK
-	{
-		std::array<float, 3> fMins; // bounding box
-		std::array<float, 3> fMaxs; // bounding box
-		uint32_t lContent;  // always 0
-		uint32_t lNumVerts; // number of VERTEX structs that follow
-		uint32_t lNumTris;  // number of TRIANGLE structs that follow
-		uint32_t lNumSkins; // number of SKIN structs that follow
-	};
-
-	struct __attribute__((packed)) VERTEX
-	{
-		float x,y,z; // position
-		float tu,tv; // texture coordinates
-		float su,sv; // lightmap coordinates
-	};
-
-	struct __attribute__((packed)) TRIANGLE
-	{
-		uint16_t v1,v2,v3; // indices into the VERTEX array
-		uint16_t skin;  // index into the SKIN array
-		uint32_t unused; // always 0
-	};
-
-	struct __attribute__((packed)) SKIN
-	{
-		uint16_t texture;  // index into the textures list
-		uint16_t lightmap; // index into the lightmaps list
-		uint32_t material; // index into the MATERIAL_INFO array
-		float ambient,albedo;
-		uint32_t flags;     // bit 1 = flat (no lightmap), bit 2 = sky, bit 14 = smooth
-	};
-
-	struct __attribute__((packed)) LIGHTMAP_TERRAIN
-	{
-		uint32_t object; // terrain entity index into the objects list
-		uint32_t width, height; // lightmap size
-	};
-
-	struct __attribute__((packed)) REGION
-	{
-		std::array<float, 3> min;
-		std::array<float, 3> max;
-		uint32_t val_a;
-		uint32_t val_b;
-		std::array<char, 32> name;
-	};
-
-	struct File
-	{
-		FILE * f;
-
-		File(FILE * f) : f(f)
+		File & f;
+		std::string const & fileName;
+		LoadOptions const & options;
+		glm::mat3 const mapping;
+
+		//! Set when a record has an unknown texture format or object type,
+		//! the file cannot be loaded then.
+		bool invalid = false;
+
+		Decoder(File & f, std::string const & fileName, LoadOptions const & options) :
+			f(f),
+			fileName(fileName),
+			options(options),
+			mapping(coordinateMatrix(options.targetCoordinateSystem))
 		{
 
 		}
 
-		File(File const &) = delete;
-		File(File &&) = delete;
-
-		~File()
+		glm::vec3 mapVec(glm::vec3 const & v) const
 		{
-			if(f != nullptr)
-				fclose(f);
+			return v * mapping;
 		}
 
-		operator bool() const
+		glm::vec3 mapScale(glm::vec3 const & v) const
 		{
-			return (f != nullptr);
+			switch(options.targetCoordinateSystem)
+			{
+				case LoadOptions::Gamestudio: return v;
+				case LoadOptions::OpenGL:     return glm::vec3(v.x, v.z, v.y);
+				case LoadOptions::DirectX:    return glm::vec3(v.x, v.z, v.y);
+				default:                      std::terminate();
+			}
 		}
 
-		operator FILE* ()
+		//! Reads the count and the offset table at the start of a list.
+		std::vector<uint32_t> offsetTable(LIST const & list)
 		{
-			return f;
-		}
+			f.seek(list.offset);
 
-		void seek(long offset, int mode = SEEK_SET)
-		{
-			fseek(f, offset, mode);
+			auto const count = f.read<uint32_t>();
+			std::vector<uint32_t> offsets(count);
+			for(size_t i = 0; i < count; i++)
+				offsets[i] = f.read<uint32_t>();
+			return offsets;
 		}
 
-		template<typename T>
-		typename std::enable_if<std::is_trivially_constructible<T>::value, T>::type read()
+		Texture textureHeader(TEXTURE const & tex)
 		{
-			uint8_t buffer[sizeof(T)];
-
-			size_t offset = 0;
-			while(offset < sizeof(T))
-				offset += fread(&buffer[offset], 1, sizeof(T) - offset, f);
-
-			return reinterpret_cast<T&>(*buffer);
+			Texture texture;
+			texture.name = toString(tex.name);
+			texture.width = tex.width;
+			texture.height = tex.height;
+			texture.format = Texture::Format(tex.type & 0x07);
+			texture.hasMipMaps = (tex.type & 8);
+			return texture;
 		}
 
-		std::vector<std::byte> read(size_t const len)
+		//! Sizes of the mip levels that follow the TEXTURE struct of an
+		//! uncompressed texture.
+		std::vector<size_t> levelSizes(Texture const & texture)
 		{
-			std::vector<std::byte> data(len);
-
-			size_t offset = 0;
-			while(offset < data.size())
-				offset += fread(&data[offset], 1, data.size() - offset, f);
-
-			return data;
-		}
-	};
-
-	glm::vec4 toColor(uint32_t val)
-	{
-		auto const select = [](uint32_t val, int byte) -> uint8_t {
-			return (val >> (4 * byte)) & 0xFF;
-		};
-		return glm::vec4(
-			select(val, 3) / 255.0,
-			select(val, 2) / 255.0,
-			select(val, 1) / 255.0,
-			select(val, 0) / 255.0);
-	}
-
-	template<typename T, size_t N>
-	std::string toString(T const (&chars)[N])
-	{
-		char buffer[N + 1];
-		strncpy(buffer, chars, N);
-		return std::string(buffer);
-	}
-
-	template<typename T, size_t N>
-	std::string toString(std::array<T, N> const & chars)
-	{
-		char buffer[N + 1];
-		strncpy(buffer, chars.data(), N);
-		return std::string(buffer);
-	}
+			size_t bpp;
+			switch(texture.format)
+			{
+				case Texture::RGB565:
+					bpp = 2;
+					break;
+				case Texture::RGB888:
+					bpp = 3;
+					break;
+				case Texture::RGBA8888:
+					bpp = 4;
+					break;
 
-	glm::vec3 toVec3(float const (&array)[3])
-	{
-		return glm::vec3(array[0], array[1], array[2]);
-	}
+				default: // unknown or invalid format
+					invalid = true;
+					return { };
+			}
 
-	glm::vec3 toVec3(std::array<float,3> const & array)
-	{
-		return glm::vec3(array[0], array[1], array[2]);
-	}
+			size_t datalen = bpp * texture.width * texture.height;
+			size_t miplevels = 1;
 
-	Euler toEuler(float const (&array)[3])
-	{
-		return Euler { array[0], array[1], array[2] };
-	}
+			// In case of mipmaps (type = 13, 12, or 10) the pixels of
+			// the 3 mipmaps follow the base texture pixels.
+			if(texture.hasMipMaps)
+				miplevels = 4;
 
-	Euler toEuler(std::array<float, 3> const & array)
-	{
-		return Euler { array[0], array[1], array[2] };
-	}
-}
+			std::vector<size_t> sizes;
+			for(size_t miplevel = 0; miplevel < miplevels; miplevel++)
+			{
+				sizes.push_back(datalen);
 
-std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const & options)
-{
-	File f(fopen(fileName.c_str(), "rb"));
-	if(not f)
-		return std::nullopt;
+				// reduce mipmap to quarter size
+				datalen /= 4;
+				if(datalen == 0)
+					break;
+			}
+			return sizes;
+		}
 
-	auto const mapVec = [&](glm::vec3 const & v)
-	{
-		glm::mat3 mat;
-		switch(options.targetCoordinateSystem)
+		//! Places of all mip levels of a texture in the file, for
+		//! LoadOptions::STREAM_MIPS. DDS images are decoded from their
+		//! headers, the result is empty for unsupported DDS formats.
+		std::vector<FileSpan> levelSpans(TEXTURE const & tex, Texture & texture, size_t dataOffset)
 		{
-			case LoadOptions::Gamestudio:
-				mat = glm::identity<glm::mat3>();
-				break;
-			case LoadOptions::OpenGL:
-				mat = glm::mat3(
-					 0.0, -1.0,  0.0,
-					 0.0,  0.0,  1.0,
-					-1.0,  0.0,  0.0
-				);
-				break;
-			case LoadOptions::DirectX:
-				mat = glm::mat3(
-					 0.0, -1.0,  0.0,
-					 0.0,  0.0,  1.0,
-					 1.0,  0.0,  0.0
-			    );
-				break;
-			default:
-				std::terminate();
+			std::vector<FileSpan> spans;
+			if(texture.format == Texture::DDS)
+			{
+				f.seek(dataOffset);
+				auto const head = f.read(std::min<size_t>(tex.width, maxDDSHeaderSize));
+				if(not decodeDDSHeader(ByteView { head.data(), head.size() }, tex.width, texture, spans))
+					return { };
+				// the other surfaces would be lost, see hasExtraSurfaces()
+				if(spans.back().offset + spans.back().size < tex.width)
+					return { };
+				for(auto & span : spans)
+					span.offset += dataOffset;
+			}
+			else
+			{
+				size_t offset = dataOffset;
+				for(auto const size : levelSizes(texture))
+				{
+					spans.push_back(FileSpan { offset, size });
+					offset += size;
+				}
+			}
+			return spans;
 		}
-		return v * mat;
-	};
-	auto const mapScale = [&](glm::vec3 const & v)
-	{
-		switch(options.targetCoordinateSystem)
+
+		//! Records the levels that are larger than streamedMipSize as
+		//! pending and returns the ones to load now.
+		std::vector<FileSpan> skipLevels(Texture & texture, std::vector<FileSpan> spans)
 		{
-			case LoadOptions::Gamestudio: return v;
-			case LoadOptions::OpenGL:     return glm::vec3(v.x, v.z, v.y);
-			case LoadOptions::DirectX:    return glm::vec3(v.x, v.z, v.y);
-			default:                      std::terminate();
+			size_t skipped = 0;
+			while(skipped + 1 < spans.size() and (std::max(texture.width, texture.height) >> skipped) > options.streamedMipSize)
+				skipped++;
+			texture.skippedLevels = static_cast<unsigned int>(skipped);
+			texture.pendingLevels.assign(spans.begin(), spans.begin() + skipped);
+			spans.erase(spans.begin(), spans.begin() + skipped);
+			return spans;
 		}
-	};
-
-	Level level;
-
-	WMB_HEADER header = f.read<WMB_HEADER>();
-	if(memcmp(header.version.data(), "WMB7", 4) != 0)
-		return std::nullopt;
-
-	// Load textures
-	if(header.textures.offset != 0)
-	{
-		f.seek(header.textures.offset);
 
-		auto const texcount = f.read<uint32_t>();
-		std::vector<uint32_t> offsets(texcount);
-		for(size_t i = 0; i < texcount; i++)
-			offsets[i] = f.read<uint32_t>();
+		void warnUnsupportedDDS(Texture const & texture)
+		{
+			if(options.log_warnings())
+				std::cerr << "WMB Warning: " << fileName << ": texture '" << texture.name << "' has an unsupported DDS format!" << std::endl;
+		}
 
-		for(size_t i = 0; i < texcount; i++)
+		Texture texture(uint32_t offset)
 		{
-			f.seek(header.textures.offset + offsets[i]);
+			f.seek(offset);
 
 			TEXTURE const tex = f.read<TEXTURE>();
+			Texture texture = textureHeader(tex);
 
-			Texture texture;
-			texture.name = toString(tex.name);
-			texture.width = tex.width;
-			texture.height = tex.height;
-			texture.format = Texture::Format(tex.type & 0x07);
-			texture.hasMipMaps = (tex.type & 8);
+			if(options.stream_mips())
+			{
+				auto const spans = levelSpans(tex, texture, offset + sizeof(TEXTURE));
+				if(not spans.empty())
+				{
+					for(auto const & span : skipLevels(texture, spans))
+					{
+						f.seek(span.offset);
+						texture.levels.push_back(f.read(span.size));
+					}
+					return texture;
+				}
+
+				// unsupported DDS formats are loaded completely
+				f.seek(offset + sizeof(TEXTURE));
+			}
 
 			if(texture.format == Texture::DDS)
 			{
 				// In case of a compressed DDS image, the image content follows
 				// the TEXTURE struct and the width gives the image content
 				// size in bytes.
-				texture.levels.push_back(f.read(texture.width));
+				auto blob = f.read(tex.width);
+
+				// On success the DDS file becomes the texture storage and the
+				// mip levels point into it. Unknown formats are kept as a
+				// single level, like before.
+				if(not decodeDDS(blob, texture))
+				{
+					warnUnsupportedDDS(texture);
+					texture.levels.push_back(std::move(blob));
+				}
 			}
 			else
 			{
-				size_t bpp;
-				switch(texture.format)
+				for(auto const size : levelSizes(texture))
+					texture.levels.push_back(f.read(size));
+			}
+
+			return texture;
+		}
+
+		//! Reads all textures of the list with their mip levels in one
+		//! pool, see packTextures().
+		std::vector<Texture> pooledTextures(LIST const & list, std::vector<uint32_t> const & offsets)
+		{
+			size_t const alignment = std::max<size_t>(1, options.textureAlignment);
+			auto const alignUp = [&](size_t n)
+			{
+				return (n + alignment - 1) / alignment * alignment;
+			};
+
+			std::vector<Texture> textures;
+			textures.reserve(offsets.size());
+
+			// The headers give the size of the pixel data, so the pool is
+			// allocated once. DDS files are an upper bound for their levels.
+			// Streamed textures only get their small levels.
+			size_t capacity = 0;
+			std::vector<std::vector<FileSpan>> streamed(offsets.size());
+			for(size_t i = 0; i < offsets.size(); i++)
+			{
+				f.seek(list.offset + offsets[i]);
+				auto const tex = f.read<TEXTURE>();
+				textures.push_back(textureHeader(tex));
+				if(options.stream_mips())
+					streamed[i] = levelSpans(tex, textures.back(), list.offset + offsets[i] + sizeof(TEXTURE));
+
+				if(not streamed[i].empty())
 				{
-					case Texture::RGB565:
-						bpp = 2;
-						break;
-					case Texture::RGB888:
-						bpp = 3;
-						break;
-					case Texture::RGBA8888:
-						bpp = 4;
-						break;
-
-					default: // unknown or invalid format
-						std::terminate();
+					streamed[i] = skipLevels(textures.back(), std::move(streamed[i]));
+					for(auto const & span : streamed[i])
+						capacity += alignUp(span.size);
 				}
+				else if(textures.back().format == Texture::DDS)
+					capacity += tex.width + 16 * alignment;
+				else for(auto const size : levelSizes(textures.back()))
+					capacity += alignUp(size);
+			}
 
-				size_t datalen = bpp * texture.width * texture.height;
-				size_t miplevels = 1;
+			auto pool = std::make_shared<std::vector<std::byte>>();
+			pool->reserve(capacity);
 
-				// In case of mipmaps (type = 13, 12, or 10) the pixels of
-				// the 3 mipmaps follow the base texture pixels.
-				if(texture.hasMipMaps)
-					miplevels = 4;
+			// offsets into the pool, the views are created when it is complete
+			std::vector<std::vector<std::pair<size_t, size_t>>> spans(offsets.size());
+			auto const allocate = [&](size_t size)
+			{
+				size_t const at = alignUp(pool->size());
+				pool->resize(at + size);
+				return at;
+			};
 
-				for(size_t miplevel = 0; miplevel < 3; miplevel++)
+			for(size_t i = 0; i < offsets.size(); i++)
+			{
+				auto & texture = textures[i];
+				if(not streamed[i].empty())
 				{
-					texture.levels.push_back(f.read(datalen));
+					for(auto const & span : streamed[i])
+					{
+						size_t const at = allocate(span.size);
+						f.seek(span.offset);
+						f.read(pool->data() + at, span.size);
+						spans[i].emplace_back(at, span.size);
+					}
+					continue;
+				}
+
+				f.seek(list.offset + offsets[i] + sizeof(TEXTURE));
 
-					// reduce mipmap to quarter size
-					datalen /= 4;
-					if(datalen == 0)
-						break;
+				if(texture.format == Texture::DDS)
+				{
+					auto blob = f.read(texture.width);
+					if(not decodeDDS(ByteView { blob.data(), blob.size() }, texture))
+					{
+						warnUnsupportedDDS(texture);
+						texture.levels.push_back(std::move(blob));
+						continue;
+					}
+					if(hasExtraSurfaces(ByteView { blob.data(), blob.size() }, texture))
+					{
+						texture.mips.clear();
+						decodeDDS(blob, texture);
+						continue;
+					}
+					for(auto const & mip : texture.mips)
+					{
+						size_t const at = allocate(mip.size());
+						memcpy(pool->data() + at, mip.data(), mip.size());
+						spans[i].emplace_back(at, mip.size());
+					}
+					texture.mips.clear();
+				}
+				else
+				{
+					for(auto const size : levelSizes(texture))
+					{
+						size_t const at = allocate(size);
+						f.read(pool->data() + at, size);
+						spans[i].emplace_back(at, size);
+					}
 				}
 			}
 
-			level.textures.push_back(texture);
+			std::shared_ptr<std::vector<std::byte> const> const storage = std::move(pool);
+			for(size_t i = 0; i < textures.size(); i++)
+			{
+				if(spans[i].empty())
+					continue;
+				textures[i].storage = storage;
+				for(auto const & span : spans[i])
+					textures[i].mips.push_back(ByteView { storage->data() + span.first, span.second });
+			}
+			return textures;
 		}
-	}
 
-	// Load materials
-	if(header.materials.offset != 0)
-	{
-		f.seek(header.materials.offset);
-		size_t const count = header.materials.length / sizeof(MATERIAL_INFO);
-
-		level.materials.reserve(count);
-		for(size_t i = 0; i < count; i++)
+		std::vector<Material> materials(LIST const & list)
 		{
-			auto const info = f.read<MATERIAL_INFO>();
+			f.seek(list.offset);
+			size_t const count = list.length / sizeof(MATERIAL_INFO);
 
-			Material mtl;
-			mtl.name = toString(info.material);
-			mtl.isDefault = (0 == memcmp(info.material.data(), "\0def", 4));
-
-			level.materials.push_back(mtl);
-		}
-	}
-
-	// Load blocks
-	if(header.blocks.offset != 0)
-	{
-		f.seek(header.blocks.offset);
+			std::vector<Material> materials;
+			materials.reserve(count);
+			for(size_t i = 0; i < count; i++)
+			{
+				auto const info = f.read<MATERIAL_INFO>();
 
-		auto const blockcount = f.read<uint32_t>();
-		level.blocks.reserve(blockcount);
+				Material mtl;
+				mtl.name = toString(info.material);
+				mtl.isDefault = (0 == memcmp(info.material.data(), "\0def", 4));
 
-		// A block consists of a BLOCK struct, followed by an array of
-		// VERTEX, TRIANGLE, and SKIN structs.
+				materials.push_back(mtl);
+			}
+			return materials;
+		}
 
-		for(size_t idx = 0; idx < blockcount; idx++)
+		//! Reads the block at the current file position.
+		Block block(WeldStats & welded)
 		{
+			// A block consists of a BLOCK struct, followed by an array of
+			// VERTEX, TRIANGLE, and SKIN structs.
+
 			auto const bl = f.read<BLOCK>();
 			Block block;
-			block.bbMax = glm::vec3(bl.fMaxs[0], bl.fMaxs[1], bl.fMaxs[2]);
-			block.bbMin = glm::vec3(bl.fMins[0], bl.fMins[1], bl.fMins[2]);
+			// the mapping may swap or mirror axes, so sort the corners again
+			auto const corner1 = mapVec(toVec3(bl.fMins));
+			auto const corner2 = mapVec(toVec3(bl.fMaxs));
+			block.bbMin = glm::min(corner1, corner2);
+			block.bbMax = glm::max(corner1, corner2);
 
 			block.skins.reserve(bl.lNumSkins);
 			block.triangles.reserve(bl.lNumTris);
@@ -541,58 +414,134 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 				block.skins.push_back(skin);
 			}
 
-			level.blocks.push_back(block);
+			if(options.weld)
+				welded += weld(block, *options.weld);
+
+			return block;
 		}
-	}
 
-	// Load objects
-	{
-		f.seek(header.objects.offset);
-		auto const objcount = f.read<uint32_t>();
-		std::vector<uint32_t> objoffets(objcount);
-		for(size_t i = 0; i < objcount; i++)
-			objoffets[i] = f.read<uint32_t>();
+		//! Returns nullopt if the file has no BSP tree.
+		std::optional<BspLists> bspLists(WMB_HEADER const & header)
+		{
+			if(header.bsp_nodes.offset == 0 or header.bsp_leafs.offset == 0 or header.bsp_blocks.offset == 0)
+				return std::nullopt;
 
-		bool hasInfo = false;
-		for(size_t i = 0; i < objcount; i++)
+			BspLists lists;
+			for(auto [list, data] : { std::pair(&header.bsp_nodes, &lists.nodes), std::pair(&header.bsp_leafs, &lists.leafs),
+			                          std::pair(&header.bsp_blocks, &lists.blocks), std::pair(&header.pvs, &lists.pvs) })
+			{
+				if(list->offset == 0)
+					continue;
+				f.seek(list->offset);
+				*data = f.read(list->length);
+			}
+			return lists;
+		}
+
+		//! Returns nullopt if the file has no BSP tree or it is invalid.
+		std::optional<Bsp> bsp(WMB_HEADER const & header, size_t blockCount)
+		{
+			if(header.bsp_nodes.offset == 0 or header.bsp_leafs.offset == 0 or header.bsp_blocks.offset == 0)
+				return std::nullopt;
+
+			Bsp bsp;
+			bsp.blockCount = blockCount;
+
+			f.seek(header.bsp_nodes.offset);
+			bsp.nodes.resize(header.bsp_nodes.length / sizeof(BSP_NODE));
+			for(auto & node : bsp.nodes)
+			{
+				auto const n = f.read<BSP_NODE>();
+				// the mapping is a rotation or mirroring, so it keeps the distances
+				node.normal = mapVec(toVec3(n.normal));
+				node.distance = n.distance;
+				node.children = { n.children[0], n.children[1] };
+			}
+
+			f.seek(header.bsp_leafs.offset);
+			bsp.leafs.resize(header.bsp_leafs.length / sizeof(BSP_LEAF));
+			for(auto & leaf : bsp.leafs)
+			{
+				auto const l = f.read<BSP_LEAF>();
+				auto const corner1 = mapVec(toVec3(l.mins));
+				auto const corner2 = mapVec(toVec3(l.maxs));
+				leaf.minimum = glm::min(corner1, corner2);
+				leaf.maximum = glm::max(corner1, corner2);
+				leaf.firstBlock = l.firstBlock;
+				leaf.blockCount = l.numBlocks;
+				leaf.visibility = l.pvs;
+			}
+
+			f.seek(header.bsp_blocks.offset);
+			bsp.leafBlocks.resize(header.bsp_blocks.length / sizeof(uint32_t));
+			for(auto & index : bsp.leafBlocks)
+				index = f.read<uint32_t>();
+
+			if(header.pvs.offset != 0)
+			{
+				f.seek(header.pvs.offset);
+				bsp.pvs = f.read(header.pvs.length);
+			}
+
+			bool valid = not bsp.leafs.empty();
+			for(auto const & node : bsp.nodes)
+			{
+				for(auto const child : node.children)
+				{
+					if(child >= 0)
+						valid = valid and (size_t(child) < bsp.nodes.size());
+					else
+						valid = valid and (size_t(-(child + 1)) < bsp.leafs.size());
+				}
+			}
+			for(auto & leaf : bsp.leafs)
+			{
+				valid = valid and (size_t(leaf.firstBlock) + leaf.blockCount <= bsp.leafBlocks.size());
+				if(leaf.visibility >= 0 and size_t(leaf.visibility) >= bsp.pvs.size())
+					valid = false;
+			}
+			for(auto const index : bsp.leafBlocks)
+				valid = valid and (index < blockCount);
+
+			if(valid)
+				return bsp;
+
+			if(options.log_warnings())
+				std::cerr << "WMB Warning: " << fileName << " has an invalid BSP tree, ignoring it!" << std::endl;
+			return std::nullopt;
+		}
+
+		//! Decodes the object at the given file offset. The info object
+		//! is stored in info and yields nullopt.
+		std::optional<Level::Object> object(uint32_t offset, Info & info, bool & hasInfo)
 		{
-			f.seek(header.objects.offset + objoffets[i]);
+			f.seek(offset);
 			auto const type = f.read<OBJECT_TYPE>();
 			switch(type)
 			{
 				case OBJECT_TYPE::Info:
 				{
-					static constexpr std::array<unsigned int, 3> lightMapSizes =
-					{
-						256, 512, 1024
-					};
 					auto const inf = f.read<WMB_INFO>();
 
 					if(hasInfo)
 					{
 						if(options.log_warnings())
 							std::cerr << "WMB Warning: " << fileName << " has multiple Info objects defined!" << std::endl;
-						break;
+						return std::nullopt;
 					}
 
 					// assert(inf.flags == 0x7F);
 
-					Info info;
-
-					info.azimuth = inf.azimuth;
-					info.elevation = inf.elevation;
-					info.gamma = inf.gamma / 255.0f;
-					info.lightMapSize = lightMapSizes.at(inf.LMapSize);
-					info.sunColor = toColor(inf.dwSunColor);
-					info.ambientColor = toColor(inf.dwAmbientColor);
-					for(size_t i = 0; i < 4; i++)
-						info.fogColor[i] = toColor(inf.dwFogColor[i]);
-
-					level.info = info;
+					if(inf.LMapSize > 2)
+					{
+						invalid = true;
+						return std::nullopt;
+					}
+					info = toInfo(inf);
 
 					hasInfo = true;
 
-					break;
+					return std::nullopt;
 				}
 				case OBJECT_TYPE::Light:
 				{
@@ -604,9 +553,7 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 					light.color = glm::vec3(l.red, l.green, l.blue);
 					light.range = l.range;
 
-					level.objects.push_back(light);
-
-					break;
+					return light;
 				}
 				case OBJECT_TYPE::Path:
 				{
@@ -672,9 +619,7 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 						path.edges.push_back(edge);
 					}
 
-					level.objects.push_back(path);
-
-					break;
+					return path;
 				}
 				case OBJECT_TYPE::Position:
 				{
@@ -684,9 +629,8 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 					pos.name = toString(p.name);
 					pos.origin = mapVec(toVec3(p.origin));
 					pos.angle = toEuler(p.angle);
-					level.objects.push_back(pos);
 
-					break;
+					return pos;
 				}
 				case OBJECT_TYPE::Sound:
 				{
@@ -700,9 +644,7 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 					snd.range = s.range;
 					snd.volume = s.volume;
 
-					level.objects.push_back(snd);
-
-					break;
+					return snd;
 				}
 				case OBJECT_TYPE::Entity:
 				{
@@ -729,9 +671,7 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 					ent.string1 = toString(e.string1);
 					ent.string2 = toString(e.string2);
 
-					level.objects.push_back(ent);
-
-					break;
+					return ent;
 				}
 				case OBJECT_TYPE::OldEntity:
 				{
@@ -751,9 +691,7 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 					for(size_t i = 0; i < e.skill.size(); i++)
 						ent.skill[i] = e.skill[i];
 
-					level.objects.push_back(ent);
-
-					break;
+					return ent;
 				}
 				case OBJECT_TYPE::Region:
 				{
@@ -764,18 +702,309 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 					region.minimum = toVec3(reg.min);
 					region.maximum = toVec3(reg.max);
 
-					level.objects.push_back(region);
-					break;
+					return region;
 				}
 				default:
-					std::terminate();
+					invalid = true;
+					return std::nullopt;
+			}
+		}
+
+		//! Reads the block lightmap at the current file position.
+		Lightmap lightmap(unsigned int size)
+		{
+			Lightmap lm;
+			lm.width = size;
+			lm.height = size;
+			lm.object = std::nullopt;
+			lm.data = f.read(3 * lm.width * lm.height);
+			return lm;
+		}
+
+		//! Reads the terrain lightmap at the current file position.
+		Lightmap terrainLightmap()
+		{
+			auto const obj = f.read<LIGHTMAP_TERRAIN>();
+
+			Lightmap lm;
+			lm.width = obj.width;
+			lm.height = obj.height;
+			lm.object = obj.object;
+			lm.data = f.read(3 * lm.width * lm.height);
+			return lm;
+		}
+	};
+
+	using Record = LevelDigest::Record;
+
+	//! Reads a whole list into memory, empty lists yield no data.
+	std::vector<std::byte> readList(File & f, LIST const & list)
+	{
+		if(list.offset == 0)
+			return { };
+		f.seek(list.offset);
+		return f.read(list.length);
+	}
+
+	//! Hashes the records of a list that starts with a count and an offset
+	//! table. A record ends where the next one in file order starts.
+	std::vector<Record> tableRecords(LIST const & list, std::vector<std::byte> const & data)
+	{
+		if(data.size() < sizeof(uint32_t))
+			return { };
+
+		uint32_t count;
+		memcpy(&count, data.data(), sizeof count);
+		if(data.size() < sizeof(uint32_t) * (size_t(count) + 1))
+			return { };
+
+		std::vector<uint32_t> offsets(count);
+		memcpy(offsets.data(), data.data() + sizeof(uint32_t), sizeof(uint32_t) * count);
+
+		std::vector<uint32_t> sorted = offsets;
+		std::sort(sorted.begin(), sorted.end());
+
+		std::vector<Record> records;
+		records.reserve(count);
+		for(auto const offset : offsets)
+		{
+			auto const next = std::upper_bound(sorted.begin(), sorted.end(), offset);
+			size_t const begin = std::min<size_t>(offset, data.size());
+			size_t const end = (next != sorted.end()) ? std::min<size_t>(*next, data.size()) : data.size();
+			records.push_back(Record { list.offset + offset, hashBytes(data.data() + begin, end - begin) });
+		}
+		return records;
+	}
+
+	//! Hashes all lists and records of the file. Returns nullopt if a list
+	//! or record does not fit into the file.
+	std::optional<LevelDigest> computeDigest(File & f, WMB_HEADER const & header)
+	{
+		LevelDigest digest;
+
+		{
+			auto const data = readList(f, header.textures);
+			digest.textureList = hashBytes(data.data(), data.size());
+			digest.textures = tableRecords(header.textures, data);
+		}
+
+		{
+			auto const data = readList(f, header.materials);
+			digest.materialList = hashBytes(data.data(), data.size());
+		}
+
+		{
+			auto const data = readList(f, header.blocks);
+			digest.blockList = hashBytes(data.data(), data.size());
+
+			if(data.size() >= sizeof(uint32_t))
+			{
+				uint32_t count;
+				memcpy(&count, data.data(), sizeof count);
+
+				size_t offset = sizeof(uint32_t);
+				digest.blocks.reserve(count);
+				for(size_t i = 0; i < count; i++)
+				{
+					if(offset + sizeof(BLOCK) > data.size())
+						return std::nullopt;
+					BLOCK bl;
+					memcpy(&bl, data.data() + offset, sizeof bl);
+					size_t const length = sizeof(BLOCK) +
+						size_t(bl.lNumVerts) * sizeof(VERTEX) +
+						size_t(bl.lNumTris) * sizeof(TRIANGLE) +
+						size_t(bl.lNumSkins) * sizeof(SKIN);
+					if(offset + length > data.size())
+						return std::nullopt;
+					digest.blocks.push_back(Record { uint32_t(header.blocks.offset + offset), hashBytes(data.data() + offset, length) });
+					offset += length;
+				}
+			}
+		}
+
+		unsigned int lightMapSize = 0;
+		{
+			auto const data = readList(f, header.objects);
+			digest.objectList = hashBytes(data.data(), data.size());
+			digest.objects = tableRecords(header.objects, data);
+
+			// The lightmap size is needed to split the lightmaps list
+			for(size_t i = 0; i < digest.objects.size(); i++)
+			{
+				size_t const offset = digest.objects[i].offset - header.objects.offset;
+				if(offset + sizeof(OBJECT_TYPE) + sizeof(WMB_INFO) > data.size())
+					continue;
+				OBJECT_TYPE type;
+				memcpy(&type, data.data() + offset, sizeof type);
+				if(type != OBJECT_TYPE::Info)
+					continue;
+				WMB_INFO inf;
+				memcpy(&inf, data.data() + offset + sizeof type, sizeof inf);
+				if(inf.LMapSize > 2)
+					return std::nullopt;
+				digest.infoRecord = i;
+				lightMapSize = toInfo(inf).lightMapSize;
+				break;
+			}
+		}
+
+		{
+			auto const data = readList(f, header.lightmaps);
+			digest.lightmapList = hashBytes(data.data(), data.size());
+			if(lightMapSize > 0)
+			{
+				size_t const length = 3 * lightMapSize * lightMapSize;
+				for(size_t offset = 0; offset + length <= data.size(); offset += length)
+					digest.lightmaps.push_back(Record { uint32_t(header.lightmaps.offset + offset), hashBytes(data.data() + offset, length) });
+			}
+		}
+
+		{
+			auto const data = readList(f, header.lightmaps_terrain);
+			digest.terrainLightmapList = hashBytes(data.data(), data.size());
+
+			if(data.size() >= sizeof(uint32_t))
+			{
+				uint32_t count;
+				memcpy(&count, data.data(), sizeof count);
+
+				size_t offset = sizeof(uint32_t);
+				for(size_t i = 0; i < count; i++)
+				{
+					if(offset + sizeof(LIGHTMAP_TERRAIN) > data.size())
+						return std::nullopt;
+					LIGHTMAP_TERRAIN lm;
+					memcpy(&lm, data.data() + offset, sizeof lm);
+					size_t const length = sizeof(LIGHTMAP_TERRAIN) + 3 * size_t(lm.width) * lm.height;
+					if(offset + length > data.size())
+						return std::nullopt;
+					digest.terrainLightmaps.push_back(Record { uint32_t(header.lightmaps_terrain.offset + offset), hashBytes(data.data() + offset, length) });
+					offset += length;
+				}
 			}
 		}
+
+		for(auto const * list : { &header.bsp_nodes, &header.bsp_leafs, &header.bsp_blocks, &header.pvs })
+		{
+			auto const data = readList(f, *list);
+			digest.bspLists = hashBytes(data.data(), data.size(), digest.bspLists);
+		}
+
+		if(f.truncated)
+			return std::nullopt;
+		return digest;
+	}
+
+	//! Compares the records and returns the indices of the new or changed ones.
+	std::vector<size_t> changedRecords(std::vector<Record> const & previous, std::vector<Record> const & current)
+	{
+		std::vector<size_t> changed;
+		for(size_t i = 0; i < current.size(); i++)
+		{
+			if(i >= previous.size() or previous[i].hash != current[i].hash)
+				changed.push_back(i);
+		}
+		return changed;
+	}
+}
+
+std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const & options)
+{
+	File f(fopen(fileName.c_str(), "rb"));
+	if(not f)
+		return std::nullopt;
+
+	Decoder decoder(f, fileName, options);
+
+	Level level;
+	level.info = Info { }; // a file without info object is rejected below
+
+	WMB_HEADER header = f.read<WMB_HEADER>();
+	if(memcmp(header.version.data(), "WMB7", 4) != 0)
+		return std::nullopt;
+
+	// Load textures
+	if(header.textures.offset != 0)
+	{
+		auto const offsets = decoder.offsetTable(header.textures);
+		if(options.pool_textures())
+		{
+			level.textures = decoder.pooledTextures(header.textures, offsets);
+		}
+		else
+		{
+			level.textures.reserve(offsets.size());
+			for(auto const offset : offsets)
+				level.textures.push_back(decoder.texture(header.textures.offset + offset));
+		}
+	}
+
+	// Load materials
+	if(header.materials.offset != 0)
+		level.materials = decoder.materials(header.materials);
+
+	// Load blocks
+	if(header.blocks.offset != 0)
+	{
+		f.seek(header.blocks.offset);
+
+		auto const blockcount = f.read<uint32_t>();
+		level.blocks.reserve(blockcount);
+
+		WeldStats welded;
+		for(size_t idx = 0; idx < blockcount; idx++)
+			level.blocks.push_back(decoder.block(welded));
+
+		if(options.weld and options.log_verbose())
+			std::cerr << "WMB: " << fileName << ": welded " << welded.verticesRemoved << " vertices, dropped "
+			          << welded.trianglesRemoved << " triangles, saved " << welded.bytesSaved << " bytes" << std::endl;
+
+		if(options.compute_frames())
+		{
+			FrameOptions frameOptions;
+			frameOptions.coordinateSystem = options.targetCoordinateSystem;
+			auto const framed = computeFrames(level, frameOptions);
+			if(framed.blocksSkipped > 0 and options.log_warnings())
+				std::cerr << "WMB Warning: " << fileName << ": " << framed.blocksSkipped << " blocks have too many vertices for frames!" << std::endl;
+		}
+	}
+
+	// Load BSP tree
+	level.bspLists = decoder.bspLists(header);
+	if(options.decode_bsp())
+		level.bsp = decoder.bsp(header, level.blocks.size());
+
+	// Load objects
+	{
+		bool hasInfo = false;
+		for(auto const offset : decoder.offsetTable(header.objects))
+		{
+			bool const hadInfo = hasInfo;
+			auto obj = decoder.object(header.objects.offset + offset, level.info, hasInfo);
+			if(hasInfo and not hadInfo)
+				level.infoIndex = level.objects.size();
+			if(obj)
+				level.objects.push_back(std::move(*obj));
+		}
+	}
+
+	if(options.index_entities())
+		level.entityIndex = buildEntityIndex(level);
+
+	if(decoder.invalid)
+	{
+		if(options.log_errors())
+			std::cerr << "WMB Error: " << fileName << " has an unknown texture format, object type or lightmap size!" << std::endl;
+		return std::nullopt;
 	}
 
 	// check for lightmap resolution valid
 	if(level.info.lightMapSize == 0)
-		std::terminate();
+	{
+		if(options.log_errors())
+			std::cerr << "WMB Error: " << fileName << " has no valid info object!" << std::endl;
+		return std::nullopt;
+	}
 
 	// Load lightmaps
 	if(header.lightmaps.offset != 0)
@@ -785,15 +1014,7 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 		size_t const lmcount = header.lightmaps.length / (3 * level.info.lightMapSize * level.info.lightMapSize);
 
 		for(size_t i = 0; i < lmcount; i++)
-		{
-			Lightmap lm;
-			lm.width = level.info.lightMapSize;
-			lm.height = level.info.lightMapSize;
-			lm.object = std::nullopt;
-			lm.data = f.read(3 * lm.width * lm.height);
-
-			level.lightmaps.push_back(lm);
-		}
+			level.lightmaps.push_back(decoder.lightmap(level.info.lightMapSize));
 	}
 
 	// Load terrain lightmaps
@@ -804,17 +1025,253 @@ std::optional<Level> WMB::load(std::string const & fileName, LoadOptions const &
 		auto const lmcount = f.read<uint32_t>();
 
 		for(size_t i = 0; i < lmcount; i++)
+			level.terrain_lightmaps.push_back(decoder.terrainLightmap());
+	}
+
+	if(options.track_changes())
+	{
+		level.digest = computeDigest(f, header);
+		if(not level.digest and options.log_warnings())
+			std::cerr << "WMB Warning: " << fileName << " is truncated, changes cannot be tracked!" << std::endl;
+	}
+
+	return level;
+}
+
+std::optional<LevelChanges> WMB::reload(Level & level, std::string const & fileName, LoadOptions const & options)
+{
+	LoadOptions tracking = options;
+	tracking.flags.set(LoadOptions::TRACK_CHANGES);
+
+	if(not level.digest)
+	{
+		auto fresh = load(fileName, tracking);
+		if(not fresh)
+			return std::nullopt;
+		level = std::move(*fresh);
+
+		auto const all = [](size_t count)
 		{
-			auto const obj = f.read<LIGHTMAP_TERRAIN>();
+			std::vector<size_t> indices(count);
+			for(size_t i = 0; i < count; i++)
+				indices[i] = i;
+			return indices;
+		};
 
-			Lightmap lm;
-			lm.width = obj.width;
-			lm.width = obj.height;
-			lm.object = obj.object;
-			lm.data = f.read(3 * lm.width * lm.height);
-			level.terrain_lightmaps.push_back(lm);
+		LevelChanges changes;
+		changes.textures = all(level.textures.size());
+		changes.blocks = all(level.blocks.size());
+		changes.objects = all(level.objects.size());
+		changes.lightmaps = all(level.lightmaps.size());
+		changes.terrainLightmaps = all(level.terrain_lightmaps.size());
+		changes.materials = true;
+		changes.info = true;
+		changes.bsp = true;
+		return changes;
+	}
+
+	File f(fopen(fileName.c_str(), "rb"));
+	if(not f)
+		return std::nullopt;
+
+	WMB_HEADER header = f.read<WMB_HEADER>();
+	if(f.truncated or memcmp(header.version.data(), "WMB7", 4) != 0)
+		return std::nullopt;
+
+	auto digest = computeDigest(f, header);
+	if(not digest or not digest->infoRecord)
+		return std::nullopt;
+
+	LevelDigest const & previous = *level.digest;
+	Decoder decoder(f, fileName, tracking);
+	LevelChanges changes;
+
+	// Everything is decoded before the level is touched, so a file that
+	// cannot be read leaves the level as it was.
+
+	std::vector<Texture> textures;
+	if(digest->textureList != previous.textureList)
+	{
+		changes.textures = changedRecords(previous.textures, digest->textures);
+		for(auto const i : changes.textures)
+			textures.push_back(decoder.texture(digest->textures[i].offset));
+	}
+
+	std::vector<Material> materials;
+	if(digest->materialList != previous.materialList)
+	{
+		changes.materials = true;
+		if(header.materials.offset != 0)
+			materials = decoder.materials(header.materials);
+	}
+
+	std::vector<Block> blocks;
+	if(digest->blockList != previous.blockList)
+	{
+		WeldStats welded;
+		changes.blocks = changedRecords(previous.blocks, digest->blocks);
+		FrameOptions frameOptions;
+		frameOptions.coordinateSystem = options.targetCoordinateSystem;
+		for(auto const i : changes.blocks)
+		{
+			f.seek(digest->blocks[i].offset);
+			blocks.push_back(decoder.block(welded));
+			if(options.compute_frames())
+				computeFrames(blocks.back(), frameOptions);
+		}
+	}
+
+	// The tree references the blocks by index, so it is validated again
+	// when the number of blocks changes.
+	std::optional<BspLists> bspLists;
+	std::optional<Bsp> bsp;
+	if(digest->bspLists != previous.bspLists or digest->blocks.size() != previous.blocks.size())
+	{
+		changes.bsp = true;
+		bspLists = decoder.bspLists(header);
+		if(options.decode_bsp())
+			bsp = decoder.bsp(header, digest->blocks.size());
+	}
+
+	// The info object is not part of Level::objects, so the records can
+	// only be replaced one by one while it stays at the same place.
+	Info info = level.info;
+	std::optional<size_t> infoIndex = level.infoIndex;
+	std::vector<Level::Object> objects;
+	bool allObjects = false;
+	if(digest->objectList != previous.objectList)
+	{
+		size_t const infoRecord = *digest->infoRecord;
+
+		changes.info = (not previous.infoRecord) or (previous.objects[*previous.infoRecord].hash != digest->objects[infoRecord].hash);
+		if(changes.info)
+		{
+			bool hasInfo = false;
+			decoder.object(digest->objects[infoRecord].offset, info, hasInfo);
+		}
+
+		auto const decodeObjects = [&](bool all)
+		{
+			objects.clear();
+			changes.objects.clear();
+
+			bool hasInfo = true; // further info objects are ignored
+			for(size_t i = 0; i < digest->objects.size(); i++)
+			{
+				if(i == infoRecord)
+				{
+					if(all)
+						infoIndex = objects.size();
+					continue;
+				}
+				bool const changed = (i >= previous.objects.size()) or (previous.objects[i].hash != digest->objects[i].hash);
+				if(not all and not changed)
+					continue;
+
+				auto obj = decoder.object(digest->objects[i].offset, info, hasInfo);
+				if(not obj)
+				{
+					if(all)
+						continue;
+					return false; // the record does not map to an object anymore
+				}
+
+				changes.objects.push_back(all ? objects.size() : (i > infoRecord ? i - 1 : i));
+				objects.push_back(std::move(*obj));
+			}
+			return true;
+		};
+
+		allObjects = (digest->objects.size() != previous.objects.size())
+		          or (digest->infoRecord != previous.infoRecord)
+		          or (level.objects.size() + 1 != previous.objects.size());
+		if(not allObjects and not decodeObjects(false))
+			allObjects = true;
+		if(allObjects)
+			decodeObjects(true);
+	}
+
+	// A different lightmap size changes the split of the lightmaps list
+	bool const resized = (info.lightMapSize != level.info.lightMapSize);
+	std::vector<Lightmap> lightmaps;
+	if(resized or digest->lightmapList != previous.lightmapList)
+	{
+		changes.lightmaps = resized ?
+			changedRecords({ }, digest->lightmaps) :
+			changedRecords(previous.lightmaps, digest->lightmaps);
+		for(auto const i : changes.lightmaps)
+		{
+			f.seek(digest->lightmaps[i].offset);
+			lightmaps.push_back(decoder.lightmap(info.lightMapSize));
+		}
+	}
+
+	std::vector<Lightmap> terrainLightmaps;
+	if(digest->terrainLightmapList != previous.terrainLightmapList)
+	{
+		changes.terrainLightmaps = changedRecords(previous.terrainLightmaps, digest->terrainLightmaps);
+		for(auto const i : changes.terrainLightmaps)
+		{
+			f.seek(digest->terrainLightmaps[i].offset);
+			terrainLightmaps.push_back(decoder.terrainLightmap());
 		}
 	}
 
-	return std::move(level);
+	if(f.truncated or decoder.invalid or info.lightMapSize == 0)
+		return std::nullopt;
+
+	// Apply the changes
+	auto const apply = [](auto & list, size_t count, std::vector<size_t> const & indices, auto & items)
+	{
+		list.resize(count);
+		for(size_t i = 0; i < indices.size(); i++)
+			list[indices[i]] = std::move(items[i]);
+	};
+
+	if(digest->textureList != previous.textureList)
+	{
+		apply(level.textures, digest->textures.size(), changes.textures, textures);
+		if(options.pool_textures())
+			packTextures(level, options.textureAlignment);
+	}
+
+	// Unchanged textures can still have moved in the file, the places of
+	// their levels that are not loaded yet move with them.
+	{
+		std::vector<bool> replaced(digest->textures.size(), false);
+		for(auto const i : changes.textures)
+			replaced[i] = true;
+		for(size_t i = 0; i < std::min({ previous.textures.size(), digest->textures.size(), level.textures.size() }); i++)
+		{
+			if(replaced[i] or previous.textures[i].offset == digest->textures[i].offset)
+				continue;
+			for(auto & span : level.textures[i].pendingLevels)
+				span.offset = span.offset - previous.textures[i].offset + digest->textures[i].offset;
+		}
+	}
+
+	if(changes.materials)
+		level.materials = std::move(materials);
+	if(digest->blockList != previous.blockList)
+		apply(level.blocks, digest->blocks.size(), changes.blocks, blocks);
+	if(changes.bsp)
+	{
+		level.bspLists = std::move(bspLists);
+		level.bsp = std::move(bsp);
+	}
+	if(allObjects)
+		level.objects = std::move(objects);
+	else
+		apply(level.objects, level.objects.size(), changes.objects, objects);
+	if(not changes.objects.empty() and (level.entityIndex or options.index_entities()))
+		level.entityIndex = buildEntityIndex(level);
+	level.info = info;
+	level.infoIndex = infoIndex;
+	if(resized or digest->lightmapList != previous.lightmapList)
+		apply(level.lightmaps, digest->lightmaps.size(), changes.lightmaps, lightmaps);
+	if(digest->terrainLightmapList != previous.terrainLightmapList)
+		apply(level.terrain_lightmaps, digest->terrainLightmaps.size(), changes.terrainLightmaps, terrainLightmaps);
+
+	level.digest = std::move(digest);
+	return changes;
 }
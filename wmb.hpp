@@ -3,12 +3,15 @@
 
 #include <glm/glm.hpp>
 #include <string>
+#include <string_view>
 #include <optional>
 #include <vector>
 #include <cstddef>
+#include <cstdint>
 #include <variant>
 #include <array>
 #include <bitset>
+#include <memory>
 
 namespace WMB
 {
@@ -17,6 +20,43 @@ namespace WMB
 		float pan, tilt, roll;
 	};
 
+	//! Read-only view of a contiguous array that is owned elsewhere.
+	template<typename T>
+	struct View
+	{
+		T const * ptr = nullptr;
+		size_t count = 0;
+
+		T const * data() const { return ptr; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+
+		T const * begin() const { return ptr; }
+		T const * end() const { return ptr + count; }
+
+		T const & operator[](size_t i) const { return ptr[i]; }
+	};
+
+	using ByteView = View<std::byte>;
+
+	//! A range of bytes in a file.
+	struct FileSpan
+	{
+		size_t offset;
+		size_t size;
+	};
+
+	enum class BlockCompression
+	{
+		None = 0,
+		BC1 = 1, // DXT1, RGB with optional 1 bit alpha
+		BC2 = 2, // DXT3, RGBA with explicit 4 bit alpha
+		BC3 = 3, // DXT5, RGBA
+		BC4 = 4, // single channel
+		BC5 = 5, // two channels
+		BC7 = 7, // RGBA, high quality
+	};
+
 	struct Texture
 	{
 		enum Format
@@ -31,8 +71,44 @@ namespace WMB
 		unsigned int width, height;
 		Format format;
 		bool hasMipMaps;
+
+		// Uncompressed pixels are stored in BGR(A) byte order, or as
+		// little endian 565 words. When the texture is block compressed,
+		// the levels contain the compressed blocks and decode to RGB(A).
+		BlockCompression compression = BlockCompression::None;
 		std::vector<std::vector<std::byte>> levels;
 
+		// Pixel data shared between copies of the texture. When set, the
+		// mip levels are views into it and `levels` is empty. DDS textures
+		// keep the whole DDS file here. Textures packed with packTextures()
+		// share one pool for the whole level.
+		std::shared_ptr<std::vector<std::byte> const> storage;
+		std::vector<ByteView> mips;
+
+		// The largest levels are not loaded when the level was loaded with
+		// LoadOptions::STREAM_MIPS, level(0) is then the mip level
+		// `skippedLevels` of the texture. MipStreamer loads them later
+		// from the recorded places in the file, largest first.
+		unsigned int skippedLevels = 0;
+		std::vector<FileSpan> pendingLevels;
+
+		size_t levelCount() const {
+			return storage ? mips.size() : levels.size();
+		}
+
+		ByteView level(size_t i) const {
+			if(storage)
+				return mips.at(i);
+			auto const & lvl = levels.at(i);
+			return ByteView { lvl.data(), lvl.size() };
+		}
+
+		//! Offset of a mip level in the storage, only valid with storage.
+		size_t storageOffset(size_t i) const {
+			return static_cast<size_t>(mips.at(i).data() - storage->data());
+		}
+
+		//! Only valid for textures without shared storage, use level() otherwise.
 		std::vector<std::byte> & data() {
 			return levels.at(0);
 		}
@@ -46,7 +122,8 @@ namespace WMB
 	{
 		unsigned int width, height;
 		std::optional<unsigned int> object; // object for terrain lightmap or nullopt
-		std::vector<std::byte> data; // encoded in BGR
+		BlockCompression compression = BlockCompression::None;
+		std::vector<std::byte> data; // encoded in BGR, or compressed blocks that decode to RGB
 	};
 
 	struct Material
@@ -62,6 +139,13 @@ namespace WMB
 	    glm::vec2 lightmap; // lightmap coordinates
 	};
 
+	//! Shading frame of a vertex, see computeFrames().
+	struct VertexFrame
+	{
+		glm::vec3 normal;  // unit normal on the front side
+		glm::vec4 tangent; // unit tangent along +u, w = sign of the bitangent
+	};
+
 	struct Triangle
 	{
 		uint16_t v1,v2,v3; // indices into the VERTEX array
@@ -106,6 +190,53 @@ namespace WMB
 		std::vector<Vertex> vertices;
 		std::vector<Triangle> triangles;
 		std::vector<Skin> skins;
+		std::vector<VertexFrame> frames; // empty or one per vertex
+	};
+
+	struct BspNode
+	{
+		glm::vec3 normal; // points to the front side
+		float distance;   // a point p is in front when dot(normal, p) >= distance
+		std::array<int32_t, 2> children; // front and back child, negative numbers are -(leaf + 1)
+	};
+
+	struct BspLeaf
+	{
+		glm::vec3 minimum; // bounding box
+		glm::vec3 maximum; // bounding box
+		uint32_t firstBlock; // index into Bsp::leafBlocks
+		uint32_t blockCount; // number of blocks in this leaf
+		int32_t visibility;  // offset of the compressed PVS row in Bsp::pvs, -1 if everything is visible
+	};
+
+	struct Bsp
+	{
+		std::vector<BspNode> nodes; // node 0 is the root
+		std::vector<BspLeaf> leafs;
+		std::vector<uint32_t> leafBlocks; // indices into Level::blocks
+		std::vector<std::byte> pvs; // run-length encoded PVS rows, bit i = leaf i
+		size_t blockCount = 0;
+
+		//! Returns the leaf that contains the given point.
+		size_t leafAt(glm::vec3 const & point) const;
+
+		//! Decompresses the PVS row of a leaf. Bit (i % 64) of word (i / 64)
+		//! is set when leaf i is potentially visible from the given leaf.
+		std::vector<uint64_t> visibleLeafs(size_t leaf) const;
+
+		//! Returns the sorted indices of all blocks that are potentially
+		//! visible from the given leaf.
+		std::vector<uint32_t> visibleBlocks(size_t leaf) const;
+	};
+
+	//! The BSP lists as stored in the file. save() writes them back
+	//! unchanged, they reference the blocks by index.
+	struct BspLists
+	{
+		std::vector<std::byte> nodes;
+		std::vector<std::byte> leafs;
+		std::vector<std::byte> blocks; // block indices of the leafs
+		std::vector<std::byte> pvs;
 	};
 
 	struct Info
@@ -252,24 +383,181 @@ namespace WMB
 		Region = 5,
 	};
 
+	//! Open addressing hash table from strings to lists of object indices.
+	//! The keys are stored back to back in one string, the lists in one
+	//! index array, so the table only needs a few allocations.
+	struct StringIndex
+	{
+		std::string keys;              // all keys back to back
+		std::vector<uint32_t> keyOffsets; // key i is keys[keyOffsets[i], keyOffsets[i + 1])
+		std::vector<uint32_t> keyHashes;  // to skip most string compares
+		std::vector<uint32_t> rowOffsets; // key i maps to rows[rowOffsets[i], rowOffsets[i + 1])
+		std::vector<uint32_t> rows;       // indices into Level::objects, ascending per key
+		std::vector<uint32_t> slots;      // key + 1 or 0 for empty slots, the size is a power of two
+
+		size_t size() const { return keyHashes.size(); }
+
+		//! Returns the indices of the objects with the given key.
+		View<uint32_t> find(std::string_view key) const;
+	};
+
+	//! Lookup tables for the entities in Level::objects.
+	struct EntityIndex
+	{
+		StringIndex names;
+		StringIndex actions;
+		StringIndex fileNames;
+
+		//! Returns the first entity with the given name.
+		std::optional<uint32_t> byName(std::string_view name) const;
+
+		View<uint32_t> byAction(std::string_view action) const { return actions.find(action); }
+		View<uint32_t> byFileName(std::string_view fileName) const { return fileNames.find(fileName); }
+	};
+
+	//! Hashes of the lists and records of the file a level was loaded
+	//! from. reload() compares them with the file on disk to find the
+	//! records that changed.
+	struct LevelDigest
+	{
+		struct Record
+		{
+			uint32_t offset; // file offset of the record
+			uint64_t hash;
+		};
+
+		// hashes of the whole lists
+		uint64_t textureList = 0;
+		uint64_t materialList = 0;
+		uint64_t blockList = 0;
+		uint64_t objectList = 0;
+		uint64_t lightmapList = 0;
+		uint64_t terrainLightmapList = 0;
+		uint64_t bspLists = 0; // nodes, leafs, block lists and PVS
+
+		std::vector<Record> textures;
+		std::vector<Record> blocks;
+		std::vector<Record> objects; // in file order, including the info object
+		std::vector<Record> lightmaps;
+		std::vector<Record> terrainLightmaps;
+
+		std::optional<size_t> infoRecord; // index of the info object in objects
+	};
+
 	struct Level
 	{
+		using Object = std::variant<
+			Position,
+			Light,
+			Sound,
+			Path,
+			Entity,
+			Region
+		>;
+
 		Info info;
 
+		//! Place of the info object in the object list of the file, the
+		//! indices of Entity::attachedEntity and Lightmap::object count
+		//! it. save() writes it after the other objects when not set.
+		std::optional<size_t> infoIndex;
+
 		std::vector<Texture> textures;
 		std::vector<Material> materials;
 		std::vector<Lightmap> lightmaps;
 		std::vector<Lightmap> terrain_lightmaps;
 		std::vector<Block> blocks;
+		std::optional<BspLists> bspLists; // only for BSP compiled levels
+		std::optional<Bsp> bsp; // only with LoadOptions::DECODE_BSP and a valid tree, see LOG_WARNINGS
 
-		std::vector<std::variant<
-			Position,
-			Light,
-			Sound,
-			Path,
-			Entity,
-			Region
-		>> objects;
+		std::vector<Object> objects;
+
+		// only when loaded with LoadOptions::TRACK_CHANGES
+		std::optional<LevelDigest> digest;
+
+		// only when loaded with LoadOptions::INDEX_ENTITIES
+		std::optional<EntityIndex> entityIndex;
+	};
+
+	//! Indices of the records that reload() decoded again. Lists that got
+	//! shorter are truncated, compare the sizes to find removed records.
+	struct LevelChanges
+	{
+		std::vector<size_t> textures;
+		std::vector<size_t> blocks;
+		std::vector<size_t> objects;
+		std::vector<size_t> lightmaps;
+		std::vector<size_t> terrainLightmaps;
+		bool materials = false;
+		bool info = false;
+		bool bsp = false;
+
+		bool empty() const {
+			return textures.empty() and blocks.empty() and objects.empty() and lightmaps.empty()
+			   and terrainLightmaps.empty() and not materials and not info and not bsp;
+		}
+	};
+
+	struct WeldOptions
+	{
+		// A vertex is merged into the first kept vertex whose attributes
+		// all differ by at most the given epsilon per component. An epsilon
+		// of 0 requires an exact match, NaN only matches the same bits.
+		float positionEpsilon = 0.0f;
+		float uvEpsilon = 0.0f;
+		float lightmapEpsilon = 0.0f;
+	};
+
+	struct WeldStats
+	{
+		size_t verticesRemoved = 0;
+		size_t trianglesRemoved = 0; // degenerate triangles after remapping
+		size_t bytesSaved = 0;
+
+		WeldStats & operator+=(WeldStats const & other);
+	};
+
+	struct BlockHeader
+	{
+		glm::vec3 bbMin; // bounding box
+		glm::vec3 bbMax; // bounding box
+		size_t vertexCount;
+		size_t triangleCount;
+		size_t skinCount;
+	};
+
+	//! Metadata of a WMB file that can be read without loading it.
+	struct LevelProbe
+	{
+		size_t fileSize = 0;
+
+		size_t textureCount = 0;
+		size_t materialCount = 0;
+		size_t blockCount = 0;
+		size_t objectCount = 0; // including the info object
+		size_t lightmapCount = 0;
+		size_t terrainLightmapCount = 0;
+
+		// totals over all blocks, to presize buffers
+		size_t vertexCount = 0;
+		size_t triangleCount = 0;
+		size_t skinCount = 0;
+
+		// list sizes in bytes
+		size_t textureBytes = 0;
+		size_t materialBytes = 0;
+		size_t blockBytes = 0;
+		size_t objectBytes = 0;
+		size_t lightmapBytes = 0;
+		size_t terrainLightmapBytes = 0;
+		size_t bspBytes = 0; // nodes, leafs, block lists and PVS
+
+		glm::vec3 bbMin; // union of all block bounds
+		glm::vec3 bbMax; // union of all block bounds
+		std::vector<BlockHeader> blocks;
+
+		std::optional<Info> info;
+		bool hasBsp = false;
 	};
 
 	struct LoadOptions
@@ -285,21 +573,131 @@ namespace WMB
 		{
 			LOG_WARNINGS = 0,
 			LOG_ERRORS = 1,
-			LOG_VERBOSE = 2
+			LOG_VERBOSE = 2,
+			TRACK_CHANGES = 3, // keep a digest of the file for reload()
+			INDEX_ENTITIES = 4, // build Level::entityIndex
+			POOL_TEXTURES = 5,  // read all mip levels into one buffer, see packTextures()
+			COMPUTE_FRAMES = 6, // fill Block::frames, see computeFrames()
+			STREAM_MIPS = 7,    // skip the mip levels larger than streamedMipSize, see MipStreamer
+			DECODE_BSP = 8,     // fill Level::bsp, the record layout is assumed, see BSP_NODE
 		};
 
 		//! Converts the WMB coordinates into the given coordinate system.
 		CoordinateSystem targetCoordinateSystem = Gamestudio;
 
-		std::bitset<3> flags = LOG_WARNINGS | LOG_ERRORS;
+		std::bitset<16> flags = LOG_WARNINGS | LOG_ERRORS;
+
+		//! Alignment of the mip levels in the texture pool.
+		size_t textureAlignment = 16;
+
+		//! Largest edge of the mip levels that are loaded with STREAM_MIPS.
+		//! The smallest level of each texture is always loaded.
+		unsigned int streamedMipSize = 64;
+
+		//! Welds duplicated vertices of each block while loading.
+		std::optional<WeldOptions> weld;
 
 
 		bool log_warnings() const { return flags.test(LOG_WARNINGS); }
 		bool log_errors()   const { return flags.test(LOG_ERRORS); }
 		bool log_verbose()  const { return flags.test(LOG_VERBOSE); }
+		bool track_changes() const { return flags.test(TRACK_CHANGES); }
+		bool index_entities() const { return flags.test(INDEX_ENTITIES); }
+		bool pool_textures() const { return flags.test(POOL_TEXTURES); }
+		bool compute_frames() const { return flags.test(COMPUTE_FRAMES); }
+		bool stream_mips() const { return flags.test(STREAM_MIPS); }
+		bool decode_bsp() const { return flags.test(DECODE_BSP); }
+	};
+
+	struct FrameOptions
+	{
+		//! The coordinate system the level was loaded with, it decides
+		//! which side of a triangle is the front.
+		LoadOptions::CoordinateSystem coordinateSystem = LoadOptions::Gamestudio;
+
+		unsigned int threads = 0; // 0 = one thread per core
+	};
+
+	struct FrameStats
+	{
+		size_t verticesAdded = 0; // split at flat edges and mirrored texture coordinates
+		size_t blocksSkipped = 0; // the split vertices would not fit into 16 bit indices
+
+		FrameStats & operator+=(FrameStats const & other);
+	};
+
+	struct SaveOptions
+	{
+		enum Flags
+		{
+			STRIP_TEXTURES = 0,  // drop textures that no skin references
+			STRIP_MATERIALS = 1, // drop materials that no skin or entity references
+			ALIGN_ARRAYS = 2,    // align list starts and texture pixels to 16 bytes, block vertices stay packed
+		};
+
+		//! The coordinate system the level was loaded with, it is converted
+		//! back into Gamestudio coordinates when writing.
+		LoadOptions::CoordinateSystem sourceCoordinateSystem = LoadOptions::Gamestudio;
+
+		std::bitset<3> flags;
+
+		bool strip_textures()  const { return flags.test(STRIP_TEXTURES); }
+		bool strip_materials() const { return flags.test(STRIP_MATERIALS); }
+		bool align_arrays()    const { return flags.test(ALIGN_ARRAYS); }
 	};
 
 	std::optional<Level> load(std::string const & fileName, LoadOptions const & options = LoadOptions());
+
+	//! Copies the mip levels of all textures into one buffer that becomes
+	//! the storage of every texture. Each level starts at a multiple of
+	//! the alignment, so the whole pool can be uploaded with one copy and
+	//! Texture::storageOffset() gives the place of each level. DDS
+	//! textures are written as new DDS images afterwards, except cube maps
+	//! and arrays, which keep their DDS file as storage.
+	void packTextures(Level & level, size_t alignment = 16);
+
+	//! Builds the name, action and file name tables in one pass over the
+	//! objects of the level.
+	EntityIndex buildEntityIndex(Level const & level);
+
+	//! Updates a level loaded with LoadOptions::TRACK_CHANGES from a new
+	//! version of its file. Only the records whose hashes changed are
+	//! decoded again, the options must match the ones used for loading.
+	//! The entity index is rebuilt when objects changed. Levels without a
+	//! digest are loaded completely. Returns nullopt and leaves the level
+	//! untouched if the file could not be read.
+	std::optional<LevelChanges> reload(Level & level, std::string const & fileName, LoadOptions const & options = LoadOptions());
+
+	//! Reads the list headers, the count and offset tables and the block
+	//! headers of a WMB file, but no vertex, pixel or object data. Only the
+	//! coordinate system of the options is used.
+	std::optional<LevelProbe> probe(std::string const & fileName, LoadOptions const & options = LoadOptions());
+
+	//! Writes the level as a WMB7 file. The lists are written in the order
+	//! the loader reads them. Block compressed textures are stored as DDS
+	//! images, the BSP lists are copied from Level::bspLists and Level::bsp
+	//! is not written. Returns false if the file could not be written, the level
+	//! contains block compressed lightmaps or textures with skipped levels.
+	bool save(Level const & level, std::string const & fileName, SaveOptions const & options = SaveOptions());
+
+	//! Merges duplicated vertices, remaps the triangles and drops
+	//! triangles that became degenerate.
+	WeldStats weld(Block & block, WeldOptions const & options = WeldOptions());
+	WeldStats weld(Level & level, WeldOptions const & options = WeldOptions());
+
+	//! Computes a normal and tangent for every vertex of the block.
+	//! Triangles of smooth skins share the sum of their face normals,
+	//! weighted by the corner angles, at every position. Triangles of
+	//! other skins keep their face normal. The tangents follow the texture
+	//! coordinates like MikkTSpace does, but are not bit exact to it.
+	//! Vertices that need more than one frame are duplicated at the end
+	//! of the vertex array, so the existing indices stay valid. Vertices
+	//! without a triangle get a zero frame.
+	FrameStats computeFrames(Block & block, FrameOptions const & options = FrameOptions());
+
+	//! Computes the frames of all blocks, the blocks are split between
+	//! the threads.
+	FrameStats computeFrames(Level & level, FrameOptions const & options = FrameOptions());
 }
 
 #endif // WMB_HPP
@@ -1,5 +1,39 @@
 
-SOURCES += $$PWD/wmb.cpp
-HEADERS += $$PWD/wmb.hpp
+SOURCES += $$PWD/wmb.cpp \
+           $$PWD/wmb_weld.cpp \
+           $$PWD/wmb_quantize.cpp \
+           $$PWD/wmb_cull.cpp \
+           $$PWD/wmb_bsp.cpp \
+           $$PWD/wmb_write.cpp \
+           $$PWD/wmb_compress.cpp \
+           $$PWD/wmb_dds.cpp \
+           $$PWD/wmb_probe.cpp \
+           $$PWD/wmb_index.cpp \
+           $$PWD/wmb_lights.cpp \
+           $$PWD/wmb_pool.cpp \
+           $$PWD/wmb_frames.cpp \
+           $$PWD/wmb_meshlets.cpp \
+           $$PWD/wmb_lod.cpp \
+           $$PWD/wmb_cache.cpp \
+           $$PWD/wmb_stream.cpp \
+           $$PWD/wmb_mipstream.cpp \
+           $$PWD/wmb_paths.cpp \
+           $$PWD/wmb_bake.cpp
+HEADERS += $$PWD/wmb.hpp \
+           $$PWD/wmb_format.hpp \
+           $$PWD/wmb_quantize.hpp \
+           $$PWD/wmb_cull.hpp \
+           $$PWD/wmb_compress.hpp \
+           $$PWD/wmb_lights.hpp \
+           $$PWD/wmb_meshlets.hpp \
+           $$PWD/wmb_lod.hpp \
+           $$PWD/wmb_cache.hpp \
+           $$PWD/wmb_stream.hpp \
+           $$PWD/wmb_mipstream.hpp \
+           $$PWD/wmb_paths.hpp \
+           $$PWD/wmb_bake.hpp \
+           $$PWD/wmb_parallel.hpp
 
 INCLUDEPATH += $$PWD
+
+CONFIG += thread
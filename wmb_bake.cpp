@@ -0,0 +1,670 @@
+#include "wmb_bake.hpp"
+#include "wmb_format.hpp"
+#include "wmb_parallel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	glm::vec3 normalizeOrZero(glm::vec3 const & v)
+	{
+		float const len = glm::length(v);
+		return (len > 0.0f) ? v / len : glm::vec3(0.0f);
+	}
+
+	struct Box
+	{
+		glm::vec3 minimum = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 maximum = glm::vec3(-std::numeric_limits<float>::max());
+
+		bool empty() const
+		{
+			return minimum.x > maximum.x;
+		}
+
+		void extend(glm::vec3 const & p)
+		{
+			minimum = glm::min(minimum, p);
+			maximum = glm::max(maximum, p);
+		}
+
+		void extend(Box const & box)
+		{
+			if(box.empty())
+				return;
+			extend(box.minimum);
+			extend(box.maximum);
+		}
+
+		float halfArea() const
+		{
+			if(empty())
+				return 0.0f;
+			glm::vec3 const d = maximum - minimum;
+			return d.x * d.y + d.y * d.z + d.z * d.x;
+		}
+
+		float distance(glm::vec3 const & p) const
+		{
+			glm::vec3 const d = glm::max(glm::max(minimum - p, p - maximum), glm::vec3(0.0f));
+			return glm::length(d);
+		}
+	};
+
+	//! Bounding volume hierarchy over the shadow casting triangles. The
+	//! nodes are stored depth first, so the left child of an inner node
+	//! follows it directly.
+	class Bvh
+	{
+	public:
+		explicit Bvh(std::vector<std::array<glm::vec3, 3>> const & triangles)
+		{
+			if(triangles.empty())
+				return;
+
+			std::vector<Reference> references(triangles.size());
+			for(size_t i = 0; i < triangles.size(); i++)
+			{
+				auto & ref = references[i];
+				ref.triangle = static_cast<uint32_t>(i);
+				for(auto const & p : triangles[i])
+					ref.bounds.extend(p);
+				ref.centroid = (triangles[i][0] + triangles[i][1] + triangles[i][2]) / 3.0f;
+			}
+
+			nodes.reserve(2 * triangles.size() / leafSize + 1);
+			build(references, 0, references.size(), 0);
+
+			this->triangles.reserve(triangles.size());
+			for(auto const & ref : references)
+			{
+				auto const & p = triangles[ref.triangle];
+				this->triangles.push_back(Triangle { p[0], p[1] - p[0], p[2] - p[0] });
+			}
+		}
+
+		//! True if a triangle is hit between the origin and the distance
+		//! along the unit direction.
+		bool occluded(glm::vec3 const & origin, glm::vec3 const & direction, float distance) const
+		{
+			if(nodes.empty())
+				return false;
+
+			glm::vec3 inverse;
+			for(int i = 0; i < 3; i++)
+			{
+				float const d = (std::abs(direction[i]) > 1e-20f) ? direction[i] : std::copysign(1e-20f, direction[i]);
+				inverse[i] = 1.0f / d;
+			}
+
+			uint32_t stack[maxDepth + 1];
+			size_t size = 0;
+			uint32_t index = 0;
+			while(true)
+			{
+				auto const & node = nodes[index];
+				if(hitsBox(node, origin, inverse, distance))
+				{
+					if(node.count == 0)
+					{
+						stack[size++] = node.index;
+						index = index + 1;
+						continue;
+					}
+					for(uint32_t i = node.index; i < node.index + node.count; i++)
+					{
+						if(hitsTriangle(triangles[i], origin, direction, distance))
+							return true;
+					}
+				}
+				if(size == 0)
+					return false;
+				index = stack[--size];
+			}
+		}
+
+	private:
+		static constexpr size_t leafSize = 4;
+		static constexpr size_t maxDepth = 60;
+		static constexpr size_t binCount = 16;
+
+		struct Node
+		{
+			glm::vec3 minimum;
+			uint32_t index; // first triangle of a leaf, right child of an inner node
+			glm::vec3 maximum;
+			uint32_t count; // triangles of a leaf, 0 for inner nodes
+		};
+
+		struct Triangle
+		{
+			glm::vec3 v0, e1, e2;
+		};
+
+		struct Reference
+		{
+			Box bounds;
+			glm::vec3 centroid;
+			uint32_t triangle;
+		};
+
+		std::vector<Node> nodes;
+		std::vector<Triangle> triangles;
+
+		//! Splits the references with a binned surface area heuristic.
+		void build(std::vector<Reference> & refs, size_t begin, size_t end, size_t depth)
+		{
+			size_t const node = nodes.size();
+			nodes.emplace_back();
+
+			Box bounds, centroids;
+			for(size_t i = begin; i < end; i++)
+			{
+				bounds.extend(refs[i].bounds);
+				centroids.extend(refs[i].centroid);
+			}
+			nodes[node].minimum = bounds.minimum;
+			nodes[node].maximum = bounds.maximum;
+
+			auto const makeLeaf = [&]()
+			{
+				nodes[node].index = static_cast<uint32_t>(begin);
+				nodes[node].count = static_cast<uint32_t>(end - begin);
+			};
+
+			size_t const count = end - begin;
+			glm::vec3 const extent = centroids.maximum - centroids.minimum;
+			int axis = 0;
+			if(extent.y > extent[axis])
+				axis = 1;
+			if(extent.z > extent[axis])
+				axis = 2;
+			if(count <= leafSize or depth >= maxDepth or not (extent[axis] > 0.0f))
+				return makeLeaf();
+
+			float const scale = binCount / extent[axis];
+			auto const binOf = [&](Reference const & ref)
+			{
+				size_t const bin = static_cast<size_t>((ref.centroid[axis] - centroids.minimum[axis]) * scale);
+				return std::min(bin, binCount - 1);
+			};
+
+			std::array<Box, binCount> binBounds;
+			std::array<size_t, binCount> binCounts = { };
+			for(size_t i = begin; i < end; i++)
+			{
+				size_t const bin = binOf(refs[i]);
+				binBounds[bin].extend(refs[i].bounds);
+				binCounts[bin]++;
+			}
+
+			// cost of splitting after bin i, swept from both sides
+			std::array<float, binCount> costs;
+			Box left;
+			size_t leftCount = 0;
+			for(size_t i = 0; i + 1 < binCount; i++)
+			{
+				left.extend(binBounds[i]);
+				leftCount += binCounts[i];
+				costs[i] = left.halfArea() * leftCount;
+			}
+			Box right;
+			size_t rightCount = 0;
+			size_t best = 0;
+			float bestCost = std::numeric_limits<float>::max();
+			for(size_t i = binCount - 1; i > 0; i--)
+			{
+				right.extend(binBounds[i]);
+				rightCount += binCounts[i];
+				float const cost = costs[i - 1] + right.halfArea() * rightCount;
+				if(cost < bestCost)
+				{
+					bestCost = cost;
+					best = i - 1;
+				}
+			}
+
+			// one box test is cheaper than a triangle test
+			if(bestCost >= bounds.halfArea() * (count - 0.125f) and count <= 4 * leafSize)
+				return makeLeaf();
+
+			size_t middle = std::partition(refs.begin() + begin, refs.begin() + end, [&](Reference const & ref)
+			{
+				return binOf(ref) <= best;
+			}) - refs.begin();
+			if(middle == begin or middle == end)
+			{
+				middle = begin + count / 2;
+				std::nth_element(refs.begin() + begin, refs.begin() + middle, refs.begin() + end, [&](Reference const & a, Reference const & b)
+				{
+					return a.centroid[axis] < b.centroid[axis];
+				});
+			}
+
+			nodes[node].count = 0;
+			build(refs, begin, middle, depth + 1);
+			nodes[node].index = static_cast<uint32_t>(nodes.size());
+			build(refs, middle, end, depth + 1);
+		}
+
+		static bool hitsBox(Node const & node, glm::vec3 const & origin, glm::vec3 const & inverse, float distance)
+		{
+			glm::vec3 const t1 = (node.minimum - origin) * inverse;
+			glm::vec3 const t2 = (node.maximum - origin) * inverse;
+			glm::vec3 const near = glm::min(t1, t2);
+			glm::vec3 const far = glm::max(t1, t2);
+			float const enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+			float const leave = std::min(std::min(far.x, far.y), std::min(far.z, distance));
+			return enter <= leave;
+		}
+
+		//! Möller-Trumbore, both sides of the triangle cast shadows.
+		static bool hitsTriangle(Triangle const & tris, glm::vec3 const & origin, glm::vec3 const & direction, float distance)
+		{
+			glm::vec3 const p = glm::cross(direction, tris.e2);
+			float const det = glm::dot(tris.e1, p);
+			if(std::abs(det) < 1e-12f)
+				return false;
+			float const inverse = 1.0f / det;
+			glm::vec3 const s = origin - tris.v0;
+			float const u = glm::dot(s, p) * inverse;
+			if(u < 0.0f or u > 1.0f)
+				return false;
+			glm::vec3 const q = glm::cross(s, tris.e1);
+			float const v = glm::dot(direction, q) * inverse;
+			if(v < 0.0f or u + v > 1.0f)
+				return false;
+			float const t = glm::dot(tris.e2, q) * inverse;
+			return t > 0.0f and t < distance;
+		}
+	};
+
+	struct Surface
+	{
+		uint32_t block;
+		uint32_t triangle;
+	};
+
+	struct LightSource
+	{
+		glm::vec3 origin;
+		glm::vec3 color;
+		float range;
+		bool shadows;
+	};
+
+	//! Texels of a lightmap, split into square tiles that are baked as
+	//! separate jobs.
+	struct Page
+	{
+		static constexpr unsigned int tileSize = 32;
+
+		unsigned int width = 0, height = 0;
+		unsigned int tilesX = 0, tilesY = 0;
+		std::vector<std::vector<uint32_t>> tiles; // indices into the surfaces of the lightmap
+		std::vector<glm::vec3> color;
+		std::vector<uint8_t> covered;
+	};
+
+	//! Fills the texels next to covered ones with the average of their
+	//! covered neighbours, one ring per pass.
+	void dilate(Page & page, unsigned int passes)
+	{
+		for(unsigned int pass = 0; pass < passes; pass++)
+		{
+			std::vector<uint8_t> next = page.covered;
+			for(unsigned int y = 0; y < page.height; y++)
+			{
+				for(unsigned int x = 0; x < page.width; x++)
+				{
+					size_t const i = size_t(y) * page.width + x;
+					if(page.covered[i])
+						continue;
+
+					glm::vec3 sum(0.0f);
+					int count = 0;
+					for(int dy = -1; dy <= 1; dy++)
+					{
+						for(int dx = -1; dx <= 1; dx++)
+						{
+							int const nx = int(x) + dx;
+							int const ny = int(y) + dy;
+							if(nx < 0 or ny < 0 or nx >= int(page.width) or ny >= int(page.height))
+								continue;
+							size_t const j = size_t(ny) * page.width + nx;
+							if(page.covered[j])
+							{
+								sum += page.color[j];
+								count++;
+							}
+						}
+					}
+					if(count > 0)
+					{
+						page.color[i] = sum / float(count);
+						next[i] = 1;
+					}
+				}
+			}
+			page.covered = std::move(next);
+		}
+	}
+}
+
+BakeStats WMB::bakeLightmaps(Level & level, BakeOptions const & options)
+{
+	BakeStats stats;
+	if(level.lightmaps.empty())
+		return stats;
+
+	// The front side is clockwise in DirectX coordinates, see computeFrames()
+	float const front = (options.coordinateSystem == LoadOptions::Gamestudio) ? -1.0f : 1.0f;
+
+	// Sky surfaces do not cast shadows, flat ones have no lightmap
+	std::vector<std::array<glm::vec3, 3>> casters;
+	std::vector<std::vector<Surface>> surfaces(level.lightmaps.size());
+	Box scene;
+	for(size_t b = 0; b < level.blocks.size(); b++)
+	{
+		auto const & block = level.blocks[b];
+		for(size_t t = 0; t < block.triangles.size(); t++)
+		{
+			auto const & tris = block.triangles[t];
+			size_t const count = block.vertices.size();
+			if(tris.v1 >= count or tris.v2 >= count or tris.v3 >= count or tris.skin >= block.skins.size())
+				continue;
+			auto const & skin = block.skins[tris.skin];
+			if(skin.isSky())
+				continue;
+
+			std::array<glm::vec3, 3> const p = { block.vertices[tris.v1].position, block.vertices[tris.v2].position, block.vertices[tris.v3].position };
+			casters.push_back(p);
+			for(auto const & corner : p)
+				scene.extend(corner);
+
+			if(not skin.isFlat() and skin.lightmap < level.lightmaps.size())
+				surfaces[skin.lightmap].push_back(Surface { static_cast<uint32_t>(b), static_cast<uint32_t>(t) });
+		}
+	}
+	Bvh const bvh(casters);
+	casters = { };
+
+	std::vector<LightSource> lights;
+	for(auto const & object : level.objects)
+	{
+		auto const * light = std::get_if<Light>(&object);
+		if(light == nullptr or light->range <= 0.0f)
+			continue;
+		if(not (light->isDynamic() ? options.dynamicLights : options.staticLights))
+			continue;
+		// the colors are stored in percent
+		lights.push_back(LightSource { light->origin, light->color / 100.0f, light->range, options.shadows and light->isCasting() });
+	}
+
+	// Info colors are ARGB, the sun is given in Gamestudio coordinates
+	auto const rgb = [](glm::vec4 const & argb) { return glm::vec3(argb.y, argb.z, argb.w); };
+	glm::vec3 const ambient = rgb(level.info.ambientColor);
+	glm::vec3 const sunColor = rgb(level.info.sunColor);
+	float const azimuth = glm::radians(level.info.azimuth);
+	float const elevation = glm::radians(level.info.elevation);
+	glm::vec3 const toSun = normalizeOrZero(glm::vec3(
+		std::cos(azimuth) * std::cos(elevation),
+		std::sin(azimuth) * std::cos(elevation),
+		std::sin(elevation)) * coordinateMatrix(options.coordinateSystem));
+	float const sunDistance = scene.empty() ? 0.0f : 2.0f * glm::length(scene.maximum - scene.minimum) + 1.0f;
+
+	// Every surface goes into the tiles its texel bounds touch
+	std::vector<Page> pages(level.lightmaps.size());
+	auto const texelRange = [](float minimum, float maximum, unsigned int size, unsigned int & first, unsigned int & last)
+	{
+		// texel x is inside when its center x + 0.5 is
+		float const lower = std::ceil(std::max(minimum - 0.5f, 0.0f));
+		float const upper = std::floor(std::min(maximum - 0.5f, float(size) - 1.0f));
+		if(not (lower <= upper))
+			return false;
+		first = static_cast<unsigned int>(lower);
+		last = static_cast<unsigned int>(upper);
+		return true;
+	};
+	for(size_t p = 0; p < pages.size(); p++)
+	{
+		auto const & lightmap = level.lightmaps[p];
+		if(surfaces[p].empty() or lightmap.width == 0 or lightmap.height == 0)
+			continue;
+
+		auto & page = pages[p];
+		page.width = lightmap.width;
+		page.height = lightmap.height;
+		page.tilesX = (page.width + Page::tileSize - 1) / Page::tileSize;
+		page.tilesY = (page.height + Page::tileSize - 1) / Page::tileSize;
+		page.tiles.resize(size_t(page.tilesX) * page.tilesY);
+
+		glm::vec2 const size(page.width, page.height);
+		for(size_t s = 0; s < surfaces[p].size(); s++)
+		{
+			auto const & block = level.blocks[surfaces[p][s].block];
+			auto const & tris = block.triangles[surfaces[p][s].triangle];
+			glm::vec2 const a = block.vertices[tris.v1].lightmap * size;
+			glm::vec2 const b = block.vertices[tris.v2].lightmap * size;
+			glm::vec2 const c = block.vertices[tris.v3].lightmap * size;
+			unsigned int x0, x1, y0, y1;
+			if(not texelRange(std::min({ a.x, b.x, c.x }), std::max({ a.x, b.x, c.x }), page.width, x0, x1))
+				continue;
+			if(not texelRange(std::min({ a.y, b.y, c.y }), std::max({ a.y, b.y, c.y }), page.height, y0, y1))
+				continue;
+			for(unsigned int ty = y0 / Page::tileSize; ty <= y1 / Page::tileSize; ty++)
+			{
+				for(unsigned int tx = x0 / Page::tileSize; tx <= x1 / Page::tileSize; tx++)
+					page.tiles[size_t(ty) * page.tilesX + tx].push_back(static_cast<uint32_t>(s));
+			}
+		}
+		page.color.assign(size_t(page.width) * page.height, glm::vec3(0.0f));
+		page.covered.assign(size_t(page.width) * page.height, 0);
+	}
+
+	std::atomic<size_t> texels { 0 };
+	std::atomic<size_t> rays { 0 };
+	auto const bakeTile = [&](size_t p, size_t tile)
+	{
+		auto & page = pages[p];
+		auto const & list = page.tiles[tile];
+		unsigned int const tileX0 = unsigned(tile % page.tilesX) * Page::tileSize;
+		unsigned int const tileY0 = unsigned(tile / page.tilesX) * Page::tileSize;
+		unsigned int const tileX1 = std::min(tileX0 + Page::tileSize, page.width) - 1;
+		unsigned int const tileY1 = std::min(tileY0 + Page::tileSize, page.height) - 1;
+
+		// only the lights that reach the surfaces of the tile
+		Box bounds;
+		for(auto const s : list)
+		{
+			auto const & block = level.blocks[surfaces[p][s].block];
+			auto const & tris = block.triangles[surfaces[p][s].triangle];
+			for(auto const v : { tris.v1, tris.v2, tris.v3 })
+				bounds.extend(block.vertices[v].position);
+		}
+		std::vector<LightSource const *> nearby;
+		for(auto const & light : lights)
+		{
+			if(bounds.distance(light.origin) < light.range)
+				nearby.push_back(&light);
+		}
+
+		size_t tileRays = 0;
+		auto const shade = [&](glm::vec3 const & position, glm::vec3 const & normal)
+		{
+			glm::vec3 result = ambient;
+			glm::vec3 const start = position + options.bias * normal;
+			if(options.sun)
+			{
+				float const lambert = glm::dot(normal, toSun);
+				if(lambert > 0.0f)
+				{
+					bool lit = true;
+					if(options.shadows)
+					{
+						tileRays++;
+						lit = not bvh.occluded(start, toSun, sunDistance);
+					}
+					if(lit)
+						result += sunColor * lambert;
+				}
+			}
+			for(auto const * light : nearby)
+			{
+				glm::vec3 const toLight = light->origin - position;
+				float const distance = glm::length(toLight);
+				if(distance <= 0.0f or distance >= light->range)
+					continue;
+				float const lambert = glm::dot(normal, toLight / distance);
+				if(lambert <= 0.0f)
+					continue;
+				if(light->shadows)
+				{
+					tileRays++;
+					glm::vec3 const ray = light->origin - start;
+					float const length = glm::length(ray);
+					if(length > 0.0f and bvh.occluded(start, ray / length, length))
+						continue;
+				}
+				result += light->color * lambert * (1.0f - distance / light->range);
+			}
+			return result;
+		};
+
+		size_t tileTexels = 0;
+		glm::vec2 const size(page.width, page.height);
+		for(auto const s : list)
+		{
+			auto const & block = level.blocks[surfaces[p][s].block];
+			auto const & tris = block.triangles[surfaces[p][s].triangle];
+			std::array<uint16_t, 3> const v = { tris.v1, tris.v2, tris.v3 };
+			std::array<glm::vec3, 3> const position = { block.vertices[v[0]].position, block.vertices[v[1]].position, block.vertices[v[2]].position };
+			std::array<glm::vec2, 3> const uv = { block.vertices[v[0]].lightmap * size, block.vertices[v[1]].lightmap * size, block.vertices[v[2]].lightmap * size };
+
+			glm::vec3 const faceNormal = normalizeOrZero(front * glm::cross(position[1] - position[0], position[2] - position[0]));
+			if(faceNormal == glm::vec3(0.0f))
+				continue;
+			bool const smooth = block.skins[tris.skin].isSmooth() and block.frames.size() == block.vertices.size();
+
+			auto const edge = [](glm::vec2 const & a, glm::vec2 const & b, glm::vec2 const & c)
+			{
+				return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+			};
+			float const area = edge(uv[0], uv[1], uv[2]);
+			if(std::abs(area) < 1e-12f)
+				continue;
+
+			unsigned int x0, x1, y0, y1;
+			if(not texelRange(std::min({ uv[0].x, uv[1].x, uv[2].x }), std::max({ uv[0].x, uv[1].x, uv[2].x }), page.width, x0, x1))
+				continue;
+			if(not texelRange(std::min({ uv[0].y, uv[1].y, uv[2].y }), std::max({ uv[0].y, uv[1].y, uv[2].y }), page.height, y0, y1))
+				continue;
+			x0 = std::max(x0, tileX0);
+			y0 = std::max(y0, tileY0);
+			x1 = std::min(x1, tileX1);
+			y1 = std::min(y1, tileY1);
+
+			float const epsilon = -1e-5f;
+			for(unsigned int y = y0; y <= y1 and y0 <= y1; y++)
+			{
+				for(unsigned int x = x0; x <= x1 and x0 <= x1; x++)
+				{
+					glm::vec2 const center(x + 0.5f, y + 0.5f);
+					float const w0 = edge(uv[1], uv[2], center) / area;
+					float const w1 = edge(uv[2], uv[0], center) / area;
+					float const w2 = 1.0f - w0 - w1;
+					if(w0 < epsilon or w1 < epsilon or w2 < epsilon)
+						continue;
+
+					glm::vec3 const point = w0 * position[0] + w1 * position[1] + w2 * position[2];
+					glm::vec3 normal = faceNormal;
+					if(smooth)
+					{
+						glm::vec3 const interpolated = normalizeOrZero(
+							w0 * block.frames[v[0]].normal + w1 * block.frames[v[1]].normal + w2 * block.frames[v[2]].normal);
+						if(interpolated != glm::vec3(0.0f))
+							normal = interpolated;
+					}
+
+					size_t const i = size_t(y) * page.width + x;
+					page.color[i] = shade(point, normal);
+					if(not page.covered[i])
+					{
+						page.covered[i] = 1;
+						tileTexels++;
+					}
+				}
+			}
+		}
+		texels += tileTexels;
+		rays += tileRays;
+	};
+
+	// Tiles differ a lot in cost. The ones with the most triangles are
+	// started first and idle workers steal the rest from busy ones.
+	{
+		std::vector<std::pair<size_t, size_t>> order;
+		for(size_t p = 0; p < pages.size(); p++)
+		{
+			for(size_t tile = 0; tile < pages[p].tiles.size(); tile++)
+			{
+				if(not pages[p].tiles[tile].empty())
+					order.emplace_back(p, tile);
+			}
+		}
+		std::stable_sort(order.begin(), order.end(), [&](auto const & a, auto const & b)
+		{
+			return pages[a.first].tiles[a.second].size() > pages[b.first].tiles[b.second].size();
+		});
+
+		WorkStealingPool pool(options.threads);
+		for(auto const & [p, tile] : order)
+			pool.submit([&bakeTile, p = p, tile = tile]() { bakeTile(p, tile); });
+		pool.wait();
+	}
+
+	float const gamma = std::clamp(level.info.gamma, 0.0f, 1.0f);
+	parallelFor(pages.size(), options.threads, [&](size_t p)
+	{
+		auto & page = pages[p];
+		if(page.tiles.empty())
+			return;
+		dilate(page, options.dilation);
+
+		auto & lightmap = level.lightmaps[p];
+		size_t const count = size_t(page.width) * page.height;
+		std::vector<std::byte> data(3 * count);
+		if(lightmap.compression == BlockCompression::None and lightmap.data.size() == data.size())
+			data = lightmap.data;
+
+		auto const encode = [](float value)
+		{
+			return std::byte(static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f));
+		};
+		for(size_t i = 0; i < count; i++)
+		{
+			if(not page.covered[i])
+				continue;
+			glm::vec3 const c = glm::vec3(gamma) + (1.0f - gamma) * glm::clamp(page.color[i], glm::vec3(0.0f), glm::vec3(1.0f));
+			data[3 * i + 0] = encode(c.z);
+			data[3 * i + 1] = encode(c.y);
+			data[3 * i + 2] = encode(c.x);
+		}
+		lightmap.data = std::move(data);
+		lightmap.compression = BlockCompression::None;
+	});
+
+	for(auto const & page : pages)
+		stats.lightmaps += page.tiles.empty() ? 0 : 1;
+	stats.texels = texels;
+	stats.rays = rays;
+	return stats;
+}
@@ -0,0 +1,52 @@
+#ifndef WMB_BAKE_HPP
+#define WMB_BAKE_HPP
+
+#include "wmb.hpp"
+
+namespace WMB
+{
+	struct BakeOptions
+	{
+		//! The coordinate system the level was loaded with, it decides
+		//! which side of a triangle is lit and where the sun is.
+		LoadOptions::CoordinateSystem coordinateSystem = LoadOptions::Gamestudio;
+
+		bool sun = true;            // Info::sunColor from Info::azimuth and Info::elevation
+		bool staticLights = true;   // lights without Light::DYNAMIC
+		bool dynamicLights = false; // lights with Light::DYNAMIC
+		bool shadows = true;        // shadow rays for the sun and lights with Light::CAST
+
+		//! Distance the shadow rays start above the surface, in level units.
+		float bias = 0.25f;
+
+		//! Texels around the lit surfaces that are filled with the average
+		//! of their neighbours, so bilinear filtering does not pick up the
+		//! unused texels at the edges.
+		unsigned int dilation = 2;
+
+		unsigned int threads = 0; // 0 = one thread per core
+	};
+
+	struct BakeStats
+	{
+		size_t lightmaps = 0; // lightmaps that were baked
+		size_t texels = 0;    // texels inside of triangles
+		size_t rays = 0;      // shadow rays
+	};
+
+	//! Bakes Level::lightmaps again from the light objects, the sun and
+	//! the ambient color of Level::info. The texels are placed with
+	//! Vertex::lightmap and lit with a Lambert term, lights fade out
+	//! linearly over their range. Shadow rays are traced against all
+	//! triangles except sky surfaces with a bounding volume hierarchy.
+	//! Smooth skins use the normals of Block::frames when present.
+	//!
+	//! The lightmaps are split into tiles that are baked on a work
+	//! stealing pool. Baked lightmaps are stored uncompressed, texels that
+	//! no triangle covers keep their old value when the lightmap was
+	//! uncompressed. Level::terrain_lightmaps are not changed, the terrain
+	//! geometry is not part of the level.
+	BakeStats bakeLightmaps(Level & level, BakeOptions const & options = BakeOptions());
+}
+
+#endif // WMB_BAKE_HPP
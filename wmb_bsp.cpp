@@ -0,0 +1,95 @@
+#include "wmb.hpp"
+
+using namespace WMB;
+
+size_t Bsp::leafAt(glm::vec3 const & point) const
+{
+	if(nodes.empty())
+		return 0;
+
+	int32_t index = 0;
+	// the depth is bounded by the node count, so a broken tree can't loop forever
+	for(size_t depth = 0; depth <= nodes.size(); depth++)
+	{
+		auto const & node = nodes[size_t(index)];
+		bool const front = glm::dot(node.normal, point) >= node.distance;
+		index = node.children[front ? 0 : 1];
+		if(index < 0)
+			return size_t(-(index + 1));
+	}
+	return 0;
+}
+
+std::vector<uint64_t> Bsp::visibleLeafs(size_t leaf) const
+{
+	std::vector<uint64_t> visible((leafs.size() + 63) / 64, 0);
+
+	int32_t const offset = leafs.at(leaf).visibility;
+	if(offset < 0)
+	{
+		// no visibility information, everything can be seen
+		for(size_t i = 0; i < leafs.size(); i++)
+			visible[i / 64] |= uint64_t(1) << (i % 64);
+		return visible;
+	}
+
+	// A zero byte is followed by the number of zero bytes it stands for,
+	// all other bytes are literal bits.
+	size_t const rowSize = (leafs.size() + 7) / 8;
+	size_t in = size_t(offset);
+	size_t out = 0;
+	while(out < rowSize and in < pvs.size())
+	{
+		auto const bits = std::to_integer<uint8_t>(pvs[in++]);
+		if(bits == 0)
+		{
+			if(in >= pvs.size())
+				break;
+			out += std::to_integer<uint8_t>(pvs[in++]);
+			continue;
+		}
+		visible[out / 8] |= uint64_t(bits) << (8 * (out % 8));
+		out++;
+	}
+
+	// the leaf itself is always visible, and bits past the last leaf are not
+	visible[leaf / 64] |= uint64_t(1) << (leaf % 64);
+	if(leafs.size() % 64)
+		visible.back() &= (uint64_t(1) << (leafs.size() % 64)) - 1;
+
+	return visible;
+}
+
+std::vector<uint32_t> Bsp::visibleBlocks(size_t leaf) const
+{
+	auto const leafMask = visibleLeafs(leaf);
+
+	std::vector<uint64_t> blockMask((blockCount + 63) / 64, 0);
+	for(size_t word = 0; word < leafMask.size(); word++)
+	{
+		uint64_t bits = leafMask[word];
+		while(bits != 0)
+		{
+			auto const & l = leafs[64 * word + __builtin_ctzll(bits)];
+			bits &= bits - 1;
+
+			for(size_t i = 0; i < l.blockCount; i++)
+			{
+				auto const block = leafBlocks[l.firstBlock + i];
+				blockMask[block / 64] |= uint64_t(1) << (block % 64);
+			}
+		}
+	}
+
+	std::vector<uint32_t> blocks;
+	for(size_t word = 0; word < blockMask.size(); word++)
+	{
+		uint64_t bits = blockMask[word];
+		while(bits != 0)
+		{
+			blocks.push_back(static_cast<uint32_t>(64 * word + __builtin_ctzll(bits)));
+			bits &= bits - 1;
+		}
+	}
+	return blocks;
+}
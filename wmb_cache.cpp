@@ -0,0 +1,250 @@
+#include "wmb_cache.hpp"
+
+#include <filesystem>
+#include <limits>
+#include <set>
+#include <sstream>
+#include <tuple>
+
+using namespace WMB;
+
+namespace // anonymous namespace
+{
+	template<typename T>
+	size_t bytesOf(std::vector<T> const & vector)
+	{
+		return vector.capacity() * sizeof(T);
+	}
+
+	size_t bytesOf(std::string const & string)
+	{
+		// short strings live inside the object
+		return (string.capacity() >= sizeof(std::string)) ? string.capacity() + 1 : 0;
+	}
+
+	size_t bytesOf(StringIndex const & index)
+	{
+		return bytesOf(index.keys) + bytesOf(index.keyOffsets) + bytesOf(index.keyHashes)
+		     + bytesOf(index.rowOffsets) + bytesOf(index.rows) + bytesOf(index.slots);
+	}
+
+	struct ObjectBytes
+	{
+		size_t operator()(Position const & pos) const { return bytesOf(pos.name); }
+		size_t operator()(Light const &) const { return 0; }
+		size_t operator()(Sound const & sound) const { return bytesOf(sound.fileName); }
+		size_t operator()(Path const & path) const { return bytesOf(path.name) + bytesOf(path.nodes) + bytesOf(path.edges); }
+		size_t operator()(Region const & region) const { return bytesOf(region.name); }
+		size_t operator()(Entity const & ent) const
+		{
+			return bytesOf(ent.name) + bytesOf(ent.fileName) + bytesOf(ent.action)
+			     + bytesOf(ent.material) + bytesOf(ent.string1) + bytesOf(ent.string2);
+		}
+	};
+
+	//! Every field of the options that changes the loaded level.
+	std::string encodeOptions(LoadOptions const & options)
+	{
+		std::ostringstream ss;
+		ss << options.flags.to_string() << '/' << options.targetCoordinateSystem << '/' << options.textureAlignment << '/' << options.streamedMipSize;
+		if(options.weld)
+			ss << '/' << options.weld->positionEpsilon << ',' << options.weld->uvEpsilon << ',' << options.weld->lightmapEpsilon;
+		return ss.str();
+	}
+}
+
+size_t WMB::memoryFootprint(Level const & level)
+{
+	size_t bytes = sizeof(Level);
+
+	std::set<std::vector<std::byte> const *> storages;
+	bytes += bytesOf(level.textures);
+	for(auto const & texture : level.textures)
+	{
+		bytes += bytesOf(texture.name) + bytesOf(texture.levels) + bytesOf(texture.mips);
+		for(auto const & data : texture.levels)
+			bytes += bytesOf(data);
+		if(texture.storage and storages.insert(texture.storage.get()).second)
+			bytes += sizeof(std::vector<std::byte>) + bytesOf(*texture.storage);
+	}
+
+	bytes += bytesOf(level.materials);
+	for(auto const & material : level.materials)
+		bytes += bytesOf(material.name);
+
+	for(auto const * lightmaps : { &level.lightmaps, &level.terrain_lightmaps })
+	{
+		bytes += bytesOf(*lightmaps);
+		for(auto const & lightmap : *lightmaps)
+			bytes += bytesOf(lightmap.data);
+	}
+
+	bytes += bytesOf(level.blocks);
+	for(auto const & block : level.blocks)
+		bytes += bytesOf(block.vertices) + bytesOf(block.triangles) + bytesOf(block.skins) + bytesOf(block.frames);
+
+	if(level.bspLists)
+		bytes += bytesOf(level.bspLists->nodes) + bytesOf(level.bspLists->leafs) + bytesOf(level.bspLists->blocks) + bytesOf(level.bspLists->pvs);
+	if(level.bsp)
+		bytes += bytesOf(level.bsp->nodes) + bytesOf(level.bsp->leafs) + bytesOf(level.bsp->leafBlocks) + bytesOf(level.bsp->pvs);
+
+	bytes += bytesOf(level.objects);
+	for(auto const & object : level.objects)
+		bytes += std::visit(ObjectBytes(), object);
+
+	if(level.digest)
+	{
+		bytes += bytesOf(level.digest->textures) + bytesOf(level.digest->blocks) + bytesOf(level.digest->objects)
+		       + bytesOf(level.digest->lightmaps) + bytesOf(level.digest->terrainLightmaps);
+	}
+
+	if(level.entityIndex)
+		bytes += bytesOf(level.entityIndex->names) + bytesOf(level.entityIndex->actions) + bytesOf(level.entityIndex->fileNames);
+
+	return bytes;
+}
+
+bool LevelCache::Key::operator<(Key const & other) const
+{
+	return std::tie(fileName, options, modified) < std::tie(other.fileName, other.options, other.modified);
+}
+
+LevelCache::LevelCache(size_t budget) :
+	budget(budget)
+{
+
+}
+
+std::shared_ptr<Level const> LevelCache::load(std::string const & fileName, LoadOptions const & options)
+{
+	std::error_code ec;
+	auto const modified = std::filesystem::last_write_time(fileName, ec);
+	if(ec)
+		return nullptr;
+
+	Key const key { fileName, encodeOptions(options), static_cast<int64_t>(modified.time_since_epoch().count()) };
+
+	std::promise<std::shared_ptr<Level const>> promise;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		auto const found = entries.find(key);
+		if(found != entries.end())
+		{
+			counters.hits++;
+			uses.splice(uses.begin(), uses, found->second.use);
+			Future const level = found->second.level;
+			lock.unlock();
+			return level.get();
+		}
+
+		counters.misses++;
+		uses.push_front(key);
+		Entry entry;
+		entry.level = promise.get_future().share();
+		entry.use = uses.begin();
+		entries.emplace(key, std::move(entry));
+	}
+
+	// Loaded without the lock, the other callers of this key wait for
+	// the future.
+	std::shared_ptr<Level const> level;
+	try
+	{
+		if(auto loaded = WMB::load(fileName, options))
+			level = std::make_shared<Level const>(std::move(*loaded));
+	}
+	catch(...)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto const found = entries.find(key);
+			uses.erase(found->second.use);
+			entries.erase(found);
+		}
+		promise.set_exception(std::current_exception());
+		throw;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto const found = entries.find(key);
+		if(level)
+		{
+			found->second.bytes = memoryFootprint(*level);
+			found->second.ready = true;
+			counters.bytes += found->second.bytes;
+			counters.levels++;
+
+			// older versions of the same file
+			for(auto it = entries.lower_bound(Key { fileName, key.options, std::numeric_limits<int64_t>::min() }); it != entries.end() and it->first.fileName == fileName and it->first.options == key.options; )
+			{
+				if(it->first.modified == key.modified or not it->second.ready)
+				{
+					++it;
+					continue;
+				}
+				counters.bytes -= it->second.bytes;
+				counters.levels--;
+				counters.evictions++;
+				uses.erase(it->second.use);
+				it = entries.erase(it);
+			}
+			evict();
+		}
+		else
+		{
+			uses.erase(found->second.use);
+			entries.erase(found);
+		}
+	}
+	promise.set_value(level);
+	return level;
+}
+
+void LevelCache::evict()
+{
+	auto it = uses.end();
+	while(counters.bytes > budget and it != uses.begin())
+	{
+		--it;
+		auto const found = entries.find(*it);
+		if(not found->second.ready)
+			continue;
+		counters.bytes -= found->second.bytes;
+		counters.levels--;
+		counters.evictions++;
+		entries.erase(found);
+		it = uses.erase(it);
+	}
+}
+
+void LevelCache::setBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	budget = bytes;
+	evict();
+}
+
+void LevelCache::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for(auto it = entries.begin(); it != entries.end(); )
+	{
+		if(not it->second.ready)
+		{
+			++it;
+			continue;
+		}
+		counters.evictions++;
+		uses.erase(it->second.use);
+		it = entries.erase(it);
+	}
+	counters.bytes = 0;
+	counters.levels = 0;
+}
+
+LevelCache::Stats LevelCache::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return counters;
+}
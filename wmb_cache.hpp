@@ -0,0 +1,89 @@
+#ifndef WMB_CACHE_HPP
+#define WMB_CACHE_HPP
+
+#include "wmb.hpp"
+
+#include <cstdint>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace WMB
+{
+	//! Bytes allocated by the level, including the vector capacities and
+	//! the strings. Texture storage shared between textures counts once.
+	size_t memoryFootprint(Level const & level);
+
+	//! Thread-safe cache of loaded levels, keyed by file name,
+	//! modification time and load options. Callers that ask for the same
+	//! key while it is loading wait for that load instead of starting
+	//! their own. The least recently used levels are dropped when the
+	//! cached levels need more than the budget. Dropping only releases
+	//! the reference of the cache, levels still in use stay valid.
+	class LevelCache
+	{
+	public:
+		struct Stats
+		{
+			size_t hits = 0;      // including callers that waited for a running load
+			size_t misses = 0;
+			size_t evictions = 0;
+			size_t bytes = 0;     // footprint of the cached levels
+			size_t levels = 0;
+		};
+
+		explicit LevelCache(size_t budget = size_t(512) << 20);
+
+		LevelCache(LevelCache const &) = delete;
+		LevelCache & operator=(LevelCache const &) = delete;
+
+		//! Returns the cached level or loads it. Returns nullptr if the
+		//! file could not be loaded, failed loads are not cached.
+		//! Versions of the file with another modification time are
+		//! dropped when the new one is loaded.
+		std::shared_ptr<Level const> load(std::string const & fileName, LoadOptions const & options = LoadOptions());
+
+		//! Changes the budget and drops levels until it is met.
+		void setBudget(size_t bytes);
+
+		//! Drops all finished levels.
+		void clear();
+
+		Stats stats() const;
+
+	private:
+		using Future = std::shared_future<std::shared_ptr<Level const>>;
+
+		struct Key
+		{
+			std::string fileName;
+			std::string options; // encoded LoadOptions
+			int64_t modified;
+
+			bool operator<(Key const & other) const;
+		};
+
+		struct Entry
+		{
+			Future level;
+			size_t bytes = 0;
+			bool ready = false;
+			std::list<Key>::iterator use; // position in `uses`
+		};
+
+		//! Drops the least recently used finished levels until the budget
+		//! is met, the mutex must be locked.
+		void evict();
+
+		mutable std::mutex mutex;
+		size_t budget;
+		std::map<Key, Entry> entries;
+		std::list<Key> uses; // most recently used first
+		Stats counters;
+	};
+}
+
+#endif // WMB_CACHE_HPP
@@ -0,0 +1,668 @@
+#include "wmb_compress.hpp"
+#include "wmb_parallel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	//! The 16 pixels of a 4x4 block as a structure of arrays, in 0..255.
+	struct BlockPixels
+	{
+		alignas(16) std::array<float, 16> r, g, b, a;
+
+		glm::vec4 pixel(size_t i) const
+		{
+			return glm::vec4(r[i], g[i], b[i], a[i]);
+		}
+	};
+
+	size_t blockSize(BlockCompression format)
+	{
+		return (format == BlockCompression::BC1) ? 8 : 16;
+	}
+
+	//! True for the formats encode() can write.
+	bool encodable(BlockCompression format)
+	{
+		return format == BlockCompression::BC1 or format == BlockCompression::BC3 or format == BlockCompression::BC7;
+	}
+
+	void gather(uint8_t const * rgba, unsigned width, unsigned height, unsigned bx, unsigned by, BlockPixels & px)
+	{
+		for(unsigned y = 0; y < 4; y++)
+		{
+			unsigned const sy = std::min(4 * by + y, height - 1);
+			for(unsigned x = 0; x < 4; x++)
+			{
+				unsigned const sx = std::min(4 * bx + x, width - 1);
+				uint8_t const * src = rgba + 4 * (size_t(sy) * width + sx);
+				size_t const i = 4 * y + x;
+				px.r[i] = src[0];
+				px.g[i] = src[1];
+				px.b[i] = src[2];
+				px.a[i] = src[3];
+			}
+		}
+	}
+
+	//! Weight of the channels that take part in the error metric, alpha
+	//! is excluded for the color part of BC1/BC3.
+	glm::vec4 channelMask(bool withAlpha)
+	{
+		return glm::vec4(1.0f, 1.0f, 1.0f, withAlpha ? 1.0f : 0.0f);
+	}
+
+	//! Fits a line through the pixels and returns its extreme points.
+	void principalEndpoints(BlockPixels const & px, glm::vec4 const & mask, int iterations, glm::vec4 & e0, glm::vec4 & e1)
+	{
+		glm::vec4 mean(0.0f);
+		glm::vec4 lo(255.0f), hi(0.0f);
+		for(size_t i = 0; i < 16; i++)
+		{
+			auto const p = px.pixel(i) * mask;
+			mean = mean + p;
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+		mean = mean / 16.0f;
+
+		std::array<float, 10> cov = { }; // upper triangle of the 4x4 covariance
+		for(size_t i = 0; i < 16; i++)
+		{
+			auto const d = px.pixel(i) * mask - mean;
+			cov[0] += d.x * d.x; cov[1] += d.x * d.y; cov[2] += d.x * d.z; cov[3] += d.x * d.w;
+			cov[4] += d.y * d.y; cov[5] += d.y * d.z; cov[6] += d.y * d.w;
+			cov[7] += d.z * d.z; cov[8] += d.z * d.w;
+			cov[9] += d.w * d.w;
+		}
+
+		// power iteration, starting with the bounding box diagonal
+		glm::vec4 axis = hi - lo;
+		if(glm::dot(axis, axis) < 1e-6f)
+			axis = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f) * mask;
+		for(int it = 0; it < iterations; it++)
+		{
+			glm::vec4 const next(
+				cov[0] * axis.x + cov[1] * axis.y + cov[2] * axis.z + cov[3] * axis.w,
+				cov[1] * axis.x + cov[4] * axis.y + cov[5] * axis.z + cov[6] * axis.w,
+				cov[2] * axis.x + cov[5] * axis.y + cov[7] * axis.z + cov[8] * axis.w,
+				cov[3] * axis.x + cov[6] * axis.y + cov[8] * axis.z + cov[9] * axis.w);
+			float const len = std::sqrt(glm::dot(next, next));
+			if(len < 1e-6f)
+				break;
+			axis = next / len;
+		}
+		float const len2 = glm::dot(axis, axis);
+		if(len2 < 1e-12f)
+		{
+			e0 = e1 = mean;
+			return;
+		}
+		axis = axis / std::sqrt(len2);
+
+		float tmin = std::numeric_limits<float>::max();
+		float tmax = -tmin;
+		for(size_t i = 0; i < 16; i++)
+		{
+			float const t = glm::dot(px.pixel(i) * mask - mean, axis);
+			tmin = std::min(tmin, t);
+			tmax = std::max(tmax, t);
+		}
+		e0 = glm::clamp(mean + axis * tmax, 0.0f, 255.0f);
+		e1 = glm::clamp(mean + axis * tmin, 0.0f, 255.0f);
+	}
+
+	//! Projects the pixels onto the segment e0..e1 and rounds to one of
+	//! `levels` evenly spaced steps, 0 being e0.
+	void projectIndices(BlockPixels const & px, glm::vec4 const & e0, glm::vec4 const & e1, glm::vec4 const & mask, int levels, std::array<uint8_t, 16> & out)
+	{
+		glm::vec4 const d = (e1 - e0) * mask;
+		float const len2 = glm::dot(d, d);
+		if(len2 < 1e-6f)
+		{
+			out.fill(0);
+			return;
+		}
+		glm::vec4 const dir = d * (float(levels - 1) / len2);
+		float const offset = -glm::dot(e0 * mask, dir) + 0.5f;
+
+#if defined(__SSE2__)
+		__m128 const dr = _mm_set1_ps(dir.x);
+		__m128 const dg = _mm_set1_ps(dir.y);
+		__m128 const db = _mm_set1_ps(dir.z);
+		__m128 const da = _mm_set1_ps(dir.w);
+		__m128 const base = _mm_set1_ps(offset);
+		__m128 const top = _mm_set1_ps(float(levels - 1));
+		for(size_t i = 0; i < 16; i += 4)
+		{
+			__m128 t = base;
+			t = _mm_add_ps(t, _mm_mul_ps(_mm_load_ps(&px.r[i]), dr));
+			t = _mm_add_ps(t, _mm_mul_ps(_mm_load_ps(&px.g[i]), dg));
+			t = _mm_add_ps(t, _mm_mul_ps(_mm_load_ps(&px.b[i]), db));
+			t = _mm_add_ps(t, _mm_mul_ps(_mm_load_ps(&px.a[i]), da));
+			t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), top);
+
+			alignas(16) int32_t idx[4];
+			_mm_store_si128(reinterpret_cast<__m128i *>(idx), _mm_cvttps_epi32(t));
+			for(size_t k = 0; k < 4; k++)
+				out[i + k] = uint8_t(idx[k]);
+		}
+#else
+		for(size_t i = 0; i < 16; i++)
+		{
+			float const t = offset + px.r[i] * dir.x + px.g[i] * dir.y + px.b[i] * dir.z + px.a[i] * dir.w;
+			out[i] = uint8_t(std::clamp(t, 0.0f, float(levels - 1)));
+		}
+#endif
+	}
+
+	//! Finds the closest palette entry for every pixel.
+	template<size_t N>
+	void nearestIndices(BlockPixels const & px, std::array<glm::vec4, N> const & palette, glm::vec4 const & mask, std::array<uint8_t, 16> & out)
+	{
+#if defined(__SSE2__)
+		for(size_t i = 0; i < 16; i += 4)
+		{
+			__m128 const r = _mm_load_ps(&px.r[i]);
+			__m128 const g = _mm_load_ps(&px.g[i]);
+			__m128 const b = _mm_load_ps(&px.b[i]);
+			__m128 const a = _mm_load_ps(&px.a[i]);
+
+			__m128 best = _mm_set1_ps(std::numeric_limits<float>::max());
+			__m128i bestIndex = _mm_setzero_si128();
+			for(size_t k = 0; k < N; k++)
+			{
+				auto const c = palette[k];
+				__m128 const dr = _mm_sub_ps(r, _mm_set1_ps(c.x));
+				__m128 const dg = _mm_sub_ps(g, _mm_set1_ps(c.y));
+				__m128 const db = _mm_sub_ps(b, _mm_set1_ps(c.z));
+				__m128 const da = _mm_mul_ps(_mm_sub_ps(a, _mm_set1_ps(c.w)), _mm_set1_ps(mask.w));
+				__m128 dist = _mm_mul_ps(dr, dr);
+				dist = _mm_add_ps(dist, _mm_mul_ps(dg, dg));
+				dist = _mm_add_ps(dist, _mm_mul_ps(db, db));
+				dist = _mm_add_ps(dist, _mm_mul_ps(da, da));
+
+				__m128i const closer = _mm_castps_si128(_mm_cmplt_ps(dist, best));
+				best = _mm_min_ps(dist, best);
+				bestIndex = _mm_or_si128(
+					_mm_and_si128(closer, _mm_set1_epi32(int(k))),
+					_mm_andnot_si128(closer, bestIndex));
+			}
+
+			alignas(16) int32_t idx[4];
+			_mm_store_si128(reinterpret_cast<__m128i *>(idx), bestIndex);
+			for(size_t k = 0; k < 4; k++)
+				out[i + k] = uint8_t(idx[k]);
+		}
+#else
+		for(size_t i = 0; i < 16; i++)
+		{
+			float best = std::numeric_limits<float>::max();
+			for(size_t k = 0; k < N; k++)
+			{
+				auto const d = (px.pixel(i) - palette[k]) * mask;
+				float const dist = glm::dot(d, d);
+				if(dist < best)
+				{
+					best = dist;
+					out[i] = uint8_t(k);
+				}
+			}
+		}
+#endif
+	}
+
+	//! Solves for the endpoints that minimize the error of the given
+	//! interpolation weights in the least squares sense.
+	bool refineEndpoints(BlockPixels const & px, std::array<float, 16> const & weights, glm::vec4 & e0, glm::vec4 & e1)
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		glm::vec4 ax(0.0f), bx(0.0f);
+		for(size_t i = 0; i < 16; i++)
+		{
+			float const w = weights[i];
+			float const v = 1.0f - w;
+			aa += v * v;
+			ab += v * w;
+			bb += w * w;
+			ax = ax + px.pixel(i) * v;
+			bx = bx + px.pixel(i) * w;
+		}
+		float const det = aa * bb - ab * ab;
+		if(std::abs(det) < 1e-6f)
+			return false;
+		e0 = glm::clamp((ax * bb - bx * ab) / det, 0.0f, 255.0f);
+		e1 = glm::clamp((bx * aa - ax * ab) / det, 0.0f, 255.0f);
+		return true;
+	}
+
+	uint16_t to565(glm::vec4 const & c)
+	{
+		auto const r = uint16_t(std::lround(c.x * 31.0f / 255.0f));
+		auto const g = uint16_t(std::lround(c.y * 63.0f / 255.0f));
+		auto const b = uint16_t(std::lround(c.z * 31.0f / 255.0f));
+		return uint16_t((r << 11) | (g << 5) | b);
+	}
+
+	glm::vec4 from565(uint16_t c)
+	{
+		unsigned const r = (c >> 11) & 31;
+		unsigned const g = (c >> 5) & 63;
+		unsigned const b = c & 31;
+		return glm::vec4(
+			float((r << 3) | (r >> 2)),
+			float((g << 2) | (g >> 4)),
+			float((b << 3) | (b >> 2)),
+			255.0f);
+	}
+
+	void put(std::byte * out, uint64_t value, size_t bytes)
+	{
+		for(size_t i = 0; i < bytes; i++)
+			out[i] = std::byte((value >> (8 * i)) & 0xFF);
+	}
+
+	//! Encodes the color part of a BC1/BC3 block in four color mode.
+	void encodeColor(BlockPixels const & px, CompressOptions::Quality quality, std::byte * out)
+	{
+		glm::vec4 const mask = channelMask(false);
+
+		glm::vec4 e0, e1;
+		principalEndpoints(px, mask, (quality == CompressOptions::High) ? 8 : 2, e0, e1);
+
+		// palette step k (0..3 from c0 to c1) to the BC1 index
+		static constexpr std::array<uint8_t, 4> toCode = { 0, 2, 3, 1 };
+		static constexpr std::array<float, 4> stepWeight = { 0.0f, 1.0f / 3.0f, 2.0f / 3.0f, 1.0f };
+
+		std::array<uint8_t, 16> steps;
+		if(quality == CompressOptions::High)
+		{
+			for(int it = 0; it < 2; it++)
+			{
+				projectIndices(px, e0, e1, mask, 4, steps);
+				std::array<float, 16> weights;
+				for(size_t i = 0; i < 16; i++)
+					weights[i] = stepWeight[steps[i]];
+				if(not refineEndpoints(px, weights, e0, e1))
+					break;
+			}
+		}
+
+		uint16_t c0 = to565(e0);
+		uint16_t c1 = to565(e1);
+		if(c0 < c1)
+			std::swap(c0, c1);
+
+		uint32_t indices = 0;
+		if(c0 != c1)
+		{
+			glm::vec4 const p0 = from565(c0);
+			glm::vec4 const p1 = from565(c1);
+			if(quality == CompressOptions::High)
+			{
+				std::array<glm::vec4, 4> const palette = {
+					p0, p0 * (2.0f / 3.0f) + p1 * (1.0f / 3.0f), p0 * (1.0f / 3.0f) + p1 * (2.0f / 3.0f), p1
+				};
+				nearestIndices(px, palette, mask, steps);
+			}
+			else
+			{
+				projectIndices(px, p0, p1, mask, 4, steps);
+			}
+			for(size_t i = 0; i < 16; i++)
+				indices |= uint32_t(toCode[steps[i]]) << (2 * i);
+		}
+
+		put(out + 0, c0, 2);
+		put(out + 2, c1, 2);
+		put(out + 4, indices, 4);
+	}
+
+	//! Encodes the alpha part of a BC3 block in eight value mode.
+	void encodeAlpha(BlockPixels const & px, CompressOptions::Quality quality, std::byte * out)
+	{
+		float lo = 255.0f, hi = 0.0f;
+		for(size_t i = 0; i < 16; i++)
+		{
+			lo = std::min(lo, px.a[i]);
+			hi = std::max(hi, px.a[i]);
+		}
+		auto const a0 = uint8_t(std::lround(hi));
+		auto const a1 = uint8_t(std::lround(lo));
+
+		uint64_t indices = 0;
+		if(a0 != a1)
+		{
+			// palette step k (0..7 from a0 to a1) to the BC3 index
+			static constexpr std::array<uint8_t, 8> toCode = { 0, 2, 3, 4, 5, 6, 7, 1 };
+
+			BlockPixels alpha;
+			alpha.r.fill(0.0f);
+			alpha.g.fill(0.0f);
+			alpha.b.fill(0.0f);
+			alpha.a = px.a;
+			glm::vec4 const mask(0.0f, 0.0f, 0.0f, 1.0f);
+
+			std::array<uint8_t, 16> steps;
+			if(quality == CompressOptions::High)
+			{
+				std::array<glm::vec4, 8> palette;
+				for(size_t k = 0; k < 8; k++)
+					palette[k] = glm::vec4(0.0f, 0.0f, 0.0f, float(((7 - k) * a0 + k * a1) / 7));
+				nearestIndices(alpha, palette, mask, steps);
+			}
+			else
+			{
+				projectIndices(alpha, glm::vec4(0.0f, 0.0f, 0.0f, a0), glm::vec4(0.0f, 0.0f, 0.0f, a1), mask, 8, steps);
+			}
+			for(size_t i = 0; i < 16; i++)
+				indices |= uint64_t(toCode[steps[i]]) << (3 * i);
+		}
+
+		out[0] = std::byte(a0);
+		out[1] = std::byte(a1);
+		put(out + 2, indices, 6);
+	}
+
+	struct BitWriter
+	{
+		std::array<uint64_t, 2> words = { 0, 0 };
+		unsigned pos = 0;
+
+		void write(uint64_t value, unsigned bits)
+		{
+			for(unsigned i = 0; i < bits; i++, pos++)
+				words[pos / 64] |= ((value >> i) & 1) << (pos % 64);
+		}
+	};
+
+	//! Encodes a BC7 block in mode 6: a single subset with RGBA endpoints
+	//! of 7 bits plus a p-bit each and 4 bit indices.
+	void encodeBC7(BlockPixels const & px, CompressOptions::Quality quality, std::byte * out)
+	{
+		static constexpr std::array<int, 16> weights = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		glm::vec4 const mask = channelMask(true);
+
+		glm::vec4 e0, e1;
+		principalEndpoints(px, mask, (quality == CompressOptions::High) ? 8 : 2, e0, e1);
+
+		std::array<uint8_t, 16> indices;
+		if(quality == CompressOptions::High)
+		{
+			for(int it = 0; it < 2; it++)
+			{
+				projectIndices(px, e0, e1, mask, 16, indices);
+				std::array<float, 16> w;
+				for(size_t i = 0; i < 16; i++)
+					w[i] = weights[indices[i]] / 64.0f;
+				if(not refineEndpoints(px, w, e0, e1))
+					break;
+			}
+		}
+
+		// quantize to 7 bits and pick the p-bit with the smaller error
+		auto const quantize = [](glm::vec4 const & e, std::array<int, 4> & q, int & pbit)
+		{
+			float bestError = std::numeric_limits<float>::max();
+			for(int p = 0; p < 2; p++)
+			{
+				std::array<int, 4> candidate;
+				float error = 0.0f;
+				for(int c = 0; c < 4; c++)
+				{
+					candidate[c] = std::clamp(int(std::lround((e[c] - p) / 2.0f)), 0, 127);
+					float const d = float(2 * candidate[c] + p) - e[c];
+					error += d * d;
+				}
+				if(error < bestError)
+				{
+					bestError = error;
+					q = candidate;
+					pbit = p;
+				}
+			}
+		};
+
+		std::array<int, 4> q0, q1;
+		int p0 = 0, p1 = 0;
+		quantize(e0, q0, p0);
+		quantize(e1, q1, p1);
+
+		glm::vec4 d0, d1;
+		for(int c = 0; c < 4; c++)
+		{
+			d0[c] = float(2 * q0[c] + p0);
+			d1[c] = float(2 * q1[c] + p1);
+		}
+
+		if(quality == CompressOptions::High)
+		{
+			std::array<glm::vec4, 16> palette;
+			for(size_t k = 0; k < 16; k++)
+			{
+				for(int c = 0; c < 4; c++)
+					palette[k][c] = float(((64 - weights[k]) * int(d0[c]) + weights[k] * int(d1[c]) + 32) >> 6);
+			}
+			nearestIndices(px, palette, mask, indices);
+		}
+		else
+		{
+			projectIndices(px, d0, d1, mask, 16, indices);
+		}
+
+		// the first index is stored with 3 bits, so its top bit must be 0
+		if(indices[0] & 8)
+		{
+			std::swap(q0, q1);
+			std::swap(p0, p1);
+			for(auto & idx : indices)
+				idx = uint8_t(15 - idx);
+		}
+
+		BitWriter bits;
+		bits.write(1 << 6, 7); // mode 6
+		for(int c = 0; c < 4; c++)
+		{
+			bits.write(uint64_t(q0[c]), 7);
+			bits.write(uint64_t(q1[c]), 7);
+		}
+		bits.write(uint64_t(p0), 1);
+		bits.write(uint64_t(p1), 1);
+		bits.write(indices[0], 3);
+		for(size_t i = 1; i < 16; i++)
+			bits.write(indices[i], 4);
+
+		put(out + 0, bits.words[0], 8);
+		put(out + 8, bits.words[1], 8);
+	}
+
+	//! Expands a texture level or lightmap into RGBA8.
+	std::vector<uint8_t> toRGBA(std::vector<std::byte> const & data, Texture::Format format, size_t pixels)
+	{
+		std::vector<uint8_t> rgba(4 * pixels);
+		auto const * src = reinterpret_cast<uint8_t const *>(data.data());
+		for(size_t i = 0; i < pixels; i++)
+		{
+			uint8_t * dst = &rgba[4 * i];
+			switch(format)
+			{
+				case Texture::RGBA8888:
+					dst[0] = src[4 * i + 2];
+					dst[1] = src[4 * i + 1];
+					dst[2] = src[4 * i + 0];
+					dst[3] = src[4 * i + 3];
+					break;
+				case Texture::RGB888:
+					dst[0] = src[3 * i + 2];
+					dst[1] = src[3 * i + 1];
+					dst[2] = src[3 * i + 0];
+					dst[3] = 255;
+					break;
+				case Texture::RGB565:
+				{
+					auto const c = from565(uint16_t(src[2 * i] | (src[2 * i + 1] << 8)));
+					dst[0] = uint8_t(c.x);
+					dst[1] = uint8_t(c.y);
+					dst[2] = uint8_t(c.z);
+					dst[3] = 255;
+					break;
+				}
+				default:
+					return { }; // bytesPerPixel() filters these out
+			}
+		}
+		return rgba;
+	}
+
+	size_t bytesPerPixel(Texture::Format format)
+	{
+		switch(format)
+		{
+			case Texture::RGB565:   return 2;
+			case Texture::RGB888:   return 3;
+			case Texture::RGBA8888: return 4;
+			default:                return 0;
+		}
+	}
+}
+
+std::vector<std::byte> WMB::encode(uint8_t const * rgba, unsigned int width, unsigned int height, BlockCompression format, CompressOptions::Quality quality)
+{
+	if(not encodable(format) or width == 0 or height == 0)
+		return { };
+
+	unsigned const bw = (width + 3) / 4;
+	unsigned const bh = (height + 3) / 4;
+	size_t const stride = blockSize(format);
+
+	std::vector<std::byte> result(stride * bw * bh);
+	BlockPixels px;
+	for(unsigned by = 0; by < bh; by++)
+	{
+		for(unsigned bx = 0; bx < bw; bx++)
+		{
+			gather(rgba, width, height, bx, by, px);
+			std::byte * out = &result[stride * (size_t(by) * bw + bx)];
+			switch(format)
+			{
+				case BlockCompression::BC1:
+					encodeColor(px, quality, out);
+					break;
+				case BlockCompression::BC3:
+					encodeAlpha(px, quality, out);
+					encodeColor(px, quality, out + 8);
+					break;
+				default:
+					encodeBC7(px, quality, out);
+					break;
+			}
+		}
+	}
+	return result;
+}
+
+bool WMB::compress(Level & level, CompressOptions const & options)
+{
+	for(auto const format : { options.opaqueFormat, options.alphaFormat, options.lightmapFormat })
+	{
+		if(format != BlockCompression::None and not encodable(format))
+			return false;
+	}
+
+	// Every mip level and lightmap is a job that writes into its own slot.
+	struct Job
+	{
+		std::vector<std::byte> * data;
+		Texture::Format format;
+		unsigned width, height;
+		BlockCompression target;
+	};
+	std::vector<Job> jobs;
+
+	std::vector<Texture *> textures;
+	if(options.compressTextures)
+	{
+		for(auto & texture : level.textures)
+		{
+			if(texture.compression != BlockCompression::None or bytesPerPixel(texture.format) == 0)
+				continue;
+			auto const target = (texture.format == Texture::RGBA8888) ? options.alphaFormat : options.opaqueFormat;
+			if(target == BlockCompression::None)
+				continue;
+
+			// skip textures with truncated levels instead of compressing them partially
+			bool valid = true;
+			for(size_t i = 0; i < texture.levelCount(); i++)
+			{
+				unsigned const w = std::max(1u, texture.width >> i);
+				unsigned const h = std::max(1u, texture.height >> i);
+				valid = valid and (texture.level(i).size() >= bytesPerPixel(texture.format) * w * h);
+			}
+			if(not valid)
+				continue;
+
+			// compression replaces the levels, so shared storage is copied out first
+			if(texture.storage)
+			{
+				texture.levels.clear();
+				for(auto const & mip : texture.mips)
+					texture.levels.emplace_back(mip.begin(), mip.end());
+				texture.mips.clear();
+				texture.storage.reset();
+			}
+
+			for(size_t i = 0; i < texture.levels.size(); i++)
+			{
+				unsigned const w = std::max(1u, texture.width >> i);
+				unsigned const h = std::max(1u, texture.height >> i);
+				jobs.push_back(Job { &texture.levels[i], texture.format, w, h, target });
+			}
+			textures.push_back(&texture);
+		}
+	}
+
+	std::vector<Lightmap *> lightmaps;
+	if(options.compressLightmaps and options.lightmapFormat != BlockCompression::None)
+	{
+		for(auto * list : { &level.lightmaps, &level.terrain_lightmaps })
+		{
+			for(auto & lm : *list)
+			{
+				if(lm.compression != BlockCompression::None or lm.data.size() < 3 * size_t(lm.width) * lm.height)
+					continue;
+				// lightmaps are BGR just like RGB888 textures
+				jobs.push_back(Job { &lm.data, Texture::RGB888, lm.width, lm.height, options.lightmapFormat });
+				lightmaps.push_back(&lm);
+			}
+		}
+	}
+
+	// start with the largest images, so the threads finish at the same time
+	std::sort(jobs.begin(), jobs.end(), [](Job const & a, Job const & b) {
+		return size_t(a.width) * a.height > size_t(b.width) * b.height;
+	});
+
+	parallelFor(jobs.size(), options.threads, [&](size_t i)
+	{
+		auto const & job = jobs[i];
+		auto const rgba = toRGBA(*job.data, job.format, size_t(job.width) * job.height);
+		*job.data = encode(rgba.data(), job.width, job.height, job.target, options.quality);
+	});
+
+	for(auto * texture : textures)
+		texture->compression = (texture->format == Texture::RGBA8888) ? options.alphaFormat : options.opaqueFormat;
+	for(auto * lm : lightmaps)
+		lm->compression = options.lightmapFormat;
+	return true;
+}
@@ -0,0 +1,49 @@
+#ifndef WMB_COMPRESS_HPP
+#define WMB_COMPRESS_HPP
+
+#include "wmb.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace WMB
+{
+	struct CompressOptions
+	{
+		enum Quality
+		{
+			Fast = 0, // single pass, meant to run at load time
+			High = 1, // refined endpoints and exhaustive index search, for offline baking
+		};
+
+		Quality quality = Fast;
+
+		BlockCompression opaqueFormat = BlockCompression::BC1;   // for RGB888 and RGB565 textures
+		BlockCompression alphaFormat = BlockCompression::BC3;    // for RGBA8888 textures
+		BlockCompression lightmapFormat = BlockCompression::BC1; // for block and terrain lightmaps
+
+		bool compressTextures = true;
+		bool compressLightmaps = true;
+
+		unsigned int threads = 0; // 0 = one thread per core
+	};
+
+	//! Block compresses all uncompressed textures and lightmaps of the
+	//! level. Every mip level and lightmap is encoded as a separate job.
+	//! DDS textures are left untouched. Only BC1, BC3 and BC7 can be
+	//! encoded, returns false and leaves the level untouched if one of the
+	//! formats of the options is another one.
+	bool compress(Level & level, CompressOptions const & options = CompressOptions());
+
+	//! Encodes an image of tightly packed RGBA8 pixels. Sizes that are
+	//! not a multiple of 4 are padded by repeating the border pixels.
+	//! Returns no data for formats other than BC1, BC3 and BC7.
+	std::vector<std::byte> encode(
+		uint8_t const * rgba,
+		unsigned int width,
+		unsigned int height,
+		BlockCompression format,
+		CompressOptions::Quality quality = CompressOptions::Fast);
+}
+
+#endif // WMB_COMPRESS_HPP
@@ -0,0 +1,211 @@
+#include "wmb_cull.hpp"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace WMB;
+
+namespace // anonymous namespace
+{
+	size_t paddedSize(size_t count)
+	{
+		return (count + 7) & ~size_t(7);
+	}
+
+	struct PreparedPlane
+	{
+		// The corner of a box that lies furthest along the plane normal
+		// is the same for all boxes, so the arrays are selected up front.
+		float const * x;
+		float const * y;
+		float const * z;
+		glm::vec4 plane;
+	};
+
+	//! Runs a kernel that classifies four boxes at once and returns
+	//! their visibility in the lower four bits.
+	template<typename Kernel>
+	void run(BoundsTable const & table, CullMask & mask, Kernel const & kernel)
+	{
+		mask.assign((table.count + 63) / 64, 0);
+		for(size_t i = 0; i < table.count; i += 4)
+			mask[i / 64] |= static_cast<uint64_t>(kernel(i)) << (i % 64);
+
+		// the padding boxes must not show up as visible
+		if(table.count % 64)
+			mask.back() &= (uint64_t(1) << (table.count % 64)) - 1;
+	}
+}
+
+void BoundsTable::clear()
+{
+	count = 0;
+	for(auto * array : { &minX, &minY, &minZ, &maxX, &maxY, &maxZ })
+		array->clear();
+}
+
+void BoundsTable::push(glm::vec3 const & minimum, glm::vec3 const & maximum)
+{
+	if(count == minX.size())
+	{
+		for(auto * array : { &minX, &minY, &minZ, &maxX, &maxY, &maxZ })
+			array->resize(paddedSize(count + 1), 0.0f);
+	}
+	minX[count] = minimum.x;
+	minY[count] = minimum.y;
+	minZ[count] = minimum.z;
+	maxX[count] = maximum.x;
+	maxY[count] = maximum.y;
+	maxZ[count] = maximum.z;
+	count++;
+}
+
+BoundsTable WMB::buildBoundsTable(Level const & level)
+{
+	BoundsTable table;
+	for(auto * array : { &table.minX, &table.minY, &table.minZ, &table.maxX, &table.maxY, &table.maxZ })
+		array->reserve(paddedSize(level.blocks.size()));
+
+	for(auto const & block : level.blocks)
+		table.push(block.bbMin, block.bbMax);
+	return table;
+}
+
+Frustum Frustum::fromMatrix(glm::mat4 const & m)
+{
+	auto const row = [&](int i) {
+		return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+	};
+
+	Frustum frustum;
+	frustum.planes[0] = row(3) + row(0); // left
+	frustum.planes[1] = row(3) - row(0); // right
+	frustum.planes[2] = row(3) + row(1); // bottom
+	frustum.planes[3] = row(3) - row(1); // top
+	frustum.planes[4] = row(3) + row(2); // near
+	frustum.planes[5] = row(3) - row(2); // far
+	return frustum;
+}
+
+void WMB::cullFrustum(BoundsTable const & table, Frustum const & frustum, CullMask & visible)
+{
+	std::array<PreparedPlane, 6> planes;
+	for(size_t p = 0; p < planes.size(); p++)
+	{
+		auto const & plane = frustum.planes[p];
+		planes[p].x = (plane.x >= 0.0f) ? table.maxX.data() : table.minX.data();
+		planes[p].y = (plane.y >= 0.0f) ? table.maxY.data() : table.minY.data();
+		planes[p].z = (plane.z >= 0.0f) ? table.maxZ.data() : table.minZ.data();
+		planes[p].plane = plane;
+	}
+
+	run(table, visible, [&](size_t i) -> unsigned
+	{
+#if defined(__SSE2__)
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for(auto const & p : planes)
+		{
+			__m128 dist = _mm_set1_ps(p.plane.w);
+			dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(p.plane.x), _mm_loadu_ps(p.x + i)));
+			dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(p.plane.y), _mm_loadu_ps(p.y + i)));
+			dist = _mm_add_ps(dist, _mm_mul_ps(_mm_set1_ps(p.plane.z), _mm_loadu_ps(p.z + i)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, _mm_setzero_ps()));
+		}
+		return static_cast<unsigned>(_mm_movemask_ps(inside));
+#else
+		unsigned bits = 0;
+		for(size_t lane = 0; lane < 4; lane++)
+		{
+			bool inside = true;
+			for(auto const & p : planes)
+			{
+				float const dist = p.plane.w +
+					p.plane.x * p.x[i + lane] +
+					p.plane.y * p.y[i + lane] +
+					p.plane.z * p.z[i + lane];
+				inside = inside and (dist >= 0.0f);
+			}
+			bits |= (inside ? 1u : 0u) << lane;
+		}
+		return bits;
+#endif
+	});
+}
+
+void WMB::cullSphere(BoundsTable const & table, glm::vec3 const & center, float radius, CullMask & visible)
+{
+	run(table, visible, [&](size_t i) -> unsigned
+	{
+#if defined(__SSE2__)
+		auto const axis = [&](float const * minimum, float const * maximum, float c)
+		{
+			__m128 const pos = _mm_set1_ps(c);
+			__m128 const below = _mm_sub_ps(_mm_loadu_ps(minimum + i), pos);
+			__m128 const above = _mm_sub_ps(pos, _mm_loadu_ps(maximum + i));
+			__m128 const d = _mm_max_ps(_mm_max_ps(below, above), _mm_setzero_ps());
+			return _mm_mul_ps(d, d);
+		};
+		__m128 dist2 = axis(table.minX.data(), table.maxX.data(), center.x);
+		dist2 = _mm_add_ps(dist2, axis(table.minY.data(), table.maxY.data(), center.y));
+		dist2 = _mm_add_ps(dist2, axis(table.minZ.data(), table.maxZ.data(), center.z));
+		return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(dist2, _mm_set1_ps(radius * radius))));
+#else
+		unsigned bits = 0;
+		for(size_t lane = 0; lane < 4; lane++)
+		{
+			size_t const j = i + lane;
+			glm::vec3 const minimum(table.minX[j], table.minY[j], table.minZ[j]);
+			glm::vec3 const maximum(table.maxX[j], table.maxY[j], table.maxZ[j]);
+			glm::vec3 const d = glm::max(glm::max(minimum - center, center - maximum), glm::vec3(0.0f));
+			bits |= ((glm::dot(d, d) <= radius * radius) ? 1u : 0u) << lane;
+		}
+		return bits;
+#endif
+	});
+}
+
+void WMB::cullBox(BoundsTable const & table, glm::vec3 const & minimum, glm::vec3 const & maximum, CullMask & visible)
+{
+	run(table, visible, [&](size_t i) -> unsigned
+	{
+#if defined(__SSE2__)
+		auto const axis = [&](float const * lower, float const * upper, float lo, float hi)
+		{
+			return _mm_and_ps(
+				_mm_cmple_ps(_mm_loadu_ps(lower + i), _mm_set1_ps(hi)),
+				_mm_cmpge_ps(_mm_loadu_ps(upper + i), _mm_set1_ps(lo)));
+		};
+		__m128 overlap = axis(table.minX.data(), table.maxX.data(), minimum.x, maximum.x);
+		overlap = _mm_and_ps(overlap, axis(table.minY.data(), table.maxY.data(), minimum.y, maximum.y));
+		overlap = _mm_and_ps(overlap, axis(table.minZ.data(), table.maxZ.data(), minimum.z, maximum.z));
+		return static_cast<unsigned>(_mm_movemask_ps(overlap));
+#else
+		unsigned bits = 0;
+		for(size_t lane = 0; lane < 4; lane++)
+		{
+			size_t const j = i + lane;
+			bool const overlap =
+				(table.minX[j] <= maximum.x) and (table.maxX[j] >= minimum.x) and
+				(table.minY[j] <= maximum.y) and (table.maxY[j] >= minimum.y) and
+				(table.minZ[j] <= maximum.z) and (table.maxZ[j] >= minimum.z);
+			bits |= (overlap ? 1u : 0u) << lane;
+		}
+		return bits;
+#endif
+	});
+}
+
+void WMB::toIndices(CullMask const & mask, std::vector<uint32_t> & indices)
+{
+	indices.clear();
+	for(size_t word = 0; word < mask.size(); word++)
+	{
+		uint64_t bits = mask[word];
+		while(bits != 0)
+		{
+			indices.push_back(static_cast<uint32_t>(64 * word + __builtin_ctzll(bits)));
+			bits &= bits - 1;
+		}
+	}
+}
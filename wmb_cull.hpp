@@ -0,0 +1,50 @@
+#ifndef WMB_CULL_HPP
+#define WMB_CULL_HPP
+
+#include "wmb.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace WMB
+{
+	//! Block bounding boxes as a structure of arrays. The arrays are padded
+	//! to a multiple of 8 entries, so the culling kernels never need a
+	//! scalar tail loop.
+	struct BoundsTable
+	{
+		size_t count = 0; // number of valid boxes
+		std::vector<float> minX, minY, minZ;
+		std::vector<float> maxX, maxY, maxZ;
+
+		void clear();
+		void push(glm::vec3 const & minimum, glm::vec3 const & maximum);
+	};
+
+	BoundsTable buildBoundsTable(Level const & level);
+
+	struct Frustum
+	{
+		// xyz = normal, w = distance. A point p is inside of a plane
+		// when dot(xyz, p) + w >= 0. Normals don't have to be normalized.
+		std::array<glm::vec4, 6> planes;
+
+		//! Extracts the planes of a view-projection matrix with OpenGL clip
+		//! space (-w <= z <= w). For a 0..w depth range the near plane is
+		//! conservative.
+		static Frustum fromMatrix(glm::mat4 const & viewProjection);
+	};
+
+	//! One bit per box, bit (i % 64) of word (i / 64) is set when box i is visible.
+	using CullMask = std::vector<uint64_t>;
+
+	void cullFrustum(BoundsTable const & table, Frustum const & frustum, CullMask & visible);
+	void cullSphere(BoundsTable const & table, glm::vec3 const & center, float radius, CullMask & visible);
+	void cullBox(BoundsTable const & table, glm::vec3 const & minimum, glm::vec3 const & maximum, CullMask & visible);
+
+	//! Converts a mask into a sorted list of box indices.
+	void toIndices(CullMask const & mask, std::vector<uint32_t> & indices);
+}
+
+#endif // WMB_CULL_HPP
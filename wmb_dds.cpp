@@ -0,0 +1,294 @@
+#include "wmb.hpp"
+#include "wmb_format.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	enum : uint32_t
+	{
+		DDSD_CAPS = 0x1,
+		DDSD_HEIGHT = 0x2,
+		DDSD_WIDTH = 0x4,
+		DDSD_PIXELFORMAT = 0x1000,
+		DDSD_MIPMAPCOUNT = 0x20000,
+		DDSD_LINEARSIZE = 0x80000,
+
+		DDPF_ALPHAPIXELS = 0x1,
+		DDPF_FOURCC = 0x4,
+		DDPF_RGB = 0x40,
+
+		DDSCAPS_COMPLEX = 0x8,
+		DDSCAPS_TEXTURE = 0x1000,
+		DDSCAPS_MIPMAP = 0x400000,
+
+		DXGI_FORMAT_BC1_UNORM = 71,
+		DXGI_FORMAT_BC1_UNORM_SRGB = 72,
+		DXGI_FORMAT_BC2_UNORM = 74,
+		DXGI_FORMAT_BC2_UNORM_SRGB = 75,
+		DXGI_FORMAT_BC3_UNORM = 77,
+		DXGI_FORMAT_BC3_UNORM_SRGB = 78,
+		DXGI_FORMAT_BC4_UNORM = 80,
+		DXGI_FORMAT_BC5_UNORM = 83,
+		DXGI_FORMAT_BC7_UNORM = 98,
+		DXGI_FORMAT_BC7_UNORM_SRGB = 99,
+
+		D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3,
+	};
+
+	bool isFourCC(DDS_PIXELFORMAT const & pf, char const * code)
+	{
+		return memcmp(pf.fourCC.data(), code, 4) == 0;
+	}
+
+	BlockCompression fromDXGI(uint32_t format)
+	{
+		switch(format)
+		{
+			case DXGI_FORMAT_BC1_UNORM:
+			case DXGI_FORMAT_BC1_UNORM_SRGB: return BlockCompression::BC1;
+			case DXGI_FORMAT_BC2_UNORM:
+			case DXGI_FORMAT_BC2_UNORM_SRGB: return BlockCompression::BC2;
+			case DXGI_FORMAT_BC3_UNORM:
+			case DXGI_FORMAT_BC3_UNORM_SRGB: return BlockCompression::BC3;
+			case DXGI_FORMAT_BC4_UNORM:      return BlockCompression::BC4;
+			case DXGI_FORMAT_BC5_UNORM:      return BlockCompression::BC5;
+			case DXGI_FORMAT_BC7_UNORM:
+			case DXGI_FORMAT_BC7_UNORM_SRGB: return BlockCompression::BC7;
+			default:                         return BlockCompression::None;
+		}
+	}
+
+	size_t blockBytes(BlockCompression format)
+	{
+		switch(format)
+		{
+			case BlockCompression::BC1:
+			case BlockCompression::BC4:
+				return 8;
+			default:
+				return 16;
+		}
+	}
+
+	size_t levelSize(BlockCompression format, size_t bitsPerPixel, unsigned width, unsigned height)
+	{
+		if(format == BlockCompression::None)
+			return (size_t(width) * height * bitsPerPixel) / 8;
+		return size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+	}
+}
+
+bool WMB::detail::decodeDDS(std::vector<std::byte> & blob, Texture & texture)
+{
+	if(not decodeDDS(ByteView { blob.data(), blob.size() }, texture))
+		return false;
+
+	// moving the vector keeps its buffer, so the views stay valid
+	texture.storage = std::make_shared<std::vector<std::byte> const>(std::move(blob));
+	return true;
+}
+
+bool WMB::detail::decodeDDS(ByteView blob, Texture & texture)
+{
+	std::vector<FileSpan> levels;
+	if(not decodeDDSHeader(blob, blob.size(), texture, levels))
+		return false;
+
+	texture.levels.clear();
+	texture.mips.clear();
+	for(auto const & level : levels)
+		texture.mips.push_back(ByteView { blob.data() + level.offset, level.size });
+	return true;
+}
+
+bool WMB::detail::decodeDDSHeader(ByteView blob, size_t imageSize, Texture & texture, std::vector<FileSpan> & levels)
+{
+	if(blob.size() < 4 + sizeof(DDS_HEADER) or memcmp(blob.data(), "DDS ", 4) != 0)
+		return false;
+
+	DDS_HEADER header;
+	memcpy(&header, blob.data() + 4, sizeof header);
+	if(header.size != sizeof(DDS_HEADER) or header.width == 0 or header.height == 0)
+		return false;
+
+	size_t offset = 4 + sizeof(DDS_HEADER);
+	auto const & pf = header.ddspf;
+
+	BlockCompression compression = BlockCompression::None;
+	Texture::Format format = Texture::DDS;
+	size_t bitsPerPixel = 0;
+
+	if(pf.flags & DDPF_FOURCC)
+	{
+		if(isFourCC(pf, "DXT1"))
+			compression = BlockCompression::BC1;
+		else if(isFourCC(pf, "DXT2") or isFourCC(pf, "DXT3"))
+			compression = BlockCompression::BC2;
+		else if(isFourCC(pf, "DXT4") or isFourCC(pf, "DXT5"))
+			compression = BlockCompression::BC3;
+		else if(isFourCC(pf, "ATI1") or isFourCC(pf, "BC4U"))
+			compression = BlockCompression::BC4;
+		else if(isFourCC(pf, "ATI2") or isFourCC(pf, "BC5U"))
+			compression = BlockCompression::BC5;
+		else if(isFourCC(pf, "DX10"))
+		{
+			if(blob.size() < offset + sizeof(DDS_HEADER_DXT10))
+				return false;
+			DDS_HEADER_DXT10 dx10;
+			memcpy(&dx10, blob.data() + offset, sizeof dx10);
+			offset += sizeof dx10;
+			compression = fromDXGI(dx10.dxgiFormat);
+		}
+
+		if(compression == BlockCompression::None)
+			return false;
+	}
+	else if(pf.flags & DDPF_RGB)
+	{
+		// Uncompressed images in one of the WMB layouts are exposed as
+		// such, so they can be used like any other texture.
+		bool const alpha = (pf.flags & DDPF_ALPHAPIXELS) and (pf.aMask == 0xFF000000);
+		if(pf.rgbBitCount == 32 and pf.rMask == 0x00FF0000 and pf.gMask == 0x0000FF00 and pf.bMask == 0x000000FF and alpha)
+			format = Texture::RGBA8888;
+		else if(pf.rgbBitCount == 24 and pf.rMask == 0x00FF0000 and pf.gMask == 0x0000FF00 and pf.bMask == 0x000000FF)
+			format = Texture::RGB888;
+		else if(pf.rgbBitCount == 16 and pf.rMask == 0xF800 and pf.gMask == 0x07E0 and pf.bMask == 0x001F)
+			format = Texture::RGB565;
+		else
+			return false;
+		bitsPerPixel = pf.rgbBitCount;
+	}
+	else
+	{
+		return false;
+	}
+
+	size_t mipCount = 1;
+	if(header.flags & DDSD_MIPMAPCOUNT)
+		mipCount = std::max<uint32_t>(1, header.mipMapCount);
+
+	// A full chain ends with a 1x1 level, more levels would shift the
+	// edges by 32 bits or more
+	size_t fullChain = 1;
+	for(uint32_t edge = std::max(header.width, header.height); edge > 1; edge >>= 1)
+		fullChain++;
+	mipCount = std::min(mipCount, fullChain);
+
+	// Only the first surface is used, cube maps and volumes have more
+	// surfaces after the mip chain of the first one.
+	std::vector<FileSpan> spans;
+	for(size_t i = 0; i < mipCount; i++)
+	{
+		unsigned const w = std::max(1u, header.width >> i);
+		unsigned const h = std::max(1u, header.height >> i);
+		size_t const len = levelSize(compression, bitsPerPixel, w, h);
+		if(offset + len > imageSize)
+			break; // truncated mip chain
+		spans.push_back(FileSpan { offset, len });
+		offset += len;
+	}
+	if(spans.empty())
+		return false;
+
+	texture.width = header.width;
+	texture.height = header.height;
+	texture.format = format;
+	texture.compression = compression;
+	texture.hasMipMaps = (spans.size() > 1);
+	levels = std::move(spans);
+	return true;
+}
+
+bool WMB::detail::storesDDSFile(Texture const & texture)
+{
+	if(not texture.storage or texture.mips.empty())
+		return false;
+
+	auto const & blob = *texture.storage;
+	if(blob.size() < 4 + sizeof(DDS_HEADER) or memcmp(blob.data(), "DDS ", 4) != 0)
+		return false;
+
+	// the first level follows the header directly
+	size_t const offset = texture.mips[0].data() - blob.data();
+	return (offset == 4 + sizeof(DDS_HEADER)) or (offset == 4 + sizeof(DDS_HEADER) + sizeof(DDS_HEADER_DXT10));
+}
+
+bool WMB::detail::hasExtraSurfaces(ByteView blob, Texture const & texture)
+{
+	if(texture.mips.empty())
+		return false;
+	auto const & last = texture.mips.back();
+	return size_t(last.data() + last.size() - blob.data()) < blob.size();
+}
+
+std::vector<std::byte> WMB::detail::encodeDDS(Texture const & texture)
+{
+	size_t const mipCount = texture.levelCount();
+
+	DDS_HEADER header;
+	memset(&header, 0, sizeof header);
+	header.size = sizeof(DDS_HEADER);
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE;
+	header.width = texture.width;
+	header.height = texture.height;
+	header.pitchOrLinearSize = mipCount > 0 ? texture.level(0).size() : 0;
+	header.caps = DDSCAPS_TEXTURE;
+	if(mipCount > 1)
+	{
+		header.flags |= DDSD_MIPMAPCOUNT;
+		header.mipMapCount = mipCount;
+		header.caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+	}
+	header.ddspf.size = sizeof(DDS_PIXELFORMAT);
+	header.ddspf.flags = DDPF_FOURCC;
+
+	bool dx10 = false;
+	DDS_HEADER_DXT10 ext;
+	memset(&ext, 0, sizeof ext);
+	switch(texture.compression)
+	{
+		case BlockCompression::BC1: memcpy(header.ddspf.fourCC.data(), "DXT1", 4); break;
+		case BlockCompression::BC2: memcpy(header.ddspf.fourCC.data(), "DXT3", 4); break;
+		case BlockCompression::BC3: memcpy(header.ddspf.fourCC.data(), "DXT5", 4); break;
+		case BlockCompression::BC4: memcpy(header.ddspf.fourCC.data(), "ATI1", 4); break;
+		case BlockCompression::BC5: memcpy(header.ddspf.fourCC.data(), "ATI2", 4); break;
+		case BlockCompression::BC7:
+			memcpy(header.ddspf.fourCC.data(), "DX10", 4);
+			dx10 = true;
+			ext.dxgiFormat = DXGI_FORMAT_BC7_UNORM;
+			ext.resourceDimension = D3D10_RESOURCE_DIMENSION_TEXTURE2D;
+			ext.arraySize = 1;
+			break;
+		default:
+			return { };
+	}
+
+	size_t total = 4 + sizeof header + (dx10 ? sizeof ext : 0);
+	for(size_t i = 0; i < mipCount; i++)
+		total += texture.level(i).size();
+
+	std::vector<std::byte> blob(total);
+	std::byte * out = blob.data();
+	memcpy(out, "DDS ", 4);
+	out += 4;
+	memcpy(out, &header, sizeof header);
+	out += sizeof header;
+	if(dx10)
+	{
+		memcpy(out, &ext, sizeof ext);
+		out += sizeof ext;
+	}
+	for(size_t i = 0; i < mipCount; i++)
+	{
+		auto const mip = texture.level(i);
+		if(not mip.empty())
+			memcpy(out, mip.data(), mip.size());
+		out += mip.size();
+	}
+	return blob;
+}
@@ -0,0 +1,582 @@
+#ifndef WMB_FORMAT_HPP
+#define WMB_FORMAT_HPP
+
+// On-disk structures of the WMB7 format, shared by the loader and the
+// writer. This header is not part of the public interface.
+
+#include "wmb.hpp"
+
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <exception>
+
+namespace WMB::detail
+{
+	struct __attribute__((packed)) LIST
+	{
+		//! offset of the list from the start of the WMB file, in bytes
+		uint32_t offset;
+
+		//! length of the list, in bytes
+		uint32_t length;
+	};
+
+	struct WMB_HEADER
+	{
+		//! "WMB7"
+		std::array<char, 4> version;
+		LIST palettes;// WMB1..6 only
+		LIST legacy1; // WMB1..6 only
+		LIST textures;// textures list
+		LIST legacy2; // WMB1..6 only
+		LIST pvs;     // BSP only
+		LIST bsp_nodes; // BSP only
+		LIST materials; // material names
+		LIST legacy3; // WMB1..6 only
+		LIST legacy4; // WMB1..6 only
+		LIST aabb_hulls; // WMB1..6 only
+		LIST bsp_leafs;  // BSP only
+		LIST bsp_blocks; // BSP only
+		LIST legacy5; // WMB1..6 only
+		LIST legacy6; // WMB1..6 only
+		LIST legacy7; // WMB1..6 only
+		LIST objects; // entities, paths, sounds, etc.
+		LIST lightmaps; // lightmaps for blocks
+		LIST blocks;  // block meshes
+		LIST legacy8; // WMB1..6 only
+		LIST lightmaps_terrain; // lightmaps for terrains
+	};
+
+	struct __attribute__((packed)) TEXTURE
+	{
+		std::array<char, 16> name;   // texture name, max. 16 characters
+		uint32_t width,height; // texture size
+		uint32_t type;	    // texture type: 5 = 8888 RGBA; 4 = 888 RGB; 2 = 565 RGB; 6 = DDS; +8 = mipmaps
+		uint32_t legacy[3]; // always 0
+	};
+
+	struct MATERIAL_INFO
+	{
+		std::array<char, 44> legacy;   // always 0
+		std::array<char, 20> material; // material name from the script, max. 20 characters
+	};
+
+	static_assert(sizeof(MATERIAL_INFO) == 64);
+
+	////////////////////////////////////////////////////////////////////////////////
+
+	enum class OBJECT_TYPE : uint32_t
+	{
+		Position = 1,
+		Light = 2,
+		OldEntity = 3,
+		Sound = 4,
+		Info = 5,
+		Path = 6,
+		Entity = 7,
+		Region = 8,
+	};
+
+
+	struct __attribute__((packed)) WMB_INFO
+	{
+		// uint32_t  type;      // 5 = INFO
+		std::array<float, 3> origin; // not used
+		float azimuth;   // sun azimuth
+		float elevation; // sun elevation
+		uint32_t  flags;     // always 127 (0x7F)
+		float version;	 // compiler version
+		std::uint8_t  gamma;     // light level at black
+		std::uint8_t  LMapSize;	 // 0,1,2 for lightmap sizes 256x256, 512x512, or 1024x1024
+		uint32_t  unused[2];
+		uint32_t dwSunColor, dwAmbientColor; // color double word, ARGB
+		uint32_t dwFogColor[4];
+	};
+
+	struct __attribute__((packed)) WMB_POSITION
+	{
+		// long  type;      // 1 = POSITION
+		std::array<float, 3> origin;
+		std::array<float, 3> angle;
+		uint32_t  unused[2];
+		std::array<char, 20>  name;
+	};
+
+	struct __attribute__((packed)) WMB_LIGHT
+	{
+		// long  type;      // 2 = LIGHT
+		std::array<float, 3> origin;
+		float red,green,blue; // color in percent, 0..100
+		float range;
+		uint32_t  flags;     // 0 = static, 2 = dynamic
+	};
+
+	struct __attribute__((packed)) WMB_SOUND
+	{
+		// long  type;      // 4 = Sound
+		std::array<float, 3> origin;
+		float volume;
+		float unused[2];
+		uint32_t  range;
+		uint32_t  flags;    // always 0
+		std::array<char,33> filename;
+	};
+
+	struct __attribute__((packed)) WMB_PATH
+	{
+		// long  type;		 // 6 = PATH
+		std::array<char, 20> name;	 // Path name
+		float fNumPoints;// number of nodes
+		uint32_t  unused[3]; // always 0
+		uint32_t  num_edges;
+	};
+
+	struct __attribute__((packed)) PATH_EDGE
+	{
+		float fNode1,fNode2; // node numbers of the edge, starting with 1
+		float fLength;
+		float fBezier;
+		float fWeight;
+		float fSkill;
+	};
+
+	struct __attribute__((packed)) WMB_ENTITY
+	{
+		// long  type;     // 7 = ENTITY
+		std::array<float, 3> origin;
+		std::array<float, 3> angle;
+		std::array<float, 3> scale;
+		std::array<char, 33>  name;
+		std::array<char, 33>  filename;
+		std::array<char, 33>  action;
+		uint8_t unused1;
+		std::array<float, 20> skill;
+		uint32_t  flags;
+		float ambient;
+		float albedo;
+		int32_t  path;    // attached path index, starting with 1, or 0 for no path
+		uint32_t  entity2; // attached entity index, starting with 1, or 0 for no attached entity
+		std::array<char, 33> material;
+		std::array<char, 33> string1;
+		std::array<char, 33> string2;
+		char  unused2[33];
+	};
+
+	struct __attribute__((packed)) WMB_OLD_ENTITY
+	{
+		// long  type;     // 3 = OLD ENTITY
+		std::array<float, 3> origin;
+		std::array<float, 3> angle;
+		std::array<float, 3> scale;
+		std::array<char, 20> name;
+		std::array<char, 13> filename;
+		std::array<char, 20> action;
+		std::array<float, 8> skill;
+		uint32_t  flags;
+		float ambient;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+
+	struct __attribute__((packed)) BLOCK
+	{
+		std::array<float, 3> fMins; // bounding box
+		std::array<float, 3> fMaxs; // bounding box
+		uint32_t lContent;  // always 0
+		uint32_t lNumVerts; // number of VERTEX structs that follow
+		uint32_t lNumTris;  // number of TRIANGLE structs that follow
+		uint32_t lNumSkins; // number of SKIN structs that follow
+	};
+
+	struct __attribute__((packed)) VERTEX
+	{
+		float x,y,z; // position
+		float tu,tv; // texture coordinates
+		float su,sv; // lightmap coordinates
+	};
+
+	struct __attribute__((packed)) TRIANGLE
+	{
+		uint16_t v1,v2,v3; // indices into the VERTEX array
+		uint16_t skin;  // index into the SKIN array
+		uint32_t unused; // always 0
+	};
+
+	struct __attribute__((packed)) SKIN
+	{
+		uint16_t texture;  // index into the textures list
+		uint16_t lightmap; // index into the lightmaps list
+		uint32_t material; // index into the MATERIAL_INFO array
+		float ambient,albedo;
+		uint32_t flags;     // bit 1 = flat (no lightmap), bit 2 = sky, bit 14 = smooth
+	};
+
+	// The BSP lists are written by the map compiler for BSP levels only.
+	// Their records are not documented, the layout below is the one this
+	// library assumes. It is not the Quake layout: nodes store their plane
+	// instead of a plane index, the bounds are floats and leafs reference
+	// blocks instead of faces. The lists have no count prefix, the number
+	// of entries is given by the list length. Because of that they are
+	// only decoded with LoadOptions::DECODE_BSP and saved unchanged.
+	//
+	// A PVS row has one bit per leaf, bit i is leaf i. Unlike Quake no
+	// leaf is left out. A zero byte is followed by the number of zero
+	// bytes it stands for.
+
+	struct __attribute__((packed)) BSP_NODE
+	{
+		std::array<float, 3> normal; // plane normal
+		float distance;              // plane distance
+		std::array<int32_t, 2> children; // front/back child, negative numbers are -(leaf + 1)
+		std::array<float, 3> mins; // bounding box
+		std::array<float, 3> maxs; // bounding box
+	};
+
+	struct __attribute__((packed)) BSP_LEAF
+	{
+		uint32_t contents;   // not used
+		int32_t  pvs;        // offset into the PVS list, -1 = no visibility information
+		std::array<float, 3> mins; // bounding box
+		std::array<float, 3> maxs; // bounding box
+		uint32_t firstBlock; // index into the BSP_BLOCKS list
+		uint32_t numBlocks;  // number of block indices of this leaf
+	};
+
+	static_assert(sizeof(BSP_NODE) == 48);
+	static_assert(sizeof(BSP_LEAF) == 40);
+
+	struct __attribute__((packed)) LIGHTMAP_TERRAIN
+	{
+		uint32_t object; // terrain entity index into the objects list
+		uint32_t width, height; // lightmap size
+	};
+
+	struct __attribute__((packed)) REGION
+	{
+		std::array<float, 3> min;
+		std::array<float, 3> max;
+		uint32_t val_a;
+		uint32_t val_b;
+		std::array<char, 32> name;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+
+	// DDS images embedded into the textures list
+
+	struct __attribute__((packed)) DDS_PIXELFORMAT
+	{
+		uint32_t size;   // always 32
+		uint32_t flags;  // DDPF_*
+		std::array<char, 4> fourCC;
+		uint32_t rgbBitCount;
+		uint32_t rMask, gMask, bMask, aMask;
+	};
+
+	struct __attribute__((packed)) DDS_HEADER
+	{
+		// preceded by the magic "DDS "
+		uint32_t size;  // always 124
+		uint32_t flags; // DDSD_*
+		uint32_t height;
+		uint32_t width;
+		uint32_t pitchOrLinearSize;
+		uint32_t depth;
+		uint32_t mipMapCount;
+		uint32_t reserved1[11];
+		DDS_PIXELFORMAT ddspf;
+		uint32_t caps, caps2, caps3, caps4;
+		uint32_t reserved2;
+	};
+
+	struct __attribute__((packed)) DDS_HEADER_DXT10
+	{
+		// follows DDS_HEADER when the fourCC is "DX10"
+		uint32_t dxgiFormat;
+		uint32_t resourceDimension;
+		uint32_t miscFlag;
+		uint32_t arraySize;
+		uint32_t miscFlags2;
+	};
+
+	static_assert(sizeof(DDS_HEADER) == 124);
+	static_assert(sizeof(DDS_HEADER_DXT10) == 20);
+
+	//! Decodes the header of a DDS image and sets the dimensions,
+	//! compression and mip views of the texture. The blob is moved into
+	//! the texture storage on success and left untouched otherwise.
+	bool decodeDDS(std::vector<std::byte> & blob, Texture & texture);
+
+	//! Like above, but the mip views point into the given memory and the
+	//! storage of the texture is not set.
+	bool decodeDDS(ByteView blob, Texture & texture);
+
+	//! Like above, but only the headers at the start of the image are
+	//! needed. The places of the levels in the image of the given size are
+	//! returned instead of views.
+	bool decodeDDSHeader(ByteView blob, size_t imageSize, Texture & texture, std::vector<FileSpan> & levels);
+
+	//! Largest DDS header, including the DX10 extension.
+	constexpr size_t maxDDSHeaderSize = 4 + sizeof(DDS_HEADER) + sizeof(DDS_HEADER_DXT10);
+
+	//! True when the storage of the texture is the DDS file its levels
+	//! were decoded from, and not a pool shared with other textures.
+	bool storesDDSFile(Texture const & texture);
+
+	//! True when a DDS image has data after the levels of the texture,
+	//! like the other faces of a cube map or the slices of an array. Only
+	//! the first surface is decoded, so such textures keep their DDS file
+	//! as storage and are not pooled or streamed.
+	bool hasExtraSurfaces(ByteView blob, Texture const & texture);
+
+	//! Wraps the levels of a block compressed texture into a DDS image.
+	std::vector<std::byte> encodeDDS(Texture const & texture);
+
+	////////////////////////////////////////////////////////////////////////////////
+
+	struct File
+	{
+		FILE * f;
+		bool truncated = false; // set when a read hit the end of the file
+
+		File(FILE * f) : f(f)
+		{
+
+		}
+
+		File(File const &) = delete;
+		File(File &&) = delete;
+
+		~File()
+		{
+			if(f != nullptr)
+				fclose(f);
+		}
+
+		operator bool() const
+		{
+			return (f != nullptr);
+		}
+
+		operator FILE* ()
+		{
+			return f;
+		}
+
+		void seek(long offset, int mode = SEEK_SET)
+		{
+			fseek(f, offset, mode);
+		}
+
+		size_t size()
+		{
+			long const pos = ftell(f);
+			fseek(f, 0, SEEK_END);
+			long const len = ftell(f);
+			fseek(f, pos, SEEK_SET);
+			return (len < 0) ? 0 : size_t(len);
+		}
+
+		//! Reads a value, missing bytes at the end of the file read as zero.
+		template<typename T>
+		typename std::enable_if<std::is_trivially_constructible<T>::value, T>::type read()
+		{
+			uint8_t buffer[sizeof(T)] = { };
+
+			size_t offset = 0;
+			while(offset < sizeof(T))
+			{
+				size_t const len = fread(&buffer[offset], 1, sizeof(T) - offset, f);
+				if(len == 0)
+				{
+					truncated = true;
+					break;
+				}
+				offset += len;
+			}
+
+			return reinterpret_cast<T&>(*buffer);
+		}
+
+		//! Reads len bytes into data, missing bytes are left untouched.
+		void read(std::byte * data, size_t const len)
+		{
+			size_t offset = 0;
+			while(offset < len)
+			{
+				size_t const count = fread(data + offset, 1, len - offset, f);
+				if(count == 0)
+				{
+					truncated = true;
+					break;
+				}
+				offset += count;
+			}
+		}
+
+		std::vector<std::byte> read(size_t const len)
+		{
+			std::vector<std::byte> data(len);
+			read(data.data(), data.size());
+			return data;
+		}
+	};
+
+	inline glm::vec4 toColor(uint32_t val)
+	{
+		auto const select = [](uint32_t val, int byte) -> uint8_t {
+			return (val >> (8 * byte)) & 0xFF;
+		};
+		return glm::vec4(
+			select(val, 3) / 255.0,
+			select(val, 2) / 255.0,
+			select(val, 1) / 255.0,
+			select(val, 0) / 255.0);
+	}
+
+	inline uint32_t fromColor(glm::vec4 const & color)
+	{
+		auto const byte = [](float value, int byte) -> uint32_t {
+			return uint32_t(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f) << (8 * byte);
+		};
+		return byte(color.x, 3) | byte(color.y, 2) | byte(color.z, 1) | byte(color.w, 0);
+	}
+
+	template<typename T, size_t N>
+	std::string toString(T const (&chars)[N])
+	{
+		char buffer[N + 1];
+		strncpy(buffer, chars, N);
+		buffer[N] = 0;
+		return std::string(buffer);
+	}
+
+	template<typename T, size_t N>
+	std::string toString(std::array<T, N> const & chars)
+	{
+		char buffer[N + 1];
+		strncpy(buffer, chars.data(), N);
+		buffer[N] = 0;
+		return std::string(buffer);
+	}
+
+	//! 64 bit hash of a byte range that reads 8 bytes per step. Only used
+	//! to detect changes, not for anything security related.
+	inline uint64_t hashBytes(std::byte const * data, size_t length, uint64_t seed = 0)
+	{
+		auto const rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+		auto const mix = [&](uint64_t h, uint64_t k)
+		{
+			k *= 0x87C37B91114253D5ull;
+			k = rotl(k, 31);
+			k *= 0x4CF5AD432745937Full;
+			h ^= k;
+			return rotl(h, 27) * 5 + 0x52DCE729;
+		};
+
+		uint64_t h = seed ^ (length * 0x9E3779B97F4A7C15ull);
+		size_t i = 0;
+		for(; i + 8 <= length; i += 8)
+		{
+			uint64_t k;
+			memcpy(&k, data + i, 8);
+			h = mix(h, k);
+		}
+		if(i < length)
+		{
+			uint64_t k = 0;
+			memcpy(&k, data + i, length - i);
+			h = mix(h, k);
+		}
+
+		// finalizer of MurmurHash3
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDull;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ull;
+		h ^= h >> 33;
+		return h;
+	}
+
+	inline Info toInfo(WMB_INFO const & inf)
+	{
+		static constexpr std::array<unsigned int, 3> lightMapSizes =
+		{
+			256, 512, 1024
+		};
+
+		Info info;
+
+		info.azimuth = inf.azimuth;
+		info.elevation = inf.elevation;
+		info.gamma = inf.gamma / 255.0f;
+		info.lightMapSize = lightMapSizes.at(inf.LMapSize);
+		info.sunColor = toColor(inf.dwSunColor);
+		info.ambientColor = toColor(inf.dwAmbientColor);
+		for(size_t i = 0; i < 4; i++)
+			info.fogColor[i] = toColor(inf.dwFogColor[i]);
+
+		return info;
+	}
+
+	//! Inverse of toString, truncates the string if it is too long.
+	template<size_t N>
+	std::array<char, N> toChars(std::string const & str)
+	{
+		std::array<char, N> chars = { };
+		memcpy(chars.data(), str.data(), std::min(str.size(), N));
+		return chars;
+	}
+
+	//! Returns the matrix that maps Gamestudio coordinates into the given
+	//! coordinate system with v * matrix. All mappings are orthonormal, so
+	//! matrix * v maps back into Gamestudio coordinates.
+	inline glm::mat3 coordinateMatrix(LoadOptions::CoordinateSystem system)
+	{
+		switch(system)
+		{
+			case LoadOptions::Gamestudio:
+				return glm::identity<glm::mat3>();
+			case LoadOptions::OpenGL:
+				return glm::mat3(
+					 0.0, -1.0,  0.0,
+					 0.0,  0.0,  1.0,
+					-1.0,  0.0,  0.0
+				);
+			case LoadOptions::DirectX:
+				return glm::mat3(
+					 0.0, -1.0,  0.0,
+					 0.0,  0.0,  1.0,
+					 1.0,  0.0,  0.0
+			    );
+			default:
+				std::terminate();
+		}
+	}
+
+	inline glm::vec3 toVec3(float const (&array)[3])
+	{
+		return glm::vec3(array[0], array[1], array[2]);
+	}
+
+	inline glm::vec3 toVec3(std::array<float,3> const & array)
+	{
+		return glm::vec3(array[0], array[1], array[2]);
+	}
+
+	inline Euler toEuler(float const (&array)[3])
+	{
+		return Euler { array[0], array[1], array[2] };
+	}
+
+	inline Euler toEuler(std::array<float, 3> const & array)
+	{
+		return Euler { array[0], array[1], array[2] };
+	}
+}
+
+#endif // WMB_FORMAT_HPP
@@ -0,0 +1,308 @@
+#include "wmb.hpp"
+#include "wmb_parallel.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	// cos(0.5°), flat triangles closer to each other share their vertices
+	float const coplanar = 0.99996f;
+
+	struct PositionKey
+	{
+		std::array<uint32_t, 3> bits;
+
+		bool operator==(PositionKey const & other) const
+		{
+			return bits == other.bits;
+		}
+	};
+
+	struct PositionKeyHash
+	{
+		size_t operator()(PositionKey const & key) const
+		{
+			// FNV-1a over the coordinate bits
+			uint64_t hash = 14695981039346656037ull;
+			for(auto const bits : key.bits)
+			{
+				hash ^= bits;
+				hash *= 1099511628211ull;
+			}
+			return static_cast<size_t>(hash ^ (hash >> 32));
+		}
+	};
+
+	PositionKey toKey(glm::vec3 const & position)
+	{
+		PositionKey key;
+		for(int i = 0; i < 3; i++)
+		{
+			// treat -0.0 and +0.0 as equal
+			float value = position[i];
+			if(value == 0.0f)
+				value = 0.0f;
+			memcpy(&key.bits[i], &value, sizeof(uint32_t));
+		}
+		return key;
+	}
+
+	glm::vec3 normalizeOrZero(glm::vec3 const & v)
+	{
+		float const len = glm::length(v);
+		return (len > 0.0f) ? (v / len) : glm::vec3(0.0f);
+	}
+
+	//! Any unit vector perpendicular to the normal.
+	glm::vec3 perpendicular(glm::vec3 const & n)
+	{
+		glm::vec3 const axis = (std::abs(n.x) < 0.5f) ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		return glm::normalize(axis - n * glm::dot(n, axis));
+	}
+
+	float cornerAngle(glm::vec3 const & a, glm::vec3 const & b)
+	{
+		float const d = glm::dot(normalizeOrZero(a), normalizeOrZero(b));
+		return std::acos(std::max(-1.0f, std::min(1.0f, d)));
+	}
+
+	struct Face
+	{
+		glm::vec3 unit;    // normalized normal, zero for degenerate triangles
+		std::array<float, 3> angles; // at the corners
+		glm::vec3 tangent; // dP/du, zero for degenerate texture coordinates
+		float sign;        // orientation of the texture coordinates
+		bool smooth;
+	};
+
+	//! An output vertex, one or more per input vertex.
+	struct Slot
+	{
+		uint16_t vertex;
+		bool smooth;
+		float sign;
+		uint32_t next; // next slot of the same vertex or `none`
+		glm::vec3 normal; // weighted face normal sum of flat slots
+		glm::vec3 tangent;
+	};
+
+	uint32_t const none = std::numeric_limits<uint32_t>::max();
+
+	bool matches(Slot const & slot, Face const & face)
+	{
+		if(slot.smooth != face.smooth or slot.sign != face.sign)
+			return false;
+		if(slot.smooth)
+			return true;
+		// degenerate triangles join any flat slot
+		float const len = glm::length(slot.normal);
+		return (face.unit == glm::vec3(0.0f)) or (len == 0.0f) or (glm::dot(slot.normal, face.unit) >= coplanar * len);
+	}
+}
+
+FrameStats & FrameStats::operator+=(FrameStats const & other)
+{
+	verticesAdded += other.verticesAdded;
+	blocksSkipped += other.blocksSkipped;
+	return *this;
+}
+
+FrameStats WMB::computeFrames(Block & block, FrameOptions const & options)
+{
+	FrameStats stats;
+
+	// The front side is clockwise in DirectX coordinates. Gamestudio
+	// coordinates are mirrored against them, the OpenGL conversion
+	// flips the winding order as well.
+	float const front = (options.coordinateSystem == LoadOptions::Gamestudio) ? -1.0f : 1.0f;
+
+	size_t const count = block.vertices.size();
+	auto const valid = [&](Triangle const & tris)
+	{
+		return tris.v1 < count and tris.v2 < count and tris.v3 < count;
+	};
+
+	std::vector<Face> faces(block.triangles.size());
+	for(size_t i = 0; i < block.triangles.size(); i++)
+	{
+		auto const & tris = block.triangles[i];
+		auto & face = faces[i];
+		face = Face { glm::vec3(0.0f), { 0.0f, 0.0f, 0.0f }, glm::vec3(0.0f), 1.0f, false };
+		if(not valid(tris))
+			continue;
+
+		auto const & v1 = block.vertices[tris.v1];
+		auto const & v2 = block.vertices[tris.v2];
+		auto const & v3 = block.vertices[tris.v3];
+
+		glm::vec3 const e1 = v2.position - v1.position;
+		glm::vec3 const e2 = v3.position - v1.position;
+		glm::vec3 const e3 = v3.position - v2.position;
+		face.unit = normalizeOrZero(front * glm::cross(e1, e2));
+		face.angles[0] = cornerAngle(e1, e2);
+		face.angles[1] = cornerAngle(-e1, e3);
+		face.angles[2] = cornerAngle(e2, e3);
+		face.smooth = (tris.skin < block.skins.size()) and block.skins[tris.skin].isSmooth();
+
+		glm::vec2 const t1 = v2.uv - v1.uv;
+		glm::vec2 const t2 = v3.uv - v1.uv;
+		float const det = t1.x * t2.y - t2.x * t1.y;
+		if(det != 0.0f and std::isfinite(1.0f / det))
+		{
+			float const r = 1.0f / det;
+			face.tangent = (e1 * t2.y - e2 * t1.y) * r;
+			glm::vec3 const bitangent = (e2 * t1.x - e1 * t2.x) * r;
+			face.sign = (glm::dot(glm::cross(face.unit, face.tangent), bitangent) < 0.0f) ? -1.0f : 1.0f;
+		}
+	}
+
+	// smooth normals are summed over all vertices at the same position
+	std::unordered_map<PositionKey, uint32_t, PositionKeyHash> lookup;
+	lookup.reserve(count);
+	std::vector<uint32_t> positions(count);
+	for(size_t i = 0; i < count; i++)
+		positions[i] = lookup.emplace(toKey(block.vertices[i].position), static_cast<uint32_t>(lookup.size())).first->second;
+
+	std::vector<glm::vec3> smoothNormals(lookup.size(), glm::vec3(0.0f));
+	for(size_t i = 0; i < block.triangles.size(); i++)
+	{
+		auto const & tris = block.triangles[i];
+		if(not faces[i].smooth or not valid(tris))
+			continue;
+		smoothNormals[positions[tris.v1]] += faces[i].unit * faces[i].angles[0];
+		smoothNormals[positions[tris.v2]] += faces[i].unit * faces[i].angles[1];
+		smoothNormals[positions[tris.v3]] += faces[i].unit * faces[i].angles[2];
+	}
+
+	// Every corner is assigned to a slot of its vertex with the same
+	// smoothing and tangent sign. The first slot keeps the vertex index.
+	std::vector<Slot> slots(count);
+	for(size_t i = 0; i < count; i++)
+		slots[i] = Slot { static_cast<uint16_t>(i), false, 0.0f, none, glm::vec3(0.0f), glm::vec3(0.0f) };
+
+	std::vector<std::array<uint32_t, 3>> corners(block.triangles.size());
+	for(size_t i = 0; i < block.triangles.size(); i++)
+	{
+		auto const & tris = block.triangles[i];
+		auto const & face = faces[i];
+		if(not valid(tris))
+			continue;
+
+		std::array<uint16_t, 3> const verts = { tris.v1, tris.v2, tris.v3 };
+		for(size_t k = 0; k < 3; k++)
+		{
+			uint32_t slot = verts[k];
+			if(slots[slot].sign == 0.0f)
+			{
+				// first corner of this vertex
+				slots[slot].smooth = face.smooth;
+				slots[slot].sign = face.sign;
+			}
+			else
+			{
+				uint32_t last = slot;
+				while(slot != none and not matches(slots[slot], face))
+				{
+					last = slot;
+					slot = slots[slot].next;
+				}
+				if(slot == none)
+				{
+					slot = static_cast<uint32_t>(slots.size());
+					slots[last].next = slot;
+					slots.push_back(Slot { verts[k], face.smooth, face.sign, none, glm::vec3(0.0f), glm::vec3(0.0f) });
+				}
+			}
+			if(not face.smooth)
+				slots[slot].normal += face.unit * face.angles[k];
+			corners[i][k] = slot;
+		}
+	}
+
+	if(slots.size() > size_t(std::numeric_limits<uint16_t>::max()) + 1)
+	{
+		stats.blocksSkipped = 1;
+		return stats;
+	}
+
+	for(auto & slot : slots)
+	{
+		if(slot.smooth)
+			slot.normal = smoothNormals[positions[slot.vertex]];
+		slot.normal = normalizeOrZero(slot.normal);
+	}
+
+	// The face tangents are projected into the plane of the vertex normal
+	// and weighted by the angle of the corner.
+	for(size_t i = 0; i < block.triangles.size(); i++)
+	{
+		auto const & tris = block.triangles[i];
+		if(not valid(tris) or faces[i].tangent == glm::vec3(0.0f))
+			continue;
+
+		for(size_t k = 0; k < 3; k++)
+		{
+			auto & slot = slots[corners[i][k]];
+			glm::vec3 const t = faces[i].tangent - slot.normal * glm::dot(slot.normal, faces[i].tangent);
+			slot.tangent += normalizeOrZero(t) * faces[i].angles[k];
+		}
+	}
+
+	std::vector<VertexFrame> frames(slots.size());
+	for(size_t i = 0; i < slots.size(); i++)
+	{
+		auto const & slot = slots[i];
+		auto & frame = frames[i];
+		frame.normal = slot.normal;
+		if(slot.normal == glm::vec3(0.0f))
+		{
+			frame.tangent = glm::vec4(0.0f);
+			continue;
+		}
+
+		glm::vec3 tangent = normalizeOrZero(slot.tangent - slot.normal * glm::dot(slot.normal, slot.tangent));
+		if(tangent == glm::vec3(0.0f))
+			tangent = perpendicular(slot.normal);
+		frame.tangent = glm::vec4(tangent, slot.sign);
+	}
+
+	block.vertices.reserve(slots.size());
+	for(size_t i = count; i < slots.size(); i++)
+		block.vertices.push_back(block.vertices[slots[i].vertex]);
+
+	for(size_t i = 0; i < block.triangles.size(); i++)
+	{
+		auto & tris = block.triangles[i];
+		if(not valid(tris))
+			continue;
+		tris.v1 = static_cast<uint16_t>(corners[i][0]);
+		tris.v2 = static_cast<uint16_t>(corners[i][1]);
+		tris.v3 = static_cast<uint16_t>(corners[i][2]);
+	}
+
+	block.frames = std::move(frames);
+	stats.verticesAdded = slots.size() - count;
+	return stats;
+}
+
+FrameStats WMB::computeFrames(Level & level, FrameOptions const & options)
+{
+	std::vector<FrameStats> results(level.blocks.size());
+	parallelFor(level.blocks.size(), options.threads, [&](size_t i)
+	{
+		results[i] = computeFrames(level.blocks[i], options);
+	});
+
+	FrameStats stats;
+	for(auto const & result : results)
+		stats += result;
+	return stats;
+}
@@ -0,0 +1,146 @@
+#include "wmb.hpp"
+#include "wmb_format.hpp"
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	uint32_t hashKey(std::string_view key)
+	{
+		auto const hash = hashBytes(reinterpret_cast<std::byte const *>(key.data()), key.size());
+		return static_cast<uint32_t>(hash ^ (hash >> 32));
+	}
+
+	std::string_view keyAt(StringIndex const & index, uint32_t key)
+	{
+		auto const begin = index.keyOffsets[key];
+		auto const end = index.keyOffsets[key + 1];
+		return std::string_view(index.keys).substr(begin, end - begin);
+	}
+
+	//! Fills a StringIndex while walking over the objects. The slot table
+	//! is sized for the number of objects up front, so it never grows.
+	struct StringIndexBuilder
+	{
+		StringIndex & index;
+		std::vector<uint32_t> counts; // objects per key
+		std::vector<std::pair<uint32_t, uint32_t>> entries; // key and object
+		uint32_t const mask;
+
+		StringIndexBuilder(StringIndex & index, size_t capacity) :
+			index(index),
+			mask(tableSize(capacity) - 1)
+		{
+			index = StringIndex();
+			index.slots.assign(size_t(mask) + 1, 0);
+			index.keyOffsets.push_back(0);
+		}
+
+		static uint32_t tableSize(size_t capacity)
+		{
+			// at most half of the slots are used
+			uint32_t size = 16;
+			while(size < 2 * capacity)
+				size *= 2;
+			return size;
+		}
+
+		void insert(std::string_view key, uint32_t object)
+		{
+			uint32_t const hash = hashKey(key);
+			uint32_t slot = hash & mask;
+			while(true)
+			{
+				uint32_t const entry = index.slots[slot];
+				if(entry == 0)
+				{
+					uint32_t const id = static_cast<uint32_t>(index.keyHashes.size());
+					index.slots[slot] = id + 1;
+					index.keyHashes.push_back(hash);
+					index.keys.append(key);
+					index.keyOffsets.push_back(static_cast<uint32_t>(index.keys.size()));
+					counts.push_back(0);
+					add(id, object);
+					return;
+				}
+				if(index.keyHashes[entry - 1] == hash and keyAt(index, entry - 1) == key)
+				{
+					add(entry - 1, object);
+					return;
+				}
+				slot = (slot + 1) & mask;
+			}
+		}
+
+		void add(uint32_t key, uint32_t object)
+		{
+			counts[key]++;
+			entries.emplace_back(key, object);
+		}
+
+		//! Sorts the entries into one row per key, the objects keep their order.
+		void finish()
+		{
+			index.rowOffsets.resize(counts.size() + 1);
+			index.rowOffsets[0] = 0;
+			for(size_t i = 0; i < counts.size(); i++)
+				index.rowOffsets[i + 1] = index.rowOffsets[i] + counts[i];
+
+			std::vector<uint32_t> next(index.rowOffsets.begin(), index.rowOffsets.end() - 1);
+			index.rows.resize(entries.size());
+			for(auto const & entry : entries)
+				index.rows[next[entry.first]++] = entry.second;
+
+			index.keys.shrink_to_fit();
+		}
+	};
+}
+
+View<uint32_t> StringIndex::find(std::string_view key) const
+{
+	if(slots.empty())
+		return { };
+
+	uint32_t const mask = static_cast<uint32_t>(slots.size() - 1);
+	uint32_t const hash = hashKey(key);
+	for(uint32_t slot = hash & mask; slots[slot] != 0; slot = (slot + 1) & mask)
+	{
+		uint32_t const id = slots[slot] - 1;
+		if(keyHashes[id] == hash and keyAt(*this, id) == key)
+			return View<uint32_t> { rows.data() + rowOffsets[id], rowOffsets[id + 1] - rowOffsets[id] };
+	}
+	return { };
+}
+
+std::optional<uint32_t> EntityIndex::byName(std::string_view name) const
+{
+	auto const found = names.find(name);
+	if(found.empty())
+		return std::nullopt;
+	return found[0];
+}
+
+EntityIndex WMB::buildEntityIndex(Level const & level)
+{
+	EntityIndex result;
+
+	StringIndexBuilder names(result.names, level.objects.size());
+	StringIndexBuilder actions(result.actions, level.objects.size());
+	StringIndexBuilder fileNames(result.fileNames, level.objects.size());
+
+	for(size_t i = 0; i < level.objects.size(); i++)
+	{
+		auto const * ent = std::get_if<Entity>(&level.objects[i]);
+		if(ent == nullptr)
+			continue;
+		names.insert(ent->name, static_cast<uint32_t>(i));
+		actions.insert(ent->action, static_cast<uint32_t>(i));
+		fileNames.insert(ent->fileName, static_cast<uint32_t>(i));
+	}
+
+	names.finish();
+	actions.finish();
+	fileNames.finish();
+	return result;
+}
@@ -0,0 +1,235 @@
+#include "wmb_lights.hpp"
+#include "wmb_parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	//! Light spheres as a structure of arrays, sorted by x and padded to a
+	//! multiple of 4 with lights that never touch anything.
+	struct LightTable
+	{
+		size_t count = 0;
+		std::vector<float> x, y, z;
+		std::vector<float> radius2; // squared range, -1 for padding
+		std::vector<uint32_t> order; // index into LightAssignment::lights
+		float maxRadius = 0.0f;
+	};
+
+	LightTable buildLightTable(Level const & level, LightAssignmentOptions const & options, std::vector<uint32_t> & lights)
+	{
+		std::vector<Light const *> sources;
+		lights.clear();
+		for(size_t i = 0; i < level.objects.size(); i++)
+		{
+			auto const * light = std::get_if<Light>(&level.objects[i]);
+			if(light == nullptr or light->range <= 0.0f)
+				continue;
+			if(not (light->isDynamic() ? options.dynamicLights : options.staticLights))
+				continue;
+			lights.push_back(static_cast<uint32_t>(i));
+			sources.push_back(light);
+		}
+
+		LightTable table;
+		table.count = lights.size();
+		table.order.resize(table.count);
+		for(size_t i = 0; i < table.count; i++)
+			table.order[i] = static_cast<uint32_t>(i);
+		std::sort(table.order.begin(), table.order.end(), [&](uint32_t a, uint32_t b)
+		{
+			return sources[a]->origin.x < sources[b]->origin.x;
+		});
+
+		for(auto const i : table.order)
+		{
+			auto const * light = sources[i];
+			table.x.push_back(light->origin.x);
+			table.y.push_back(light->origin.y);
+			table.z.push_back(light->origin.z);
+			table.radius2.push_back(light->range * light->range);
+			table.maxRadius = std::max(table.maxRadius, light->range);
+		}
+
+		size_t const padded = (table.count + 3) & ~size_t(3);
+		table.x.resize(padded, 0.0f);
+		table.y.resize(padded, 0.0f);
+		table.z.resize(padded, 0.0f);
+		table.radius2.resize(padded, -1.0f);
+		return table;
+	}
+
+	//! Appends the lights that touch box j of the table, in ascending
+	//! order. Only the lights within reach along x are tested.
+	void testBox(BoundsTable const & boxes, size_t j, LightTable const & lights, std::vector<uint32_t> & out)
+	{
+		auto const lightsEnd = lights.x.begin() + lights.count;
+		size_t const first = std::lower_bound(lights.x.begin(), lightsEnd, boxes.minX[j] - lights.maxRadius) - lights.x.begin();
+		size_t const last = std::upper_bound(lights.x.begin(), lightsEnd, boxes.maxX[j] + lights.maxRadius) - lights.x.begin();
+		size_t const begin = out.size();
+
+#if defined(__SSE2__)
+		__m128 const minX = _mm_set1_ps(boxes.minX[j]);
+		__m128 const minY = _mm_set1_ps(boxes.minY[j]);
+		__m128 const minZ = _mm_set1_ps(boxes.minZ[j]);
+		__m128 const maxX = _mm_set1_ps(boxes.maxX[j]);
+		__m128 const maxY = _mm_set1_ps(boxes.maxY[j]);
+		__m128 const maxZ = _mm_set1_ps(boxes.maxZ[j]);
+
+		auto const axis = [](__m128 lower, __m128 upper, __m128 pos)
+		{
+			__m128 const d = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lower, pos), _mm_sub_ps(pos, upper)), _mm_setzero_ps());
+			return _mm_mul_ps(d, d);
+		};
+
+		// the padding makes it safe to read up to 3 lights past the range
+		for(size_t i = first & ~size_t(3); i < last; i += 4)
+		{
+			__m128 dist2 = axis(minX, maxX, _mm_loadu_ps(lights.x.data() + i));
+			dist2 = _mm_add_ps(dist2, axis(minY, maxY, _mm_loadu_ps(lights.y.data() + i)));
+			dist2 = _mm_add_ps(dist2, axis(minZ, maxZ, _mm_loadu_ps(lights.z.data() + i)));
+			unsigned bits = static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(dist2, _mm_loadu_ps(lights.radius2.data() + i))));
+			while(bits != 0)
+			{
+				out.push_back(lights.order[i + __builtin_ctz(bits)]);
+				bits &= bits - 1;
+			}
+		}
+#else
+		glm::vec3 const minimum(boxes.minX[j], boxes.minY[j], boxes.minZ[j]);
+		glm::vec3 const maximum(boxes.maxX[j], boxes.maxY[j], boxes.maxZ[j]);
+		for(size_t i = first; i < last; i++)
+		{
+			glm::vec3 const center(lights.x[i], lights.y[i], lights.z[i]);
+			glm::vec3 const d = glm::max(glm::max(minimum - center, center - maximum), glm::vec3(0.0f));
+			if(glm::dot(d, d) <= lights.radius2[i])
+				out.push_back(lights.order[i]);
+		}
+#endif
+
+		std::sort(out.begin() + begin, out.end());
+	}
+
+	//! Builds the light lists of all boxes. The boxes are processed in
+	//! chunks of 64, which are concatenated afterwards.
+	void assignBoxes(BoundsTable const & boxes, LightTable const & lights, unsigned threads, std::vector<uint32_t> & offsets, std::vector<uint32_t> & indices)
+	{
+		struct Chunk
+		{
+			std::vector<uint32_t> counts;
+			std::vector<uint32_t> lights;
+		};
+
+		size_t const chunkSize = 64;
+		std::vector<Chunk> chunks((boxes.count + chunkSize - 1) / chunkSize);
+		parallelFor(chunks.size(), threads, [&](size_t c)
+		{
+			auto & chunk = chunks[c];
+			size_t const end = std::min(boxes.count, chunkSize * (c + 1));
+			for(size_t j = chunkSize * c; j < end; j++)
+			{
+				size_t const before = chunk.lights.size();
+				testBox(boxes, j, lights, chunk.lights);
+				chunk.counts.push_back(static_cast<uint32_t>(chunk.lights.size() - before));
+			}
+		});
+
+		size_t total = 0;
+		for(auto const & chunk : chunks)
+			total += chunk.lights.size();
+
+		offsets.clear();
+		offsets.reserve(boxes.count + 1);
+		offsets.push_back(0);
+		indices.clear();
+		indices.reserve(total);
+		for(auto const & chunk : chunks)
+		{
+			for(auto const count : chunk.counts)
+				offsets.push_back(offsets.back() + count);
+			indices.insert(indices.end(), chunk.lights.begin(), chunk.lights.end());
+		}
+	}
+}
+
+View<uint32_t> LightAssignment::forBlock(size_t block) const
+{
+	return View<uint32_t> { blockLights.data() + blockOffsets.at(block), blockOffsets.at(block + 1) - blockOffsets.at(block) };
+}
+
+View<uint32_t> LightAssignment::forCell(size_t cell) const
+{
+	return View<uint32_t> { cellLights.data() + cellOffsets.at(cell), cellOffsets.at(cell + 1) - cellOffsets.at(cell) };
+}
+
+std::optional<size_t> LightAssignment::cellAt(glm::vec3 const & point) const
+{
+	if(cellOffsets.empty())
+		return std::nullopt;
+
+	size_t cell = 0;
+	size_t stride = 1;
+	for(int axis = 0; axis < 3; axis++)
+	{
+		float const t = std::floor((point[axis] - gridMin[axis]) / cellSize[axis]);
+		if(not (t >= 0.0f) or t >= float(gridSize[axis]))
+			return std::nullopt;
+		cell += stride * static_cast<size_t>(t);
+		stride *= gridSize[axis];
+	}
+	return cell;
+}
+
+LightAssignment WMB::assignLights(Level const & level, BoundsTable const & blocks, LightAssignmentOptions const & options)
+{
+	LightAssignment result;
+	LightTable const lights = buildLightTable(level, options, result.lights);
+
+	assignBoxes(blocks, lights, options.threads, result.blockOffsets, result.blockLights);
+
+	bool const hasGrid = (options.gridSize.x > 0 and options.gridSize.y > 0 and options.gridSize.z > 0);
+	if(hasGrid and blocks.count > 0)
+	{
+		glm::vec3 minimum(blocks.minX[0], blocks.minY[0], blocks.minZ[0]);
+		glm::vec3 maximum(blocks.maxX[0], blocks.maxY[0], blocks.maxZ[0]);
+		for(size_t j = 1; j < blocks.count; j++)
+		{
+			minimum = glm::min(minimum, glm::vec3(blocks.minX[j], blocks.minY[j], blocks.minZ[j]));
+			maximum = glm::max(maximum, glm::vec3(blocks.maxX[j], blocks.maxY[j], blocks.maxZ[j]));
+		}
+
+		result.gridSize = options.gridSize;
+		result.gridMin = minimum;
+		result.cellSize = glm::max((maximum - minimum) / glm::vec3(options.gridSize), glm::vec3(1e-6f));
+
+		// the cells are tested like blocks
+		BoundsTable cells;
+		for(unsigned z = 0; z < options.gridSize.z; z++)
+		{
+			for(unsigned y = 0; y < options.gridSize.y; y++)
+			{
+				for(unsigned x = 0; x < options.gridSize.x; x++)
+				{
+					glm::vec3 const lower = minimum + result.cellSize * glm::vec3(float(x), float(y), float(z));
+					cells.push(lower, lower + result.cellSize);
+				}
+			}
+		}
+		assignBoxes(cells, lights, options.threads, result.cellOffsets, result.cellLights);
+	}
+
+	return result;
+}
+
+LightAssignment WMB::assignLights(Level const & level, LightAssignmentOptions const & options)
+{
+	return assignLights(level, buildBoundsTable(level), options);
+}
@@ -0,0 +1,56 @@
+#ifndef WMB_LIGHTS_HPP
+#define WMB_LIGHTS_HPP
+
+#include "wmb.hpp"
+#include "wmb_cull.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace WMB
+{
+	struct LightAssignmentOptions
+	{
+		bool dynamicLights = true; // lights with Light::DYNAMIC
+		bool staticLights = true;  // all other lights
+
+		//! Number of cells of the cluster grid over the bounds of all
+		//! blocks. No grid is built when a component is 0.
+		glm::uvec3 gridSize = glm::uvec3(0);
+
+		unsigned int threads = 0; // 0 = one thread per core
+	};
+
+	//! Lights that touch each block and grid cell. The lists are stored
+	//! back to back with an offset array (compressed sparse rows) and
+	//! hold indices into `lights`.
+	struct LightAssignment
+	{
+		std::vector<uint32_t> lights; // indices into Level::objects
+
+		std::vector<uint32_t> blockOffsets; // block i uses blockLights[blockOffsets[i], blockOffsets[i + 1])
+		std::vector<uint32_t> blockLights;
+
+		glm::uvec3 gridSize = glm::uvec3(0);
+		glm::vec3 gridMin = glm::vec3(0.0f);
+		glm::vec3 cellSize = glm::vec3(0.0f);
+		std::vector<uint32_t> cellOffsets; // cell x + gridSize.x * (y + gridSize.y * z)
+		std::vector<uint32_t> cellLights;
+
+		View<uint32_t> forBlock(size_t block) const;
+		View<uint32_t> forCell(size_t cell) const;
+
+		//! Returns the cell that contains the point, or nullopt outside of
+		//! the grid.
+		std::optional<size_t> cellAt(glm::vec3 const & point) const;
+	};
+
+	//! Tests the sphere (origin, range) of every light against the block
+	//! bounds and the grid cells. Four lights are tested at once, the
+	//! boxes are split between the threads.
+	LightAssignment assignLights(Level const & level, BoundsTable const & blocks, LightAssignmentOptions const & options = LightAssignmentOptions());
+
+	LightAssignment assignLights(Level const & level, LightAssignmentOptions const & options = LightAssignmentOptions());
+}
+
+#endif // WMB_LIGHTS_HPP
@@ -0,0 +1,362 @@
+#include "wmb_lod.hpp"
+#include "wmb_parallel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <tuple>
+#include <unordered_map>
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	//! Sum of squared distances to a set of weighted planes.
+	struct Quadric
+	{
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+		double weight = 0;
+
+		void addPlane(glm::vec3 const & n, float d, float w)
+		{
+			a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+			b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+			c2 += w * n.z * n.z; cd += w * n.z * d;
+			d2 += w * double(d) * d;
+			weight += w;
+		}
+
+		Quadric & operator+=(Quadric const & q)
+		{
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+			weight += q.weight;
+			return *this;
+		}
+
+		double evaluate(glm::vec3 const & p) const
+		{
+			double const x = p.x, y = p.y, z = p.z;
+			double const e =
+				a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+				b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+				c2 * z * z + 2 * cd * z +
+				d2;
+			return std::max(0.0, e);
+		}
+	};
+
+	struct Collapse
+	{
+		float error;
+		uint16_t from, to;
+
+		bool operator<(Collapse const & other) const
+		{
+			return error < other.error;
+		}
+	};
+
+	bool isDegenerate(Triangle const & tris)
+	{
+		return tris.v1 == tris.v2 or tris.v2 == tris.v3 or tris.v3 == tris.v1;
+	}
+
+	//! Marks the vertices that must keep their position: seams, open
+	//! or non-manifold edges and vertices between skins.
+	std::vector<bool> findLockedVertices(Block const & block, std::vector<Triangle> const & triangles)
+	{
+		size_t const count = block.vertices.size();
+		std::vector<bool> locked(count, false);
+
+		// Vertices with the same position but different attributes
+		std::vector<uint16_t> sorted(count);
+		for(size_t i = 0; i < count; i++)
+			sorted[i] = static_cast<uint16_t>(i);
+		auto const less = [&](uint16_t a, uint16_t b)
+		{
+			auto const & p = block.vertices[a].position;
+			auto const & q = block.vertices[b].position;
+			return std::tie(p.x, p.y, p.z) < std::tie(q.x, q.y, q.z);
+		};
+		std::sort(sorted.begin(), sorted.end(), less);
+		for(size_t i = 1; i < count; i++)
+		{
+			if(not less(sorted[i - 1], sorted[i]))
+				locked[sorted[i - 1]] = locked[sorted[i]] = true;
+		}
+
+		// Every edge inside a surface is used twice, by triangles of the
+		// same skin
+		struct EdgeUse
+		{
+			uint32_t count;
+			uint16_t skin;
+			bool mixed;
+		};
+		std::unordered_map<uint32_t, EdgeUse> edges;
+		edges.reserve(3 * triangles.size());
+		std::vector<int32_t> vertexSkin(count, -1);
+		for(auto const & tris : triangles)
+		{
+			std::array<uint16_t, 3> const v = { tris.v1, tris.v2, tris.v3 };
+			for(size_t k = 0; k < 3; k++)
+			{
+				uint16_t const a = std::min(v[k], v[(k + 1) % 3]);
+				uint16_t const b = std::max(v[k], v[(k + 1) % 3]);
+				auto const result = edges.emplace((uint32_t(a) << 16) | b, EdgeUse { 0, tris.skin, false });
+				result.first->second.count++;
+				result.first->second.mixed |= (result.first->second.skin != tris.skin);
+
+				if(vertexSkin[v[k]] < 0)
+					vertexSkin[v[k]] = tris.skin;
+				else if(vertexSkin[v[k]] != tris.skin)
+					locked[v[k]] = true;
+			}
+		}
+		for(auto const & edge : edges)
+		{
+			if(edge.second.count != 2 or edge.second.mixed)
+				locked[edge.first >> 16] = locked[edge.first & 0xFFFF] = true;
+		}
+		return locked;
+	}
+
+	struct Simplifier
+	{
+		Block const & block;
+		LodOptions const & options;
+		std::vector<Triangle> triangles;
+		std::vector<bool> locked;
+		std::vector<Quadric> quadrics;
+		float error = 0.0f;
+
+		// triangles around vertex v are adjacency[offsets[v], offsets[v + 1])
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> adjacency;
+
+		Simplifier(Block const & block, LodOptions const & options) :
+			block(block),
+			options(options)
+		{
+			size_t const count = block.vertices.size();
+			for(auto const & tris : block.triangles)
+			{
+				if(tris.v1 < count and tris.v2 < count and tris.v3 < count and not isDegenerate(tris))
+					triangles.push_back(tris);
+			}
+			locked = findLockedVertices(block, triangles);
+
+			// The planes are weighted by area, so large triangles keep
+			// their shape better than slivers.
+			quadrics.resize(count);
+			for(auto const & tris : triangles)
+			{
+				auto const & p1 = position(tris.v1);
+				glm::vec3 const n = glm::cross(position(tris.v2) - p1, position(tris.v3) - p1);
+				float const len = glm::length(n);
+				if(len == 0.0f)
+					continue;
+				glm::vec3 const unit = n / len;
+				float const d = -glm::dot(unit, p1);
+				for(auto const v : { tris.v1, tris.v2, tris.v3 })
+					quadrics[v].addPlane(unit, d, 0.5f * len);
+			}
+		}
+
+		glm::vec3 const & position(uint16_t v) const
+		{
+			return block.vertices[v].position;
+		}
+
+		float collapseError(uint16_t from, uint16_t to) const
+		{
+			Quadric q = quadrics[from];
+			q += quadrics[to];
+			if(q.weight <= 0.0)
+				return 0.0f;
+			return static_cast<float>(std::sqrt(q.evaluate(position(to)) / q.weight));
+		}
+
+		void buildAdjacency()
+		{
+			offsets.assign(block.vertices.size() + 1, 0);
+			for(auto const & tris : triangles)
+			{
+				offsets[tris.v1 + 1]++;
+				offsets[tris.v2 + 1]++;
+				offsets[tris.v3 + 1]++;
+			}
+			for(size_t i = 1; i < offsets.size(); i++)
+				offsets[i] += offsets[i - 1];
+			adjacency.resize(offsets.back());
+			std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+			for(uint32_t t = 0; t < triangles.size(); t++)
+			{
+				adjacency[next[triangles[t].v1]++] = t;
+				adjacency[next[triangles[t].v2]++] = t;
+				adjacency[next[triangles[t].v3]++] = t;
+			}
+		}
+
+		//! True if moving `from` onto `to` turns none of the remaining
+		//! triangles around `from` over or into a line.
+		bool keepsOrientation(uint16_t from, uint16_t to) const
+		{
+			for(uint32_t i = offsets[from]; i < offsets[from + 1]; i++)
+			{
+				auto const & tris = triangles[adjacency[i]];
+				if(tris.v1 == to or tris.v2 == to or tris.v3 == to)
+					continue;
+
+				std::array<glm::vec3, 3> p = { position(tris.v1), position(tris.v2), position(tris.v3) };
+				glm::vec3 const before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				for(size_t k = 0; k < 3; k++)
+				{
+					if((k == 0 ? tris.v1 : k == 1 ? tris.v2 : tris.v3) == from)
+						p[k] = position(to);
+				}
+				// also rejects turns of more than ~75 degrees, that leave slivers
+				glm::vec3 const after = glm::cross(p[1] - p[0], p[2] - p[0]);
+				if(glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+					return false;
+			}
+			return true;
+		}
+
+		//! Collapses the cheapest edges until the target is reached. Each
+		//! pass only touches every neighbourhood once, so the costs that
+		//! were computed at the start of the pass stay valid.
+		void simplify(size_t target)
+		{
+			std::vector<Collapse> collapses;
+			std::vector<Collapse> best(block.vertices.size());
+			std::vector<uint16_t> remap(block.vertices.size());
+			std::vector<bool> touched(block.vertices.size());
+
+			while(triangles.size() > target)
+			{
+				buildAdjacency();
+
+				// Only the cheapest collapse of each vertex is a candidate.
+				// Edges inside a surface are seen from both triangles, one
+				// of them lists them in ascending order.
+				std::fill(best.begin(), best.end(), Collapse { std::numeric_limits<float>::max(), 0, 0 });
+				for(auto const & tris : triangles)
+				{
+					std::array<uint16_t, 3> const v = { tris.v1, tris.v2, tris.v3 };
+					for(size_t k = 0; k < 3; k++)
+					{
+						uint16_t const a = v[k];
+						uint16_t const b = v[(k + 1) % 3];
+						if(a > b)
+							continue;
+						if(not locked[a])
+							best[a] = std::min(best[a], Collapse { collapseError(a, b), a, b });
+						if(not locked[b])
+							best[b] = std::min(best[b], Collapse { collapseError(b, a), b, a });
+					}
+				}
+				collapses.clear();
+				for(auto const & collapse : best)
+				{
+					if(collapse.from != collapse.to)
+						collapses.push_back(collapse);
+				}
+				std::sort(collapses.begin(), collapses.end());
+
+				for(size_t i = 0; i < remap.size(); i++)
+					remap[i] = static_cast<uint16_t>(i);
+				std::fill(touched.begin(), touched.end(), false);
+
+				size_t remaining = triangles.size();
+				size_t done = 0;
+				for(auto const & collapse : collapses)
+				{
+					if(remaining <= target or collapse.error > options.maxError)
+						break;
+					if(touched[collapse.from] or touched[collapse.to])
+						continue;
+					if(not keepsOrientation(collapse.from, collapse.to))
+						continue;
+
+					remap[collapse.from] = collapse.to;
+					quadrics[collapse.to] += quadrics[collapse.from];
+					error = std::max(error, collapse.error);
+					done++;
+
+					for(uint32_t k = offsets[collapse.from]; k < offsets[collapse.from + 1]; k++)
+					{
+						auto const & tris = triangles[adjacency[k]];
+						touched[tris.v1] = touched[tris.v2] = touched[tris.v3] = true;
+						if(tris.v1 == collapse.to or tris.v2 == collapse.to or tris.v3 == collapse.to)
+							remaining--;
+					}
+				}
+				if(done == 0)
+					break;
+
+				size_t kept = 0;
+				for(auto tris : triangles)
+				{
+					tris.v1 = remap[tris.v1];
+					tris.v2 = remap[tris.v2];
+					tris.v3 = remap[tris.v3];
+					if(not isDegenerate(tris))
+						triangles[kept++] = tris;
+				}
+				triangles.resize(kept);
+			}
+		}
+	};
+}
+
+std::vector<Lod> WMB::buildLods(Block const & block, LodOptions const & options)
+{
+	Simplifier simplifier(block, options);
+	size_t const original = simplifier.triangles.size();
+
+	std::vector<Lod> lods;
+	for(auto const ratio : options.ratios)
+	{
+		simplifier.simplify(static_cast<size_t>(std::max(0.0f, ratio) * original));
+		lods.push_back(Lod { simplifier.triangles, simplifier.error });
+	}
+	return lods;
+}
+
+std::vector<std::vector<Lod>> WMB::buildLods(Level const & level, LodOptions const & options)
+{
+	std::vector<std::vector<Lod>> result(level.blocks.size());
+	parallelFor(level.blocks.size(), options.threads, [&](size_t i)
+	{
+		result[i] = buildLods(level.blocks[i], options);
+	});
+	return result;
+}
+
+float WMB::screenSpaceError(float error, float distance, float fovY, float screenHeight)
+{
+	if(distance <= 0.0f)
+		return std::numeric_limits<float>::max();
+	return error * screenHeight / (2.0f * distance * std::tan(0.5f * fovY));
+}
+
+std::optional<size_t> WMB::selectLod(std::vector<Lod> const & lods, float distance, float fovY, float screenHeight, float maxPixels)
+{
+	std::optional<size_t> result;
+	for(size_t i = 0; i < lods.size(); i++)
+	{
+		if(screenSpaceError(lods[i].error, distance, fovY, screenHeight) > maxPixels)
+			break;
+		result = i;
+	}
+	return result;
+}
@@ -0,0 +1,53 @@
+#ifndef WMB_LOD_HPP
+#define WMB_LOD_HPP
+
+#include "wmb.hpp"
+
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace WMB
+{
+	struct LodOptions
+	{
+		//! Target triangle count of each level of detail, as a fraction of
+		//! the triangles of the block. Every level is simplified further
+		//! from the previous one.
+		std::vector<float> ratios = { 0.5f, 0.25f, 0.125f };
+
+		//! Collapses that move the surface further than this are not
+		//! done, so a level can keep more triangles than its ratio.
+		float maxError = std::numeric_limits<float>::max();
+
+		unsigned int threads = 0; // 0 = one thread per core
+	};
+
+	struct Lod
+	{
+		std::vector<Triangle> triangles; // indices into Block::vertices
+		float error; // estimated distance between the simplified and the original surface
+	};
+
+	//! Simplifies the block with quadric error metrics. Vertices are
+	//! only moved onto their neighbours, so the levels reuse the vertex
+	//! array of the block. Vertices on open borders, between skins and
+	//! on seams (positions shared by several vertices, e.g. where the
+	//! texture or lightmap coordinates are split) are never moved.
+	//! Duplicated vertices count as seams, weld the block first.
+	std::vector<Lod> buildLods(Block const & block, LodOptions const & options = LodOptions());
+
+	//! Builds the levels of detail of all blocks, the blocks are split
+	//! between the threads.
+	std::vector<std::vector<Lod>> buildLods(Level const & level, LodOptions const & options = LodOptions());
+
+	//! Projected size of a world space error in pixels, for a camera with
+	//! the given vertical field of view (in radians) and viewport height.
+	float screenSpaceError(float error, float distance, float fovY, float screenHeight);
+
+	//! Index of the coarsest level whose error stays below `maxPixels`,
+	//! or nullopt if the full block is needed.
+	std::optional<size_t> selectLod(std::vector<Lod> const & lods, float distance, float fovY, float screenHeight, float maxPixels = 1.0f);
+}
+
+#endif // WMB_LOD_HPP
@@ -0,0 +1,382 @@
+#include "wmb_meshlets.hpp"
+#include "wmb_parallel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	uint32_t const none = std::numeric_limits<uint32_t>::max();
+
+	//! Spreads the lower 10 bits so that two zero bits follow each one.
+	uint32_t spreadBits(uint32_t v)
+	{
+		v &= 0x3FF;
+		v = (v | (v << 16)) & 0x030000FF;
+		v = (v | (v << 8)) & 0x0300F00F;
+		v = (v | (v << 4)) & 0x030C30C3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+
+	uint32_t mortonCode(glm::vec3 const & p, glm::vec3 const & minimum, glm::vec3 const & scale)
+	{
+		uint32_t code = 0;
+		for(int i = 0; i < 3; i++)
+		{
+			float const cell = std::max(0.0f, std::min(1023.0f, (p[i] - minimum[i]) * scale[i]));
+			code |= spreadBits(static_cast<uint32_t>(cell)) << i;
+		}
+		return code;
+	}
+
+	float distance2(glm::vec3 const & a, glm::vec3 const & b)
+	{
+		glm::vec3 const d = a - b;
+		return glm::dot(d, d);
+	}
+
+	struct MeshletBuilder
+	{
+		Block const & block;
+		size_t const maxVertices;
+		size_t const maxTriangles;
+		float const front;
+		MeshletBlock result;
+
+		std::vector<uint32_t> order;     // valid triangles, by skin and curve position
+		std::vector<glm::vec3> centroids;
+		std::vector<glm::vec3> normals;  // unit face normals, zero when degenerate
+		std::vector<uint32_t> adjacencyOffsets; // triangles of vertex v are adjacency[offsets[v], offsets[v + 1])
+		std::vector<uint32_t> adjacency;
+		std::vector<bool> used;
+		std::vector<uint32_t> rank; // position of each triangle in `order`
+		std::vector<uint32_t> skip; // leads to the next unused position in `order`
+
+		// state of the current meshlet
+		std::vector<uint32_t> vertexStamp; // meshlet that contains the vertex
+		std::vector<uint8_t> localIndex;
+		std::vector<uint32_t> candidateStamp; // meshlet that already lists the triangle
+		std::vector<uint32_t> candidates;
+		std::vector<uint8_t> missing; // vertices of a candidate that are not in the meshlet yet
+		std::vector<uint32_t> members;
+		glm::vec3 centroidSum;
+
+		MeshletBuilder(Block const & block, MeshletOptions const & options) :
+			block(block),
+			maxVertices(std::max<size_t>(3, std::min<size_t>(256, options.maxVertices))),
+			maxTriangles(std::max<size_t>(1, options.maxTriangles)),
+			front((options.coordinateSystem == LoadOptions::Gamestudio) ? -1.0f : 1.0f)
+		{
+		}
+
+		//! Triangles with a repeated corner would be listed twice in the
+		//! adjacency of that vertex and break the vertex counting.
+		bool valid(Triangle const & tris) const
+		{
+			size_t const count = block.vertices.size();
+			return tris.v1 < count and tris.v2 < count and tris.v3 < count
+			   and tris.v1 != tris.v2 and tris.v2 != tris.v3 and tris.v3 != tris.v1;
+		}
+
+		std::array<uint16_t, 3> corners(uint32_t t) const
+		{
+			auto const & tris = block.triangles[t];
+			return { tris.v1, tris.v2, tris.v3 };
+		}
+
+		void prepare()
+		{
+			size_t const triangleCount = block.triangles.size();
+			centroids.resize(triangleCount);
+			normals.resize(triangleCount);
+
+			glm::vec3 minimum(std::numeric_limits<float>::max());
+			glm::vec3 maximum(-std::numeric_limits<float>::max());
+			std::vector<uint32_t> counts(block.vertices.size() + 1, 0);
+			for(uint32_t t = 0; t < triangleCount; t++)
+			{
+				auto const & tris = block.triangles[t];
+				if(not valid(tris))
+					continue;
+				auto const & p1 = block.vertices[tris.v1].position;
+				auto const & p2 = block.vertices[tris.v2].position;
+				auto const & p3 = block.vertices[tris.v3].position;
+				centroids[t] = (p1 + p2 + p3) / 3.0f;
+				glm::vec3 const n = front * glm::cross(p2 - p1, p3 - p1);
+				float const len = glm::length(n);
+				normals[t] = (len > 0.0f) ? (n / len) : glm::vec3(0.0f);
+				for(int i = 0; i < 3; i++)
+				{
+					minimum[i] = std::min(minimum[i], centroids[t][i]);
+					maximum[i] = std::max(maximum[i], centroids[t][i]);
+				}
+				order.push_back(t);
+				for(auto const v : corners(t))
+					counts[v + 1]++;
+			}
+
+			// sort by skin first, then along the curve
+			glm::vec3 scale;
+			for(int i = 0; i < 3; i++)
+				scale[i] = (maximum[i] > minimum[i]) ? (1023.0f / (maximum[i] - minimum[i])) : 0.0f;
+			std::vector<std::pair<uint64_t, uint32_t>> keys;
+			keys.reserve(order.size());
+			for(auto const t : order)
+				keys.emplace_back((uint64_t(block.triangles[t].skin) << 32) | mortonCode(centroids[t], minimum, scale), t);
+			std::sort(keys.begin(), keys.end());
+			for(size_t i = 0; i < keys.size(); i++)
+				order[i] = keys[i].second;
+
+			adjacencyOffsets.resize(counts.size());
+			adjacencyOffsets[0] = 0;
+			for(size_t v = 1; v < counts.size(); v++)
+				adjacencyOffsets[v] = adjacencyOffsets[v - 1] + counts[v];
+			adjacency.resize(adjacencyOffsets.back());
+			std::vector<uint32_t> next(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for(auto const t : order)
+			{
+				for(auto const v : corners(t))
+					adjacency[next[v]++] = t;
+			}
+
+			used.assign(triangleCount, false);
+			rank.assign(triangleCount, none);
+			skip.resize(order.size() + 1);
+			for(uint32_t i = 0; i <= order.size(); i++)
+			{
+				skip[i] = i;
+				if(i < order.size())
+					rank[order[i]] = i;
+			}
+			vertexStamp.assign(block.vertices.size(), none);
+			localIndex.assign(block.vertices.size(), 0);
+			candidateStamp.assign(triangleCount, none);
+			missing.assign(triangleCount, 0);
+		}
+
+		uint32_t meshletId() const
+		{
+			return static_cast<uint32_t>(result.meshlets.size());
+		}
+
+		//! First position in `order` at or after `i` with an unused triangle.
+		uint32_t nextUnused(uint32_t i)
+		{
+			uint32_t root = i;
+			while(skip[root] != root)
+				root = skip[root];
+			while(skip[i] != root)
+			{
+				uint32_t const next = skip[i];
+				skip[i] = root;
+				i = next;
+			}
+			return root;
+		}
+
+		size_t newVertices(uint32_t t) const
+		{
+			size_t count = 0;
+			for(auto const v : corners(t))
+				count += (vertexStamp[v] != meshletId());
+			return count;
+		}
+
+		void add(uint32_t t, Meshlet & meshlet)
+		{
+			used[t] = true;
+			skip[rank[t]] = rank[t] + 1;
+			for(auto const v : corners(t))
+			{
+				if(vertexStamp[v] != meshletId())
+				{
+					vertexStamp[v] = meshletId();
+					localIndex[v] = static_cast<uint8_t>(meshlet.vertexCount++);
+					result.vertices.push_back(v);
+
+					// the unused neighbours of the same skin can follow
+					for(uint32_t i = adjacencyOffsets[v]; i < adjacencyOffsets[v + 1]; i++)
+					{
+						uint32_t const other = adjacency[i];
+						if(used[other] or block.triangles[other].skin != meshlet.skin)
+							continue;
+						if(candidateStamp[other] == meshletId())
+						{
+							missing[other]--;
+							continue;
+						}
+						candidateStamp[other] = meshletId();
+						missing[other] = static_cast<uint8_t>(newVertices(other));
+						candidates.push_back(other);
+					}
+				}
+				result.triangles.push_back(localIndex[v]);
+			}
+			meshlet.triangleCount++;
+			members.push_back(t);
+			centroidSum += centroids[t];
+		}
+
+		//! The candidate that needs the fewest new vertices, the closest one
+		//! on ties, or `none` if nothing fits.
+		uint32_t bestCandidate(Meshlet const & meshlet)
+		{
+			glm::vec3 const center = centroidSum / float(meshlet.triangleCount);
+			uint32_t best = none;
+			size_t bestNew = 4;
+			float bestDistance = 0.0f;
+
+			size_t kept = 0;
+			for(auto const t : candidates)
+			{
+				if(used[t])
+					continue;
+				candidates[kept++] = t;
+
+				size_t const added = missing[t];
+				if(meshlet.vertexCount + added > maxVertices)
+					continue;
+				float const d = distance2(centroids[t], center);
+				if(added < bestNew or (added == bestNew and d < bestDistance))
+				{
+					best = t;
+					bestNew = added;
+					bestDistance = d;
+				}
+			}
+			candidates.resize(kept);
+			return best;
+		}
+
+		void bounds(Meshlet & meshlet) const
+		{
+			glm::vec3 minimum(std::numeric_limits<float>::max());
+			glm::vec3 maximum(-std::numeric_limits<float>::max());
+			for(uint32_t i = 0; i < meshlet.vertexCount; i++)
+			{
+				auto const & p = block.vertices[result.vertices[meshlet.vertexOffset + i]].position;
+				for(int k = 0; k < 3; k++)
+				{
+					minimum[k] = std::min(minimum[k], p[k]);
+					maximum[k] = std::max(maximum[k], p[k]);
+				}
+			}
+			meshlet.center = (minimum + maximum) * 0.5f;
+			float radius2 = 0.0f;
+			for(uint32_t i = 0; i < meshlet.vertexCount; i++)
+				radius2 = std::max(radius2, distance2(block.vertices[result.vertices[meshlet.vertexOffset + i]].position, meshlet.center));
+			meshlet.radius = std::sqrt(radius2);
+
+			// The cone contains all face normals. The apex is moved back
+			// along the axis until every triangle plane is in front of it.
+			glm::vec3 axis(0.0f);
+			for(auto const t : members)
+				axis += normals[t];
+			float const len = glm::length(axis);
+			meshlet.coneApex = meshlet.center;
+			meshlet.coneAxis = glm::vec3(0.0f);
+			meshlet.coneCutoff = 1.0f;
+			if(len == 0.0f)
+				return;
+			axis /= len;
+
+			float minDot = 1.0f;
+			for(auto const t : members)
+			{
+				if(normals[t] == glm::vec3(0.0f))
+					continue;
+				minDot = std::min(minDot, glm::dot(axis, normals[t]));
+			}
+			// leave the axis at zero, rounding could pass the test with a
+			// cutoff of 1
+			if(minDot <= 0.0f)
+				return;
+			meshlet.coneAxis = axis;
+
+			float offset = 0.0f;
+			for(auto const t : members)
+			{
+				float const dn = glm::dot(axis, normals[t]);
+				if(dn <= 0.0f)
+					continue;
+				offset = std::max(offset, glm::dot(meshlet.center - centroids[t], normals[t]) / dn);
+			}
+			meshlet.coneApex = meshlet.center - axis * offset;
+			meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+
+		void build()
+		{
+			prepare();
+
+			uint32_t const end = static_cast<uint32_t>(order.size());
+			while(true)
+			{
+				uint32_t const cursor = nextUnused(0);
+				if(cursor == end)
+					break;
+
+				Meshlet meshlet { };
+				meshlet.vertexOffset = static_cast<uint32_t>(result.vertices.size());
+				meshlet.triangleOffset = static_cast<uint32_t>(result.triangles.size());
+				meshlet.skin = block.triangles[order[cursor]].skin;
+				candidates.clear();
+				members.clear();
+				centroidSum = glm::vec3(0.0f);
+				add(order[cursor], meshlet);
+
+				while(meshlet.triangleCount < maxTriangles)
+				{
+					uint32_t t = bestCandidate(meshlet);
+					if(t == none)
+					{
+						// Nothing connected fits, continue with the next
+						// triangles along the curve that still fit.
+						uint32_t ahead = nextUnused(cursor);
+						for(int misses = 0; ahead < end and misses < 16; misses++)
+						{
+							if(block.triangles[order[ahead]].skin != meshlet.skin)
+							{
+								ahead = end;
+								break;
+							}
+							if(meshlet.vertexCount + newVertices(order[ahead]) <= maxVertices)
+								break;
+							ahead = nextUnused(ahead + 1);
+						}
+						if(ahead >= end or meshlet.vertexCount + newVertices(order[ahead]) > maxVertices)
+							break;
+						t = order[ahead];
+					}
+					add(t, meshlet);
+				}
+
+				bounds(meshlet);
+				result.meshlets.push_back(meshlet);
+			}
+		}
+	};
+}
+
+MeshletBlock WMB::buildMeshlets(Block const & block, MeshletOptions const & options)
+{
+	MeshletBuilder builder(block, options);
+	builder.build();
+	return std::move(builder.result);
+}
+
+std::vector<MeshletBlock> WMB::buildMeshlets(Level const & level, MeshletOptions const & options)
+{
+	std::vector<MeshletBlock> result(level.blocks.size());
+	parallelFor(level.blocks.size(), options.threads, [&](size_t i)
+	{
+		result[i] = buildMeshlets(level.blocks[i], options);
+	});
+	return result;
+}
@@ -0,0 +1,63 @@
+#ifndef WMB_MESHLETS_HPP
+#define WMB_MESHLETS_HPP
+
+#include "wmb.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace WMB
+{
+	struct MeshletOptions
+	{
+		size_t maxVertices = 64;   // at most 256, the local indices are bytes
+		size_t maxTriangles = 124;
+
+		//! The coordinate system the level was loaded with, it decides
+		//! which side of a triangle is the front for the normal cones.
+		LoadOptions::CoordinateSystem coordinateSystem = LoadOptions::Gamestudio;
+
+		unsigned int threads = 0; // 0 = one thread per core
+	};
+
+	struct Meshlet
+	{
+		uint32_t vertexOffset;   // into MeshletBlock::vertices
+		uint32_t triangleOffset; // into MeshletBlock::triangles, 3 entries per triangle
+		uint32_t vertexCount;
+		uint32_t triangleCount;
+		uint16_t skin; // all triangles use the same skin
+
+		glm::vec3 center; // bounding sphere
+		float radius;
+
+		//! The meshlet faces away from a camera at `p` when
+		//! dot(normalize(coneApex - p), coneAxis) >= coneCutoff. The
+		//! axis is zero and the cutoff 1 when the normals spread too far
+		//! to be culled.
+		glm::vec3 coneApex;
+		glm::vec3 coneAxis;
+		float coneCutoff;
+	};
+
+	struct MeshletBlock
+	{
+		std::vector<Meshlet> meshlets;
+		std::vector<uint16_t> vertices; // indices into Block::vertices
+		std::vector<uint8_t> triangles; // indices into the vertices of the meshlet
+	};
+
+	//! Splits the triangles of the block into meshlets. Triangles are
+	//! taken in the order of a space filling curve through the block and
+	//! each meshlet grows over the triangles that share the most vertices
+	//! with it, so neighbouring meshlets are close in memory as well.
+	//! Triangles that reference missing vertices or repeat a vertex are
+	//! left out.
+	MeshletBlock buildMeshlets(Block const & block, MeshletOptions const & options = MeshletOptions());
+
+	//! Builds the meshlets of all blocks, the blocks are split between
+	//! the threads.
+	std::vector<MeshletBlock> buildMeshlets(Level const & level, MeshletOptions const & options = MeshletOptions());
+}
+
+#endif // WMB_MESHLETS_HPP
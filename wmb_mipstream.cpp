@@ -0,0 +1,203 @@
+#include "wmb_mipstream.hpp"
+#include "wmb_format.hpp"
+
+#include <algorithm>
+#include <set>
+#include <tuple>
+
+using namespace WMB;
+using namespace WMB::detail;
+
+MipStreamer::MipStreamer(std::string fileName, Level const & level, MipStreamOptions const & options) :
+	fileName(std::move(fileName))
+{
+	sources.resize(level.textures.size());
+	edges.resize(level.textures.size());
+	queued.resize(level.textures.size());
+	failed.resize(level.textures.size(), false);
+	for(size_t t = 0; t < level.textures.size(); t++)
+	{
+		auto const & texture = level.textures[t];
+		sources[t] = texture.pendingLevels;
+		edges[t] = std::max(texture.width, texture.height);
+		queued[t].assign(sources[t].size(), false);
+		if(options.background)
+		{
+			for(size_t i = 0; i < sources[t].size(); i++)
+				background.push_back(Job { t, static_cast<unsigned int>(i) });
+		}
+	}
+
+	// The smallest levels of all textures first, so every texture gets
+	// sharper at the same pace.
+	std::sort(background.begin(), background.end(), [&](Job const & a, Job const & b)
+	{
+		auto const sizeA = sources[a.texture][a.level].size;
+		auto const sizeB = sources[b.texture][b.level].size;
+		return std::make_tuple(sizeA, b.level, a.texture) < std::make_tuple(sizeB, a.level, b.texture);
+	});
+
+	for(unsigned i = 0; i < std::max(1u, options.threads); i++)
+		workers.emplace_back([this]() { run(); });
+}
+
+MipStreamer::~MipStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	for(auto & worker : workers)
+		worker.join();
+}
+
+void MipStreamer::run()
+{
+	File file(fopen(fileName.c_str(), "rb"));
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true)
+	{
+		wakeup.wait(lock, [&]() { return stopping or not requests.empty() or nextBackground < background.size(); });
+		if(stopping)
+			return;
+
+		Job job;
+		if(not requests.empty())
+		{
+			job = requests.front();
+			requests.pop_front();
+		}
+		else
+		{
+			job = background[nextBackground++];
+			if(queued[job.texture][job.level])
+				continue;
+			queued[job.texture][job.level] = true;
+		}
+		working++;
+		lock.unlock();
+
+		// the sources are never changed after the constructor
+		auto const & span = sources[job.texture][job.level];
+		std::vector<std::byte> data;
+		if(file)
+		{
+			file.truncated = false;
+			file.seek(span.offset);
+			data = file.read(span.size);
+			if(file.truncated)
+				data.clear();
+		}
+
+		lock.lock();
+		working--;
+		finished.push_back(Finished { job, std::move(data) });
+	}
+}
+
+void MipStreamer::request(size_t texture, unsigned int screenSize)
+{
+	auto const & spans = sources.at(texture);
+
+	// the smallest level that still has screenSize pixels
+	size_t needed = 0;
+	while(needed < spans.size() and (edges[texture] >> (needed + 1)) >= screenSize)
+		needed++;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(size_t i = spans.size(); i > needed; i--)
+		{
+			if(queued[texture][i - 1])
+				continue;
+			queued[texture][i - 1] = true;
+			requests.push_back(Job { texture, static_cast<unsigned int>(i - 1) });
+		}
+	}
+	wakeup.notify_all();
+}
+
+std::vector<size_t> MipStreamer::poll(Level & level)
+{
+	std::vector<Finished> done;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done.swap(finished);
+	}
+
+	std::set<size_t> touched;
+	for(auto & result : done)
+	{
+		ready[{ result.job.texture, result.job.level }] = std::move(result.data);
+		touched.insert(result.job.texture);
+	}
+
+	std::vector<size_t> changed;
+	for(auto const t : touched)
+	{
+		auto const first = ready.lower_bound({ t, 0 });
+		auto const last = ready.lower_bound({ t + 1, 0 });
+		if(t >= level.textures.size() or t >= sources.size() or failed[t])
+		{
+			ready.erase(first, last);
+			continue;
+		}
+
+		// Levels are added in front, the smallest skipped level is next.
+		auto & texture = level.textures[t];
+		bool added = false;
+		while(texture.skippedLevels > 0 and texture.skippedLevels <= sources[t].size())
+		{
+			unsigned int const next = texture.skippedLevels - 1;
+			auto const found = ready.find({ t, next });
+			if(found == ready.end())
+				break;
+
+			auto data = std::move(found->second);
+			ready.erase(found);
+
+			// a failed read or a level that was not loaded from this file
+			auto const & span = sources[t][next];
+			if(data.size() != span.size or texture.pendingLevels.size() != texture.skippedLevels
+			   or texture.pendingLevels.back().offset != span.offset)
+			{
+				failed[t] = true;
+				break;
+			}
+
+			if(texture.storage)
+			{
+				texture.levels.clear();
+				for(auto const & mip : texture.mips)
+					texture.levels.emplace_back(mip.begin(), mip.end());
+				texture.storage.reset();
+				texture.mips.clear();
+			}
+			texture.levels.insert(texture.levels.begin(), std::move(data));
+			texture.pendingLevels.pop_back();
+			texture.skippedLevels--;
+			added = true;
+		}
+		if(added)
+			changed.push_back(t);
+
+		// Levels that can no longer be added. The others wait for the
+		// smaller levels of their texture.
+		for(auto it = ready.lower_bound({ t, 0 }); it != ready.end() and it->first.first == t; )
+		{
+			if(failed[t] or it->first.second >= texture.skippedLevels or texture.skippedLevels > sources[t].size())
+				it = ready.erase(it);
+			else
+				++it;
+		}
+	}
+	return changed;
+}
+
+bool MipStreamer::busy() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return working > 0 or not requests.empty() or nextBackground < background.size() or not finished.empty();
+}
@@ -0,0 +1,96 @@
+#ifndef WMB_MIPSTREAM_HPP
+#define WMB_MIPSTREAM_HPP
+
+#include "wmb.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WMB
+{
+	struct MipStreamOptions
+	{
+		//! Loads all skipped levels without requests, the smallest levels
+		//! of all textures first. Requests are always served first.
+		bool background = true;
+
+		unsigned int threads = 1; // background loaders
+	};
+
+	//! Loads the mip levels that were skipped by LoadOptions::STREAM_MIPS
+	//! from the file of the level. The levels are read by background
+	//! threads and added to the textures by poll(), so the level can be
+	//! used while the details arrive.
+	//!
+	//! request() and poll() must be called from one thread. After reload()
+	//! the streamer still reads the old places, textures whose levels moved
+	//! are not changed anymore. Use a new streamer for the reloaded level.
+	class MipStreamer
+	{
+	public:
+		//! The level must have been loaded from the file with
+		//! LoadOptions::STREAM_MIPS. The places of the skipped levels are
+		//! copied, the level is only changed by poll().
+		MipStreamer(std::string fileName, Level const & level, MipStreamOptions const & options = MipStreamOptions());
+		~MipStreamer();
+
+		MipStreamer(MipStreamer const &) = delete;
+		MipStreamer & operator=(MipStreamer const &) = delete;
+
+		//! Loads the levels of a texture that are needed when it covers
+		//! `screenSize` pixels along its larger edge, before the background
+		//! loads.
+		void request(size_t texture, unsigned int screenSize);
+
+		//! Adds the finished levels to the textures, largest levels in
+		//! front. Textures that get new levels lose their shared storage,
+		//! packTextures() pools them again. Returns the changed textures,
+		//! so they can be uploaded again.
+		std::vector<size_t> poll(Level & level);
+
+		//! True while levels are queued, loading or waiting for poll().
+		bool busy() const;
+
+	private:
+		struct Job
+		{
+			size_t texture;
+			unsigned int level; // in the complete mip chain
+		};
+
+		struct Finished
+		{
+			Job job;
+			std::vector<std::byte> data; // empty if the read failed
+		};
+
+		void run();
+
+		std::string const fileName;
+		std::vector<std::vector<FileSpan>> sources; // skipped levels of each texture, largest first
+		std::vector<unsigned int> edges;            // larger edge of each texture
+
+		// loaded levels that wait for the smaller ones of their texture
+		std::map<std::pair<size_t, unsigned int>, std::vector<std::byte>> ready;
+		std::vector<bool> failed; // textures with a level that could not be added
+
+		// shared with the workers
+		mutable std::mutex mutex;
+		std::condition_variable wakeup;
+		std::vector<std::vector<bool>> queued;
+		std::deque<Job> requests;
+		std::vector<Job> background; // smallest levels first
+		size_t nextBackground = 0;
+		std::vector<Finished> finished;
+		size_t working = 0;
+		bool stopping = false;
+		std::vector<std::thread> workers;
+	};
+}
+
+#endif // WMB_MIPSTREAM_HPP
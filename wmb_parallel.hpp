@@ -0,0 +1,239 @@
+#ifndef WMB_PARALLEL_HPP
+#define WMB_PARALLEL_HPP
+
+// Threading helpers shared by the processing stages. This header is not
+// part of the public interface.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace WMB::detail
+{
+	//! Returns the number of worker threads to use, 0 means one per core.
+	inline unsigned workerCount(unsigned requested, size_t jobs)
+	{
+		if(requested == 0)
+			requested = std::max(1u, std::thread::hardware_concurrency());
+		return static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(requested, jobs)));
+	}
+
+	//! Calls fn(i) for every i in [0, count). The indices are handed out
+	//! one by one, so uneven jobs are balanced between the threads.
+	template<typename Fn>
+	void parallelFor(size_t count, unsigned threads, Fn const & fn)
+	{
+		threads = workerCount(threads, count);
+
+		std::atomic<size_t> next { 0 };
+		auto const worker = [&]()
+		{
+			for(size_t i = next++; i < count; i = next++)
+				fn(i);
+		};
+
+		std::vector<std::thread> pool;
+		pool.reserve(threads - 1);
+		for(unsigned i = 1; i < threads; i++)
+			pool.emplace_back(worker);
+		worker();
+		for(auto & thread : pool)
+			thread.join();
+	}
+
+	//! Thread pool where every worker has its own queue. Jobs submitted
+	//! from a job go to the back of the queue of the current worker, the
+	//! others are spread round robin over the fronts of all queues. A
+	//! worker takes jobs from the back of its own queue, so outside jobs
+	//! start in the order they were submitted, and steals from the front
+	//! of the other queues when its own runs empty.
+	class WorkStealingPool
+	{
+	public:
+		using Job = std::function<void()>;
+
+		explicit WorkStealingPool(unsigned threads = 0)
+		{
+			threads = workerCount(threads, ~size_t(0));
+			for(unsigned i = 0; i < threads; i++)
+				queues.push_back(std::make_unique<Queue>());
+			for(unsigned i = 0; i < threads; i++)
+				workers.emplace_back([this, i]() { run(i); });
+		}
+
+		WorkStealingPool(WorkStealingPool const &) = delete;
+		WorkStealingPool & operator=(WorkStealingPool const &) = delete;
+
+		~WorkStealingPool()
+		{
+			wait();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wakeup.notify_all();
+			for(auto & worker : workers)
+				worker.join();
+		}
+
+		unsigned size() const
+		{
+			return static_cast<unsigned>(workers.size());
+		}
+
+		void submit(Job job)
+		{
+			// count the job before a worker can take it
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				queued++;
+				pending++;
+			}
+			if(currentPool == this)
+			{
+				auto & queue = *queues[currentQueue];
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				queue.jobs.push_back(std::move(job));
+			}
+			else
+			{
+				auto & queue = *queues[nextQueue++ % queues.size()];
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				queue.jobs.push_front(std::move(job));
+			}
+			wakeup.notify_one();
+		}
+
+		//! Blocks until all submitted jobs are finished. Must not be
+		//! called from a job.
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			idle.wait(lock, [this]() { return pending == 0; });
+		}
+
+	private:
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<Job> jobs;
+		};
+
+		// pool and queue of the worker running on this thread
+		static inline thread_local WorkStealingPool * currentPool = nullptr;
+		static inline thread_local size_t currentQueue = 0;
+
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::atomic<size_t> nextQueue { 0 }; // for jobs submitted from outside of the pool
+		std::vector<std::thread> workers;
+
+		std::mutex mutex;
+		std::condition_variable wakeup; // a job was queued or the pool stops
+		std::condition_variable idle;   // all jobs are finished
+		size_t queued = 0;  // jobs waiting in the queues
+		size_t pending = 0; // jobs not finished yet
+		bool stopping = false;
+
+		bool take(size_t self, Job & job)
+		{
+			{
+				auto & queue = *queues[self];
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				if(not queue.jobs.empty())
+				{
+					job = std::move(queue.jobs.back());
+					queue.jobs.pop_back();
+					return true;
+				}
+			}
+			for(size_t i = 1; i < queues.size(); i++)
+			{
+				if(takeFront(*queues[(self + i) % queues.size()], job))
+					return true;
+			}
+			return false;
+		}
+
+		static bool takeFront(Queue & queue, Job & job)
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if(queue.jobs.empty())
+				return false;
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+			return true;
+		}
+
+		void run(size_t self)
+		{
+			currentPool = this;
+			currentQueue = self;
+			while(true)
+			{
+				Job job;
+				if(take(self, job))
+				{
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						queued--;
+					}
+					job();
+					std::lock_guard<std::mutex> lock(mutex);
+					if(--pending == 0)
+						idle.notify_all();
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeup.wait(lock, [this]() { return stopping or queued > 0; });
+				if(stopping and queued == 0)
+					return;
+			}
+		}
+	};
+
+	//! Counting semaphore over bytes. Requests larger than the budget are
+	//! clamped to it, so they can still run, but only on their own.
+	class ByteBudget
+	{
+	public:
+		explicit ByteBudget(size_t bytes) : capacity(std::max<size_t>(1, bytes)), available(capacity)
+		{
+
+		}
+
+		//! Blocks until the bytes are available, returns the amount that
+		//! has to be passed to release().
+		size_t acquire(size_t bytes)
+		{
+			bytes = std::min(bytes, capacity);
+			std::unique_lock<std::mutex> lock(mutex);
+			released.wait(lock, [&]() { return available >= bytes; });
+			available -= bytes;
+			return bytes;
+		}
+
+		void release(size_t bytes)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				available += bytes;
+			}
+			released.notify_all();
+		}
+
+	private:
+		size_t const capacity;
+		size_t available;
+		std::mutex mutex;
+		std::condition_variable released;
+	};
+}
+
+#endif // WMB_PARALLEL_HPP
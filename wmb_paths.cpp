@@ -0,0 +1,334 @@
+#include "wmb_paths.hpp"
+#include "wmb_parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	//! The neighbour of a node other than `except`, if it has exactly one.
+	std::optional<unsigned int> onlyOtherNeighbour(std::vector<std::vector<unsigned int>> const & neighbours, unsigned int node, unsigned int except)
+	{
+		std::optional<unsigned int> result;
+		for(auto const other : neighbours[node])
+		{
+			if(other == except)
+				continue;
+			if(result)
+				return std::nullopt;
+			result = other;
+		}
+		return result;
+	}
+
+	//! The first edge accepted by `connects`, preferring the ones that do
+	//! not lead to `back`, or -1.
+	template<typename Connects, typename Target>
+	int32_t findEdge(std::vector<PathEdge> const & edges, Connects const & connects, Target const & target, unsigned int back)
+	{
+		int32_t fallback = -1;
+		for(size_t i = 0; i < edges.size(); i++)
+		{
+			if(not connects(edges[i]))
+				continue;
+			if(target(edges[i]) != back)
+				return static_cast<int32_t>(i);
+			if(fallback < 0)
+				fallback = static_cast<int32_t>(i);
+		}
+		return fallback;
+	}
+}
+
+void PathMovers::push(uint32_t edge, float distance, float speed)
+{
+	edges.push_back(edge);
+	distances.push_back(distance);
+	speeds.push_back(speed);
+	for(auto * values : { &x, &y, &z, &tangentX, &tangentY, &tangentZ })
+		values->resize(edges.size(), 0.0f);
+}
+
+CompiledPath::CompiledPath(Path const & path, PathOptions const & options) :
+	tableSize(std::max(1u, options.tableSize)),
+	origin(path.nodes.empty() ? glm::vec3(0.0f) : path.nodes.front().position)
+{
+	std::vector<std::vector<unsigned int>> neighbours(path.nodes.size());
+	std::vector<PathEdge> edges;
+	for(auto const & edge : path.edges)
+	{
+		if(edge.node1 >= path.nodes.size() or edge.node2 >= path.nodes.size() or edge.node1 == edge.node2)
+			continue;
+		edges.push_back(edge);
+		neighbours[edge.node1].push_back(edge.node2);
+		neighbours[edge.node2].push_back(edge.node1);
+	}
+	for(auto & list : neighbours)
+	{
+		std::sort(list.begin(), list.end());
+		list.erase(std::unique(list.begin(), list.end()), list.end());
+	}
+
+	size_t const count = edges.size();
+	controls.resize(count);
+	lengths.resize(count);
+	starts.resize(count + 1, 0.0f);
+	next.resize(count);
+	previous.resize(count);
+	coefficientsX.resize(4 * count);
+	coefficientsY.resize(4 * count);
+	coefficientsZ.resize(4 * count);
+	chords.resize(count);
+	tables.resize((tableSize + 1) * count);
+
+	size_t const samples = 4 * tableSize;
+	std::vector<float> arc(samples + 1);
+	for(size_t e = 0; e < count; e++)
+	{
+		auto const & edge = edges[e];
+		glm::vec3 const a = path.nodes[edge.node1].position;
+		glm::vec3 const b = path.nodes[edge.node2].position;
+
+		glm::vec3 startTangent = b - a;
+		if(auto const n = onlyOtherNeighbour(neighbours, edge.node1, edge.node2))
+			startTangent = 0.5f * (b - path.nodes[*n].position);
+		glm::vec3 endTangent = b - a;
+		if(auto const n = onlyOtherNeighbour(neighbours, edge.node2, edge.node1))
+			endTangent = 0.5f * (path.nodes[*n].position - a);
+
+		auto & p = controls[e];
+		p[0] = a;
+		p[1] = a + (b - a) / 3.0f + edge.bezier * (startTangent - (b - a)) / 3.0f;
+		p[2] = b - (b - a) / 3.0f - edge.bezier * (endTangent - (b - a)) / 3.0f;
+		p[3] = b;
+
+		glm::vec3 const ca = -p[0] + 3.0f * p[1] - 3.0f * p[2] + p[3];
+		glm::vec3 const cb = 3.0f * p[0] - 6.0f * p[1] + 3.0f * p[2];
+		glm::vec3 const cc = -3.0f * p[0] + 3.0f * p[1];
+		glm::vec3 const cd = p[0];
+		for(auto const & [values, axis] : { std::make_pair(&coefficientsX, 0), std::make_pair(&coefficientsY, 1), std::make_pair(&coefficientsZ, 2) })
+		{
+			(*values)[4 * e + 0] = ca[axis];
+			(*values)[4 * e + 1] = cb[axis];
+			(*values)[4 * e + 2] = cc[axis];
+			(*values)[4 * e + 3] = cd[axis];
+		}
+		float const chord = glm::length(b - a);
+		chords[e] = (chord > 0.0f) ? (b - a) / chord : glm::vec3(0.0f);
+
+		// The arc length is summed over short chords, then inverted so
+		// that the table holds the parameter at evenly spaced distances.
+		glm::vec3 last = a;
+		arc[0] = 0.0f;
+		for(size_t i = 1; i <= samples; i++)
+		{
+			float const t = float(i) / float(samples);
+			glm::vec3 const point = ((ca * t + cb) * t + cc) * t + cd;
+			arc[i] = arc[i - 1] + glm::length(point - last);
+			last = point;
+		}
+		lengths[e] = arc[samples];
+		starts[e + 1] = starts[e] + lengths[e];
+
+		float * table = &tables[(tableSize + 1) * e];
+		size_t k = 0;
+		for(size_t j = 0; j <= tableSize; j++)
+		{
+			float const target = lengths[e] * float(j) / float(tableSize);
+			while(k + 1 < samples and arc[k + 1] < target)
+				k++;
+			float const span = arc[k + 1] - arc[k];
+			float const f = (span > 0.0f) ? std::clamp((target - arc[k]) / span, 0.0f, 1.0f) : 0.0f;
+			table[j] = (float(k) + f) / float(samples);
+		}
+		table[0] = 0.0f;
+		table[tableSize] = 1.0f;
+	}
+
+	for(size_t e = 0; e < count; e++)
+	{
+		auto const & edge = edges[e];
+		next[e] = findEdge(edges, [&](PathEdge const & other) { return other.node1 == edge.node2; },
+		                   [](PathEdge const & other) { return other.node2; }, edge.node1);
+		previous[e] = findEdge(edges, [&](PathEdge const & other) { return other.node2 == edge.node1; },
+		                       [](PathEdge const & other) { return other.node1; }, edge.node2);
+	}
+}
+
+std::optional<size_t> CompiledPath::nextEdge(size_t edge) const
+{
+	if(next.at(edge) < 0)
+		return std::nullopt;
+	return static_cast<size_t>(next[edge]);
+}
+
+std::optional<size_t> CompiledPath::previousEdge(size_t edge) const
+{
+	if(previous.at(edge) < 0)
+		return std::nullopt;
+	return static_cast<size_t>(previous[edge]);
+}
+
+float CompiledPath::parameter(size_t edge, float distance) const
+{
+	float const length = lengths[edge];
+	if(not (length > 0.0f))
+		return 0.0f;
+
+	float const u = std::clamp(distance / length, 0.0f, 1.0f) * float(tableSize);
+	size_t const i = std::min<size_t>(static_cast<size_t>(u), tableSize - 1);
+	float const * table = &tables[(tableSize + 1) * edge];
+	return table[i] + (u - float(i)) * (table[i + 1] - table[i]);
+}
+
+void CompiledPath::evaluate(size_t edge, float t, glm::vec3 & position, glm::vec3 & tangent) const
+{
+	float const * cx = &coefficientsX[4 * edge];
+	float const * cy = &coefficientsY[4 * edge];
+	float const * cz = &coefficientsZ[4 * edge];
+	position = glm::vec3(
+		((cx[0] * t + cx[1]) * t + cx[2]) * t + cx[3],
+		((cy[0] * t + cy[1]) * t + cy[2]) * t + cy[3],
+		((cz[0] * t + cz[1]) * t + cz[2]) * t + cz[3]);
+	glm::vec3 const derivative(
+		(3.0f * cx[0] * t + 2.0f * cx[1]) * t + cx[2],
+		(3.0f * cy[0] * t + 2.0f * cy[1]) * t + cy[2],
+		(3.0f * cz[0] * t + 2.0f * cz[1]) * t + cz[2]);
+	float const length2 = glm::dot(derivative, derivative);
+	tangent = (length2 > 0.0f) ? derivative / std::sqrt(length2) : chords[edge];
+}
+
+glm::vec3 CompiledPath::positionAt(size_t edge, float distance) const
+{
+	glm::vec3 position, tangent;
+	evaluate(edge, parameter(edge, distance), position, tangent);
+	return position;
+}
+
+glm::vec3 CompiledPath::tangentAt(size_t edge, float distance) const
+{
+	glm::vec3 position, tangent;
+	evaluate(edge, parameter(edge, distance), position, tangent);
+	return tangent;
+}
+
+glm::vec3 CompiledPath::positionAt(float distance) const
+{
+	if(lengths.empty())
+		return origin;
+	size_t const edge = std::upper_bound(starts.begin() + 1, starts.end() - 1, distance) - (starts.begin() + 1);
+	return positionAt(edge, distance - starts[edge]);
+}
+
+glm::vec3 CompiledPath::tangentAt(float distance) const
+{
+	if(lengths.empty())
+		return glm::vec3(0.0f);
+	size_t const edge = std::upper_bound(starts.begin() + 1, starts.end() - 1, distance) - (starts.begin() + 1);
+	return tangentAt(edge, distance - starts[edge]);
+}
+
+void CompiledPath::advance(PathMovers & movers, float dt, unsigned int threads) const
+{
+	size_t const count = movers.size();
+	for(auto * values : { &movers.x, &movers.y, &movers.z, &movers.tangentX, &movers.tangentY, &movers.tangentZ })
+		values->resize(count, 0.0f);
+	if(lengths.empty())
+		return;
+
+	size_t const chunkSize = 1024;
+	parallelFor((count + chunkSize - 1) / chunkSize, threads, [&](size_t c)
+	{
+		size_t const begin = chunkSize * c;
+		size_t const end = std::min(count, begin + chunkSize);
+		float params[chunkSize];
+
+		for(size_t i = begin; i < end; i++)
+		{
+			uint32_t edge = movers.edges[i];
+			float distance = movers.distances[i] + movers.speeds[i] * dt;
+
+			// bounded, so cycles of empty edges cannot hang
+			for(size_t step = 0; distance > lengths[edge] and step < lengths.size(); step++)
+			{
+				if(next[edge] < 0)
+					break;
+				distance -= lengths[edge];
+				edge = static_cast<uint32_t>(next[edge]);
+			}
+			for(size_t step = 0; distance < 0.0f and step < lengths.size(); step++)
+			{
+				if(previous[edge] < 0)
+					break;
+				edge = static_cast<uint32_t>(previous[edge]);
+				distance += lengths[edge];
+			}
+			distance = std::clamp(distance, 0.0f, lengths[edge]);
+
+			movers.edges[i] = edge;
+			movers.distances[i] = distance;
+			params[i - begin] = parameter(edge, distance);
+		}
+
+		size_t i = begin;
+#if defined(__SSE2__)
+		for(; i + 4 <= end; i += 4)
+		{
+			uint32_t const * e = &movers.edges[i];
+			__m128 const t = _mm_loadu_ps(params + (i - begin));
+
+			// Horner's scheme for the point and the derivative of one axis
+			auto const axis = [&](std::vector<float> const & values, __m128 & position)
+			{
+				auto const gather = [&](size_t k)
+				{
+					return _mm_setr_ps(values[4 * e[0] + k], values[4 * e[1] + k], values[4 * e[2] + k], values[4 * e[3] + k]);
+				};
+				__m128 const a = gather(0), b = gather(1), c = gather(2), d = gather(3);
+				position = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(a, t), b), t), c), t), d);
+				__m128 const a3 = _mm_mul_ps(_mm_set1_ps(3.0f), a);
+				__m128 const b2 = _mm_mul_ps(_mm_set1_ps(2.0f), b);
+				return _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(a3, t), b2), t), c);
+			};
+			__m128 px, py, pz;
+			__m128 const dx = axis(coefficientsX, px);
+			__m128 const dy = axis(coefficientsY, py);
+			__m128 const dz = axis(coefficientsZ, pz);
+			_mm_storeu_ps(&movers.x[i], px);
+			_mm_storeu_ps(&movers.y[i], py);
+			_mm_storeu_ps(&movers.z[i], pz);
+
+			// vanishing derivatives fall back to the chord
+			__m128 const length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			__m128 const valid = _mm_cmpgt_ps(length2, _mm_setzero_ps());
+			__m128 const scale = _mm_and_ps(valid, _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(length2)));
+			auto const tangent = [&](__m128 derivative, int k)
+			{
+				__m128 const chord = _mm_setr_ps(chords[e[0]][k], chords[e[1]][k], chords[e[2]][k], chords[e[3]][k]);
+				return _mm_or_ps(_mm_mul_ps(derivative, scale), _mm_andnot_ps(valid, chord));
+			};
+			_mm_storeu_ps(&movers.tangentX[i], tangent(dx, 0));
+			_mm_storeu_ps(&movers.tangentY[i], tangent(dy, 1));
+			_mm_storeu_ps(&movers.tangentZ[i], tangent(dz, 2));
+		}
+#endif
+		for(; i < end; i++)
+		{
+			glm::vec3 position, tangent;
+			evaluate(movers.edges[i], params[i - begin], position, tangent);
+			movers.x[i] = position.x;
+			movers.y[i] = position.y;
+			movers.z[i] = position.z;
+			movers.tangentX[i] = tangent.x;
+			movers.tangentY[i] = tangent.y;
+			movers.tangentZ[i] = tangent.z;
+		}
+	});
+}
@@ -0,0 +1,109 @@
+#ifndef WMB_PATHS_HPP
+#define WMB_PATHS_HPP
+
+#include "wmb.hpp"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace WMB
+{
+	struct PathOptions
+	{
+		//! Entries of the arc length table of each edge. More entries
+		//! make the speed along strongly bent edges more even.
+		unsigned int tableSize = 32;
+	};
+
+	//! Movers on a compiled path as a structure of arrays, one entry per
+	//! mover. The positions and tangents are written by advance().
+	struct PathMovers
+	{
+		std::vector<uint32_t> edges;
+		std::vector<float> distances; // from node1 of the edge
+		std::vector<float> speeds;    // units per second, negative moves towards node1
+		std::vector<float> x, y, z;
+		std::vector<float> tangentX, tangentY, tangentZ; // unit length, towards node2
+
+		size_t size() const { return edges.size(); }
+
+		void push(uint32_t edge, float distance, float speed);
+	};
+
+	//! A path with a cubic Bezier segment for every edge and tables that
+	//! map the distance along an edge to the curve parameter.
+	//!
+	//! The WMB file only stores a bezier factor per edge, the control
+	//! points are derived from the nodes: an edge from A to B starts with
+	//! the tangent (B - N) / 2 when A has exactly one other neighbour N,
+	//! like a Catmull-Rom spline, and with B - A otherwise. The end
+	//! tangent is built the same way from the neighbours of B. The inner
+	//! control points are A + tangent / 3 and B - tangent / 3, blended
+	//! with the points at a third and two thirds of the straight edge by
+	//! the bezier factor. A factor of 0 gives a straight edge, 1 the
+	//! Catmull-Rom segment.
+	class CompiledPath
+	{
+	public:
+		explicit CompiledPath(Path const & path, PathOptions const & options = PathOptions());
+
+		size_t edgeCount() const { return lengths.size(); }
+
+		//! Arc length of the curve, which can differ from PathEdge::length.
+		float edgeLength(size_t edge) const { return lengths.at(edge); }
+
+		//! Sum of all edges, in the order of Path::edges.
+		float length() const { return starts.empty() ? 0.0f : starts.back(); }
+
+		std::array<glm::vec3, 4> const & controlPoints(size_t edge) const { return controls.at(edge); }
+
+		//! The edge that continues at node2 of an edge: the first edge
+		//! that starts there, preferring edges that do not lead back to
+		//! node1. Nullopt at dead ends. previousEdge() is the same for
+		//! edges that end at node1.
+		std::optional<size_t> nextEdge(size_t edge) const;
+		std::optional<size_t> previousEdge(size_t edge) const;
+
+		//! Point and unit tangent at a distance from node1 of the edge, the
+		//! distance is clamped to the edge. Constant time.
+		glm::vec3 positionAt(size_t edge, float distance) const;
+		glm::vec3 tangentAt(size_t edge, float distance) const;
+
+		//! Point and unit tangent at a distance along all edges in the
+		//! order of Path::edges. Logarithmic in the number of edges.
+		glm::vec3 positionAt(float distance) const;
+		glm::vec3 tangentAt(float distance) const;
+
+		//! Moves every mover by speed * dt. Movers that leave their edge
+		//! continue on the next or previous edge and stop at dead ends.
+		//! Then the positions and tangents are evaluated, four movers at
+		//! once with SSE2. The movers are split into chunks between the
+		//! threads. All edges of the movers must be valid.
+		void advance(PathMovers & movers, float dt, unsigned int threads = 1) const;
+
+	private:
+		float parameter(size_t edge, float distance) const;
+		void evaluate(size_t edge, float t, glm::vec3 & position, glm::vec3 & tangent) const;
+
+		unsigned int tableSize;
+		glm::vec3 origin; // first node, for paths without edges
+
+		std::vector<std::array<glm::vec3, 4>> controls;
+		std::vector<float> lengths;
+		std::vector<float> starts; // distance at the start of each edge, and the total
+		std::vector<int32_t> next, previous;
+
+		// p(t) = ((a * t + b) * t + c) * t + d per edge, as four values
+		// for each axis, and the direction of the chord for edges whose
+		// derivative vanishes at the ends.
+		std::vector<float> coefficientsX, coefficientsY, coefficientsZ;
+		std::vector<glm::vec3> chords;
+
+		// tableSize + 1 curve parameters per edge at evenly spaced distances
+		std::vector<float> tables;
+	};
+}
+
+#endif // WMB_PATHS_HPP
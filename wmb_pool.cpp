@@ -0,0 +1,61 @@
+#include "wmb.hpp"
+#include "wmb_format.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace WMB;
+using namespace WMB::detail;
+
+void WMB::packTextures(Level & level, size_t alignment)
+{
+	alignment = std::max<size_t>(1, alignment);
+	auto const alignUp = [&](size_t n)
+	{
+		return (n + alignment - 1) / alignment * alignment;
+	};
+
+	// DDS files with more than one surface keep their own storage
+	std::vector<bool> pooled(level.textures.size());
+	size_t total = 0;
+	for(size_t t = 0; t < level.textures.size(); t++)
+	{
+		auto const & texture = level.textures[t];
+		pooled[t] = not (storesDDSFile(texture) and hasExtraSurfaces(ByteView { texture.storage->data(), texture.storage->size() }, texture));
+		if(not pooled[t])
+			continue;
+		for(size_t i = 0; i < texture.levelCount(); i++)
+			total += alignUp(texture.level(i).size());
+	}
+
+	// Copy everything first, the old storage may be shared with the
+	// textures that are still to be copied.
+	auto pool = std::make_shared<std::vector<std::byte>>(total);
+	std::vector<std::vector<ByteView>> mips(level.textures.size());
+	size_t offset = 0;
+	for(size_t t = 0; t < level.textures.size(); t++)
+	{
+		auto const & texture = level.textures[t];
+		if(not pooled[t])
+			continue;
+		for(size_t i = 0; i < texture.levelCount(); i++)
+		{
+			auto const mip = texture.level(i);
+			if(not mip.empty())
+				memcpy(pool->data() + offset, mip.data(), mip.size());
+			mips[t].push_back(ByteView { pool->data() + offset, mip.size() });
+			offset += alignUp(mip.size());
+		}
+	}
+
+	std::shared_ptr<std::vector<std::byte> const> const storage = std::move(pool);
+	for(size_t t = 0; t < level.textures.size(); t++)
+	{
+		if(not pooled[t])
+			continue;
+		auto & texture = level.textures[t];
+		texture.levels.clear();
+		texture.storage = storage;
+		texture.mips = std::move(mips[t]);
+	}
+}
@@ -0,0 +1,156 @@
+#include "wmb.hpp"
+#include "wmb_format.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace WMB;
+using namespace WMB::detail;
+
+std::optional<LevelProbe> WMB::probe(std::string const & fileName, LoadOptions const & options)
+{
+	File f(fopen(fileName.c_str(), "rb"));
+	if(not f)
+		return std::nullopt;
+
+	// Only small records are read, so a small buffer avoids reading a
+	// full page after every seek.
+	setvbuf(f, nullptr, _IOFBF, 512);
+
+	LevelProbe result;
+	result.fileSize = f.size();
+
+	WMB_HEADER header = f.read<WMB_HEADER>();
+	if(f.truncated or memcmp(header.version.data(), "WMB7", 4) != 0)
+		return std::nullopt;
+
+	for(auto const * list : { &header.textures, &header.materials, &header.blocks, &header.objects,
+	                          &header.lightmaps, &header.lightmaps_terrain, &header.pvs,
+	                          &header.bsp_nodes, &header.bsp_leafs, &header.bsp_blocks })
+	{
+		if(size_t(list->offset) + list->length > result.fileSize)
+			return std::nullopt;
+	}
+
+	result.textureBytes = header.textures.length;
+	result.materialBytes = header.materials.length;
+	result.blockBytes = header.blocks.length;
+	result.objectBytes = header.objects.length;
+	result.lightmapBytes = header.lightmaps.length;
+	result.terrainLightmapBytes = header.lightmaps_terrain.length;
+	result.hasBsp = (header.bsp_nodes.offset != 0 and header.bsp_leafs.offset != 0 and header.bsp_blocks.offset != 0);
+	if(result.hasBsp)
+		result.bspBytes = header.pvs.length + header.bsp_nodes.length + header.bsp_leafs.length + header.bsp_blocks.length;
+
+	if(header.textures.offset != 0)
+	{
+		f.seek(header.textures.offset);
+		result.textureCount = f.read<uint32_t>();
+		// every texture has an offset and a TEXTURE record
+		if(result.textureCount > (header.textures.length - std::min<size_t>(header.textures.length, sizeof(uint32_t))) / (sizeof(uint32_t) + sizeof(TEXTURE)))
+			return std::nullopt;
+	}
+
+	if(header.materials.offset != 0)
+		result.materialCount = header.materials.length / sizeof(MATERIAL_INFO);
+
+	// Walk the block headers, the arrays in between are skipped
+	if(header.blocks.offset != 0)
+	{
+		glm::mat3 const mapping = coordinateMatrix(options.targetCoordinateSystem);
+
+		f.seek(header.blocks.offset);
+		result.blockCount = f.read<uint32_t>();
+		// checked before reserving, the count comes from the file
+		if(result.blockCount > (header.blocks.length - std::min<size_t>(header.blocks.length, sizeof(uint32_t))) / sizeof(BLOCK))
+			return std::nullopt;
+
+		size_t offset = header.blocks.offset + sizeof(uint32_t);
+		size_t const end = size_t(header.blocks.offset) + header.blocks.length;
+		result.blocks.reserve(result.blockCount);
+		for(size_t i = 0; i < result.blockCount; i++)
+		{
+			if(offset + sizeof(BLOCK) > end)
+				return std::nullopt;
+			f.seek(offset);
+			auto const bl = f.read<BLOCK>();
+
+			auto const corner1 = toVec3(bl.fMins) * mapping;
+			auto const corner2 = toVec3(bl.fMaxs) * mapping;
+
+			BlockHeader block;
+			block.bbMin = glm::min(corner1, corner2);
+			block.bbMax = glm::max(corner1, corner2);
+			block.vertexCount = bl.lNumVerts;
+			block.triangleCount = bl.lNumTris;
+			block.skinCount = bl.lNumSkins;
+			result.blocks.push_back(block);
+
+			result.vertexCount += bl.lNumVerts;
+			result.triangleCount += bl.lNumTris;
+			result.skinCount += bl.lNumSkins;
+			if(i == 0)
+			{
+				result.bbMin = block.bbMin;
+				result.bbMax = block.bbMax;
+			}
+			else
+			{
+				result.bbMin = glm::min(result.bbMin, block.bbMin);
+				result.bbMax = glm::max(result.bbMax, block.bbMax);
+			}
+
+			offset += sizeof(BLOCK) +
+				size_t(bl.lNumVerts) * sizeof(VERTEX) +
+				size_t(bl.lNumTris) * sizeof(TRIANGLE) +
+				size_t(bl.lNumSkins) * sizeof(SKIN);
+		}
+		if(offset > end)
+			return std::nullopt;
+	}
+
+	// Only the type of each object is read until the info object is found.
+	// save() writes it last unless the level knows its place, so the last
+	// object is checked first.
+	if(header.objects.offset != 0)
+	{
+		f.seek(header.objects.offset);
+		result.objectCount = f.read<uint32_t>();
+		if(header.objects.length < sizeof(uint32_t) * (result.objectCount + 1))
+			return std::nullopt;
+
+		std::vector<uint32_t> offsets(result.objectCount);
+		for(auto & offset : offsets)
+			offset = f.read<uint32_t>();
+
+		if(not offsets.empty())
+			std::rotate(offsets.begin(), offsets.end() - 1, offsets.end());
+		for(auto const offset : offsets)
+		{
+			f.seek(header.objects.offset + offset);
+			if(f.read<OBJECT_TYPE>() != OBJECT_TYPE::Info)
+				continue;
+			auto const inf = f.read<WMB_INFO>();
+			if(inf.LMapSize > 2)
+				return std::nullopt;
+			result.info = toInfo(inf);
+			break;
+		}
+	}
+
+	if(header.lightmaps.offset != 0 and result.info)
+		result.lightmapCount = header.lightmaps.length / (3 * result.info->lightMapSize * result.info->lightMapSize);
+
+	if(header.lightmaps_terrain.offset != 0)
+	{
+		f.seek(header.lightmaps_terrain.offset);
+		result.terrainLightmapCount = f.read<uint32_t>();
+		if(result.terrainLightmapCount > (header.lightmaps_terrain.length - std::min<size_t>(header.lightmaps_terrain.length, sizeof(uint32_t))) / sizeof(LIGHTMAP_TERRAIN))
+			return std::nullopt;
+	}
+
+	if(f.truncated)
+		return std::nullopt;
+
+	return result;
+}
@@ -0,0 +1,231 @@
+#include "wmb_quantize.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace WMB;
+
+namespace // anonymous namespace
+{
+	struct QuantizationRange
+	{
+		glm::vec3 minimum;
+		glm::vec3 extent;
+	};
+
+	QuantizationRange rangeOf(Block const & block)
+	{
+		// The bounding box written by the compiler is not guaranteed to be
+		// tight, so make sure every vertex is inside of the encoded range.
+		glm::vec3 minimum = glm::min(block.bbMin, block.bbMax);
+		glm::vec3 maximum = glm::max(block.bbMin, block.bbMax);
+		for(auto const & vert : block.vertices)
+		{
+			minimum = glm::min(minimum, vert.position);
+			maximum = glm::max(maximum, vert.position);
+		}
+
+		QuantizationRange range;
+		range.minimum = minimum;
+		range.extent = glm::max(maximum - minimum, glm::vec3(1e-6f));
+		return range;
+	}
+
+	void encodeScalar(Vertex const & vert, QuantizationRange const & range, glm::vec3 const & scale, CompactVertex & out)
+	{
+		for(int i = 0; i < 3; i++)
+		{
+			float const q = (vert.position[i] - range.minimum[i]) * scale[i] + 0.5f;
+			out.position[i] = static_cast<uint16_t>(std::clamp(q, 0.0f, 65535.0f));
+		}
+		out.uv[0] = toHalf(vert.uv.x);
+		out.uv[1] = toHalf(vert.uv.y);
+		out.lightmap[0] = toHalf(vert.lightmap.x);
+		out.lightmap[1] = toHalf(vert.lightmap.y);
+	}
+
+#if defined(__SSE2__)
+	//! Quantizes one coordinate of four vertices like encodeScalar(). The
+	//! results are biased by -32768 for packBiased().
+	__m128i quantize4(__m128 value, float minimum, float scale)
+	{
+		__m128 q = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(value, _mm_set1_ps(minimum)), _mm_set1_ps(scale)), _mm_set1_ps(0.5f));
+		q = _mm_min_ps(_mm_max_ps(q, _mm_setzero_ps()), _mm_set1_ps(65535.0f));
+		return _mm_sub_epi32(_mm_cvttps_epi32(q), _mm_set1_epi32(32768));
+	}
+
+	//! SSE2 has no unsigned 32->16 bit pack, so the values are packed with
+	//! a bias that is removed afterwards.
+	__m128i packBiased(__m128i a, __m128i b)
+	{
+		return _mm_xor_si128(_mm_packs_epi32(a, b), _mm_set1_epi16(static_cast<short>(0x8000)));
+	}
+#endif
+}
+
+uint16_t WMB::toHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof bits);
+
+	uint32_t const sign = (bits >> 16) & 0x8000;
+	uint32_t const magnitude = bits & 0x7FFFFFFF;
+
+	if(magnitude >= 0x7F800000) // infinity or NaN
+		return static_cast<uint16_t>(sign | 0x7C00 | ((magnitude > 0x7F800000) ? 0x200 : 0));
+
+	if(magnitude >= 0x477FF000) // rounds to a value larger than 65504
+		return static_cast<uint16_t>(sign | 0x7C00);
+
+	if(magnitude < 0x38800000) // subnormal half or zero
+	{
+		if(magnitude < 0x33000000)
+			return static_cast<uint16_t>(sign);
+
+		uint32_t const exponent = magnitude >> 23;
+		uint32_t const mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+		uint32_t const shift = 126 - exponent;
+
+		uint32_t result = mantissa >> shift;
+		uint32_t const remainder = mantissa & ((1u << shift) - 1);
+		uint32_t const halfway = 1u << (shift - 1);
+		if(remainder > halfway or (remainder == halfway and (result & 1)))
+			result++;
+		return static_cast<uint16_t>(sign | result);
+	}
+
+	// rebias the exponent and round to nearest even
+	uint32_t result = (magnitude - 0x38000000) >> 13;
+	uint32_t const remainder = magnitude & 0x1FFF;
+	if(remainder > 0x1000 or (remainder == 0x1000 and (result & 1)))
+		result++;
+	return static_cast<uint16_t>(sign | result);
+}
+
+float WMB::fromHalf(uint16_t value)
+{
+	uint32_t const sign = static_cast<uint32_t>(value & 0x8000) << 16;
+	uint32_t const exponent = (value >> 10) & 0x1F;
+	uint32_t const mantissa = value & 0x3FF;
+
+	if(exponent == 0)
+	{
+		// zero or subnormal, exactly representable as float
+		float const result = mantissa * (1.0f / 16777216.0f);
+		return sign ? -result : result;
+	}
+
+	uint32_t bits;
+	if(exponent == 0x1F)
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	float result;
+	memcpy(&result, &bits, sizeof result);
+	return result;
+}
+
+CompactBlock WMB::quantize(Block const & block, QuantizationReport * report)
+{
+	auto const range = rangeOf(block);
+	glm::vec3 const scale = glm::vec3(65535.0f) / range.extent;
+
+	CompactBlock result;
+	result.bbMin = range.minimum;
+	result.bbMax = range.minimum + range.extent;
+	result.triangles = block.triangles;
+	result.skins = block.skins;
+	result.vertices.resize(block.vertices.size());
+
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	// Four vertices per step, every component is gathered into its own
+	// register so all lanes are used
+	for(; i + 4 <= block.vertices.size(); i += 4)
+	{
+		Vertex const * v = &block.vertices[i];
+
+		__m128i const x = quantize4(_mm_setr_ps(v[0].position.x, v[1].position.x, v[2].position.x, v[3].position.x), range.minimum.x, scale.x);
+		__m128i const y = quantize4(_mm_setr_ps(v[0].position.y, v[1].position.y, v[2].position.y, v[3].position.y), range.minimum.y, scale.y);
+		__m128i const z = quantize4(_mm_setr_ps(v[0].position.z, v[1].position.z, v[2].position.z, v[3].position.z), range.minimum.z, scale.z);
+
+		alignas(16) uint16_t xy[8], zz[8];
+		_mm_store_si128(reinterpret_cast<__m128i *>(xy), packBiased(x, y));
+		_mm_store_si128(reinterpret_cast<__m128i *>(zz), packBiased(z, z));
+
+#if defined(__F16C__)
+		__m128i const u = _mm_cvtps_ph(_mm_setr_ps(v[0].uv.x, v[1].uv.x, v[2].uv.x, v[3].uv.x), _MM_FROUND_TO_NEAREST_INT);
+		__m128i const w = _mm_cvtps_ph(_mm_setr_ps(v[0].uv.y, v[1].uv.y, v[2].uv.y, v[3].uv.y), _MM_FROUND_TO_NEAREST_INT);
+		__m128i const lu = _mm_cvtps_ph(_mm_setr_ps(v[0].lightmap.x, v[1].lightmap.x, v[2].lightmap.x, v[3].lightmap.x), _MM_FROUND_TO_NEAREST_INT);
+		__m128i const lw = _mm_cvtps_ph(_mm_setr_ps(v[0].lightmap.y, v[1].lightmap.y, v[2].lightmap.y, v[3].lightmap.y), _MM_FROUND_TO_NEAREST_INT);
+
+		alignas(16) uint16_t uv[8], lm[8];
+		_mm_store_si128(reinterpret_cast<__m128i *>(uv), _mm_unpacklo_epi64(u, w));
+		_mm_store_si128(reinterpret_cast<__m128i *>(lm), _mm_unpacklo_epi64(lu, lw));
+#endif
+
+		for(size_t k = 0; k < 4; k++)
+		{
+			auto & out = result.vertices[i + k];
+			out.position = { xy[k], xy[4 + k], zz[k] };
+#if defined(__F16C__)
+			out.uv = { uv[k], uv[4 + k] };
+			out.lightmap = { lm[k], lm[4 + k] };
+#else
+			out.uv = { toHalf(v[k].uv.x), toHalf(v[k].uv.y) };
+			out.lightmap = { toHalf(v[k].lightmap.x), toHalf(v[k].lightmap.y) };
+#endif
+		}
+	}
+#endif
+
+	for(; i < block.vertices.size(); i++)
+		encodeScalar(block.vertices[i], range, scale, result.vertices[i]);
+
+	if(report != nullptr)
+	{
+		for(size_t idx = 0; idx < block.vertices.size(); idx++)
+		{
+			auto const & original = block.vertices[idx];
+			auto const decoded = dequantize(result, result.vertices[idx]);
+
+			glm::vec2 const uvError = glm::abs(decoded.uv - original.uv);
+			glm::vec2 const lmError = glm::abs(decoded.lightmap - original.lightmap);
+
+			report->maxPositionError = std::max(report->maxPositionError, glm::distance(decoded.position, original.position));
+			report->maxUvError = std::max({ report->maxUvError, uvError.x, uvError.y });
+			report->maxLightmapError = std::max({ report->maxLightmapError, lmError.x, lmError.y });
+		}
+	}
+
+	return result;
+}
+
+std::vector<CompactBlock> WMB::quantize(Level const & level, QuantizationReport * report)
+{
+	std::vector<CompactBlock> blocks;
+	blocks.reserve(level.blocks.size());
+	for(auto const & block : level.blocks)
+		blocks.push_back(quantize(block, report));
+	return blocks;
+}
+
+Vertex WMB::dequantize(CompactBlock const & block, CompactVertex const & vertex)
+{
+	glm::vec3 const step = (block.bbMax - block.bbMin) / 65535.0f;
+
+	Vertex vert;
+	vert.position = block.bbMin + step * glm::vec3(
+		static_cast<float>(vertex.position[0]),
+		static_cast<float>(vertex.position[1]),
+		static_cast<float>(vertex.position[2]));
+	vert.uv = glm::vec2(fromHalf(vertex.uv[0]), fromHalf(vertex.uv[1]));
+	vert.lightmap = glm::vec2(fromHalf(vertex.lightmap[0]), fromHalf(vertex.lightmap[1]));
+	return vert;
+}
@@ -0,0 +1,48 @@
+#ifndef WMB_QUANTIZE_HPP
+#define WMB_QUANTIZE_HPP
+
+#include "wmb.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace WMB
+{
+	struct CompactVertex
+	{
+		std::array<uint16_t, 3> position; // unorm16, relative to the block bounds
+		std::array<uint16_t, 2> uv;       // half float texture coordinates
+		std::array<uint16_t, 2> lightmap; // half float lightmap coordinates
+	};
+
+	static_assert(sizeof(CompactVertex) == 14);
+
+	struct CompactBlock
+	{
+		glm::vec3 bbMin; // quantization range, contains all vertices
+		glm::vec3 bbMax; // quantization range, contains all vertices
+		std::vector<CompactVertex> vertices;
+		std::vector<Triangle> triangles;
+		std::vector<Skin> skins;
+	};
+
+	struct QuantizationReport
+	{
+		float maxPositionError = 0.0f; // largest distance between original and decoded position
+		float maxUvError = 0.0f;       // largest per-component error of the texture coordinates
+		float maxLightmapError = 0.0f; // largest per-component error of the lightmap coordinates
+	};
+
+	uint16_t toHalf(float value);
+	float fromHalf(uint16_t value);
+
+	//! Encodes the block vertices into the compact format. If a report
+	//! is given, the largest errors of this block are merged into it.
+	CompactBlock quantize(Block const & block, QuantizationReport * report = nullptr);
+	std::vector<CompactBlock> quantize(Level const & level, QuantizationReport * report = nullptr);
+
+	Vertex dequantize(CompactBlock const & block, CompactVertex const & vertex);
+}
+
+#endif // WMB_QUANTIZE_HPP
@@ -0,0 +1,189 @@
+#include "wmb_stream.hpp"
+#include "wmb_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace WMB;
+
+namespace // anonymous namespace
+{
+	float distanceToBox(glm::vec3 const & p, glm::vec3 const & minimum, glm::vec3 const & maximum)
+	{
+		float d2 = 0.0f;
+		for(int i = 0; i < 3; i++)
+		{
+			float const d = std::max({ minimum[i] - p[i], 0.0f, p[i] - maximum[i] });
+			d2 += d * d;
+		}
+		return std::sqrt(d2);
+	}
+}
+
+WorldStreamer::WorldStreamer(std::vector<StreamedLevel> levels, StreamOptions const & options) :
+	options(options)
+{
+	entries.resize(levels.size());
+	for(size_t i = 0; i < levels.size(); i++)
+	{
+		auto & entry = entries[i];
+		entry.source = std::move(levels[i]);
+
+		auto const probe = WMB::probe(entry.source.fileName, entry.source.options);
+		if(not probe)
+		{
+			if(entry.source.options.log_warnings())
+				std::cerr << "WMB Warning: " << entry.source.fileName << " is not a valid level, it will not be streamed!" << std::endl;
+			continue;
+		}
+		entry.valid = true;
+		entry.estimate = probe->fileSize;
+		if(probe->blockCount > 0)
+		{
+			entry.bbMin = probe->bbMin + entry.source.offset;
+			entry.bbMax = probe->bbMax + entry.source.offset;
+		}
+		else
+		{
+			entry.bbMin = entry.bbMax = entry.source.offset;
+		}
+	}
+
+	active.assign(entries.size(), false);
+	for(unsigned i = 0; i < std::max(1u, options.threads); i++)
+		workers.emplace_back([this]() { run(); });
+}
+
+WorldStreamer::~WorldStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		queue.clear();
+	}
+	wakeup.notify_all();
+	for(auto & worker : workers)
+		worker.join();
+}
+
+void WorldStreamer::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true)
+	{
+		wakeup.wait(lock, [&]() { return stopping or not queue.empty(); });
+		if(stopping)
+			return;
+
+		size_t const index = queue.back();
+		queue.pop_back();
+		active[index] = true;
+		working++;
+		lock.unlock();
+
+		// the source is never changed after the constructor
+		auto const & source = entries[index].source;
+		std::shared_ptr<Level const> level;
+		size_t bytes = 0;
+		if(auto loaded = WMB::load(source.fileName, source.options))
+		{
+			level = std::make_shared<Level const>(std::move(*loaded));
+			bytes = memoryFootprint(*level);
+		}
+
+		lock.lock();
+		active[index] = false;
+		working--;
+		finished.push_back(Finished { index, std::move(level), bytes });
+	}
+}
+
+void WorldStreamer::update(glm::vec3 const & position)
+{
+	std::vector<Finished> done;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done.swap(finished);
+	}
+
+	// Loaded levels replace the estimate with their measured size and are
+	// only published below when they still fit into the budget, so a level
+	// that is larger than expected is not loaded again and again.
+	std::vector<std::shared_ptr<Level const>> arrived(entries.size());
+	for(auto & result : done)
+	{
+		auto & entry = entries[result.index];
+		if(not result.level)
+		{
+			if(entry.source.options.log_warnings())
+				std::cerr << "WMB Warning: " << entry.source.fileName << " could not be loaded, it will not be streamed!" << std::endl;
+			entry.valid = false;
+			continue;
+		}
+		entry.estimate = result.bytes;
+		arrived[result.index] = std::move(result.level);
+	}
+
+	std::vector<std::pair<float, size_t>> order;
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		if(entries[i].valid)
+			order.emplace_back(distanceToBox(position, entries[i].bbMin, entries[i].bbMax), i);
+	}
+	std::sort(order.begin(), order.end());
+
+	// The nearest levels get the budget first. Levels that are still
+	// loading count with their estimate.
+	std::vector<size_t> missing;
+	size_t bytes = 0;
+	for(auto const & item : order)
+	{
+		auto & entry = entries[item.second];
+		bool const inRange = (item.first <= options.loadDistance) or (entry.level and item.first <= options.unloadDistance);
+		size_t const size = entry.level ? entry.bytes : entry.estimate;
+		if(inRange and bytes + size <= options.budget)
+		{
+			bytes += size;
+			if(entry.level)
+				continue;
+			if(arrived[item.second])
+			{
+				entry.level = std::move(arrived[item.second]);
+				entry.bytes = entry.estimate;
+			}
+			else
+				missing.push_back(item.second);
+		}
+		else
+		{
+			entry.level.reset();
+			entry.bytes = 0;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.clear();
+		for(auto it = missing.rbegin(); it != missing.rend(); ++it)
+		{
+			if(not active[*it])
+				queue.push_back(*it);
+		}
+	}
+	wakeup.notify_all();
+}
+
+size_t WorldStreamer::residentBytes() const
+{
+	size_t bytes = 0;
+	for(auto const & entry : entries)
+		bytes += entry.bytes;
+	return bytes;
+}
+
+bool WorldStreamer::busy() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return working > 0 or not queue.empty() or not finished.empty();
+}
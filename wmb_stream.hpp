@@ -0,0 +1,109 @@
+#ifndef WMB_STREAM_HPP
+#define WMB_STREAM_HPP
+
+#include "wmb.hpp"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WMB
+{
+	struct StreamOptions
+	{
+		size_t budget = size_t(1) << 30; // bytes of resident and loading levels
+
+		//! Levels closer than loadDistance to the position are loaded,
+		//! loaded levels are kept until they are further away than
+		//! unloadDistance. The distance is measured to the level bounds.
+		float loadDistance = 2048.0f;
+		float unloadDistance = 2560.0f;
+
+		unsigned int threads = 1; // background loaders
+	};
+
+	//! A level of the world and where it is placed.
+	struct StreamedLevel
+	{
+		std::string fileName;
+		glm::vec3 offset = glm::vec3(0.0f); // placement of the level bounds, the level itself keeps its coordinates
+		LoadOptions options;
+	};
+
+	//! Loads and unloads the levels of a world around a position. The
+	//! bounds and sizes come from probe(), so nothing is loaded up front.
+	//! Levels are loaded by background threads, nearest first, and only
+	//! appear in level() after the next update(). Levels that do not fit
+	//! into the budget are skipped, the furthest first.
+	//!
+	//! update() and the accessors must be called from one thread.
+	class WorldStreamer
+	{
+	public:
+		explicit WorldStreamer(std::vector<StreamedLevel> levels, StreamOptions const & options = StreamOptions());
+		~WorldStreamer();
+
+		WorldStreamer(WorldStreamer const &) = delete;
+		WorldStreamer & operator=(WorldStreamer const &) = delete;
+
+		//! Publishes finished loads, drops levels that are out of range or
+		//! over the budget and queues the missing ones by distance.
+		void update(glm::vec3 const & position);
+
+		size_t size() const { return entries.size(); }
+
+		//! The level or nullptr if it is not resident.
+		std::shared_ptr<Level const> level(size_t i) const { return entries.at(i).level; }
+
+		//! Bounds of the level in world coordinates, from the probe.
+		glm::vec3 bbMin(size_t i) const { return entries.at(i).bbMin; }
+		glm::vec3 bbMax(size_t i) const { return entries.at(i).bbMax; }
+
+		//! False if the file could not be probed, it is never loaded.
+		bool isValid(size_t i) const { return entries.at(i).valid; }
+
+		//! Measured footprint of the resident levels.
+		size_t residentBytes() const;
+
+		//! True while levels are queued, loading or waiting for update().
+		bool busy() const;
+
+	private:
+		struct Entry
+		{
+			StreamedLevel source;
+			bool valid = false;
+			glm::vec3 bbMin, bbMax;
+			size_t estimate = 0; // the file size, the measured bytes after the first load
+			size_t bytes = 0;    // measured footprint when resident
+			std::shared_ptr<Level const> level;
+		};
+
+		struct Finished
+		{
+			size_t index;
+			std::shared_ptr<Level const> level;
+			size_t bytes;
+		};
+
+		void run();
+
+		std::vector<Entry> entries;
+		StreamOptions const options;
+
+		// shared with the workers
+		mutable std::mutex mutex;
+		std::condition_variable wakeup;
+		std::vector<size_t> queue;   // nearest last
+		std::vector<bool> active;    // taken by a worker
+		std::vector<Finished> finished;
+		size_t working = 0;
+		bool stopping = false;
+		std::vector<std::thread> workers;
+	};
+}
+
+#endif // WMB_STREAM_HPP
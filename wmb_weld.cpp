@@ -0,0 +1,200 @@
+#include "wmb.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+using namespace WMB;
+
+namespace // anonymous namespace
+{
+	struct WeldKey
+	{
+		std::array<int64_t, 3> cells;
+
+		bool operator==(WeldKey const & other) const
+		{
+			return cells == other.cells;
+		}
+	};
+
+	struct WeldKeyHash
+	{
+		size_t operator()(WeldKey const & key) const
+		{
+			// FNV-1a over the cell coordinates
+			uint64_t hash = 14695981039346656037ull;
+			for(auto const cell : key.cells)
+			{
+				hash ^= static_cast<uint64_t>(cell);
+				hash *= 1099511628211ull;
+			}
+			return static_cast<size_t>(hash ^ (hash >> 32));
+		}
+	};
+
+	uint32_t toBits(float value)
+	{
+		// treat -0.0 and +0.0 as equal
+		if(value == 0.0f)
+			value = 0.0f;
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof bits);
+		return bits;
+	}
+
+	//! Grid cell of a value. Exact matches, NaN and values too large for
+	//! the grid use the bits of the value instead and have no neighbours.
+	int64_t toCell(float value, float epsilon, bool & gridded)
+	{
+		if(epsilon > 0.0f)
+		{
+			double const cell = std::floor(double(value) / epsilon);
+			if(std::abs(cell) < 0x1p60) // false for NaN
+			{
+				gridded = true;
+				return static_cast<int64_t>(cell);
+			}
+		}
+		gridded = false;
+		return toBits(value);
+	}
+
+	bool isClose(float a, float b, float epsilon)
+	{
+		if(epsilon > 0.0f and std::isfinite(a) and std::isfinite(b))
+			return std::abs(double(a) - double(b)) <= epsilon;
+		return toBits(a) == toBits(b);
+	}
+
+	bool isClose(Vertex const & a, Vertex const & b, WeldOptions const & options)
+	{
+		return
+			isClose(a.position.x, b.position.x, options.positionEpsilon) and
+			isClose(a.position.y, b.position.y, options.positionEpsilon) and
+			isClose(a.position.z, b.position.z, options.positionEpsilon) and
+			isClose(a.uv.x, b.uv.x, options.uvEpsilon) and
+			isClose(a.uv.y, b.uv.y, options.uvEpsilon) and
+			isClose(a.lightmap.x, b.lightmap.x, options.lightmapEpsilon) and
+			isClose(a.lightmap.y, b.lightmap.y, options.lightmapEpsilon);
+	}
+}
+
+WeldStats & WeldStats::operator+=(WeldStats const & other)
+{
+	verticesRemoved += other.verticesRemoved;
+	trianglesRemoved += other.trianglesRemoved;
+	bytesSaved += other.bytesSaved;
+	return *this;
+}
+
+WeldStats WMB::weld(Block & block, WeldOptions const & options)
+{
+	WeldStats stats;
+
+	// The kept vertices are bucketed by the grid cell of their position,
+	// each bucket is a list through next. A vertex within epsilon of a
+	// kept one is in the same or a neighbouring cell on every axis.
+	std::unordered_map<WeldKey, uint32_t, WeldKeyHash> lookup;
+	lookup.reserve(block.vertices.size());
+	std::vector<uint32_t> next;
+	next.reserve(block.vertices.size());
+	uint32_t const none = UINT32_MAX;
+
+	std::vector<uint16_t> remap(block.vertices.size());
+	std::vector<Vertex> vertices;
+	vertices.reserve(block.vertices.size());
+
+	for(size_t i = 0; i < block.vertices.size(); i++)
+	{
+		auto const & vert = block.vertices[i];
+
+		WeldKey key;
+		std::array<bool, 3> gridded;
+		for(int axis = 0; axis < 3; axis++)
+			key.cells[axis] = toCell(vert.position[axis], options.positionEpsilon, gridded[axis]);
+
+		uint32_t match = none;
+		for(int dz = -1; dz <= 1 and match == none; dz++)
+		{
+			for(int dy = -1; dy <= 1 and match == none; dy++)
+			{
+				for(int dx = -1; dx <= 1 and match == none; dx++)
+				{
+					std::array<int, 3> const offset = { dx, dy, dz };
+					WeldKey neighbour = key;
+					bool skip = false;
+					for(int axis = 0; axis < 3; axis++)
+					{
+						skip = skip or (offset[axis] != 0 and not gridded[axis]);
+						neighbour.cells[axis] += offset[axis];
+					}
+					if(skip)
+						continue;
+
+					auto const found = lookup.find(neighbour);
+					for(uint32_t k = (found != lookup.end()) ? found->second : none; k != none; k = next[k])
+					{
+						if(isClose(vertices[k], vert, options))
+						{
+							match = k;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		if(match == none)
+		{
+			match = static_cast<uint32_t>(vertices.size());
+			auto const result = lookup.emplace(key, match);
+			next.push_back(result.second ? none : result.first->second);
+			result.first->second = match;
+			vertices.push_back(vert);
+		}
+		remap[i] = static_cast<uint16_t>(match);
+	}
+
+	std::vector<Triangle> triangles;
+	triangles.reserve(block.triangles.size());
+	for(auto tris : block.triangles)
+	{
+		// triangles referencing non-existing vertices are dropped as well
+		if(tris.v1 >= remap.size() or tris.v2 >= remap.size() or tris.v3 >= remap.size())
+			continue;
+
+		tris.v1 = remap[tris.v1];
+		tris.v2 = remap[tris.v2];
+		tris.v3 = remap[tris.v3];
+
+		if(tris.v1 == tris.v2 or tris.v2 == tris.v3 or tris.v3 == tris.v1)
+			continue;
+
+		triangles.push_back(tris);
+	}
+
+	stats.verticesRemoved = block.vertices.size() - vertices.size();
+	stats.trianglesRemoved = block.triangles.size() - triangles.size();
+	stats.bytesSaved =
+		stats.verticesRemoved * sizeof(Vertex) +
+		stats.trianglesRemoved * sizeof(Triangle);
+
+	vertices.shrink_to_fit();
+	block.vertices = std::move(vertices);
+	// welding would merge the split vertices of the frames again
+	block.frames.clear();
+	block.triangles = std::move(triangles);
+
+	return stats;
+}
+
+WeldStats WMB::weld(Level & level, WeldOptions const & options)
+{
+	WeldStats stats;
+	for(auto & block : level.blocks)
+		stats += weld(block, options);
+	return stats;
+}
@@ -0,0 +1,592 @@
+#include "wmb.hpp"
+#include "wmb_format.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+using namespace WMB;
+using namespace WMB::detail;
+
+namespace // anonymous namespace
+{
+	struct Writer
+	{
+		FILE * f;
+		bool ok = true;
+
+		Writer(FILE * f) : f(f)
+		{
+
+		}
+
+		Writer(Writer const &) = delete;
+		Writer(Writer &&) = delete;
+
+		~Writer()
+		{
+			if(f != nullptr)
+				fclose(f);
+		}
+
+		uint32_t tell() const
+		{
+			return static_cast<uint32_t>(ftell(f));
+		}
+
+		void write(void const * data, size_t len)
+		{
+			if(len > 0 and fwrite(data, 1, len, f) != len)
+				ok = false;
+		}
+
+		template<typename T>
+		void write(T const & value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value);
+			write(&value, sizeof(T));
+		}
+
+		void write(std::vector<std::byte> const & data)
+		{
+			write(data.data(), data.size());
+		}
+
+		//! Pads with zeros until the file position modulo the alignment
+		//! equals the given remainder.
+		void align(uint32_t alignment, uint32_t remainder = 0)
+		{
+			static char const zeros[16] = { };
+			uint32_t const pad = (alignment + remainder - tell() % alignment) % alignment;
+			write(zeros, pad);
+		}
+
+		template<typename T>
+		void patch(uint32_t offset, T const & value)
+		{
+			auto const pos = tell();
+			fseek(f, offset, SEEK_SET);
+			write(value);
+			fseek(f, pos, SEEK_SET);
+		}
+
+		//! Closes the file, returns false if anything could not be
+		//! written, including the buffered data.
+		bool close()
+		{
+			bool const closed = (fclose(f) == 0);
+			f = nullptr;
+			return ok and closed;
+		}
+	};
+
+	//! Number of levels a raw texture is written with. The loader reads
+	//! the base level and, with the mipmap flag, exactly three quarter
+	//! size levels, so other mip chains only keep their base level.
+	size_t rawLevelCount(Texture const & texture)
+	{
+		if(not texture.hasMipMaps or texture.levelCount() < 4)
+			return 1;
+		size_t size = texture.level(0).size();
+		for(size_t i = 1; i < 4; i++)
+		{
+			size /= 4;
+			if(size == 0 or texture.level(i).size() != size)
+				return 1;
+		}
+		return 4;
+	}
+
+	//! Maps the indices of the kept entries to their new position,
+	//! dropped entries map to -1.
+	std::vector<int> compact(std::vector<bool> const & keep)
+	{
+		std::vector<int> remap(keep.size(), -1);
+		int next = 0;
+		for(size_t i = 0; i < keep.size(); i++)
+		{
+			if(keep[i])
+				remap[i] = next++;
+		}
+		return remap;
+	}
+}
+
+bool WMB::save(Level const & level, std::string const & fileName, SaveOptions const & options)
+{
+	// WMB has no way to store block compressed lightmaps
+	for(auto const * list : { &level.lightmaps, &level.terrain_lightmaps })
+	{
+		for(auto const & lm : *list)
+		{
+			if(lm.compression != BlockCompression::None)
+				return false;
+		}
+	}
+
+	// the skipped levels of streamed textures are not known here
+	for(auto const & texture : level.textures)
+	{
+		if(texture.skippedLevels > 0)
+			return false;
+	}
+
+	Writer w(fopen(fileName.c_str(), "wb"));
+	if(w.f == nullptr)
+		return false;
+
+	glm::mat3 const mapping = coordinateMatrix(options.sourceCoordinateSystem);
+	auto const unmapVec = [&](glm::vec3 const & v)
+	{
+		// the mappings are orthonormal, so this is the inverse of v * mapping
+		glm::vec3 const r = mapping * v;
+		return std::array<float, 3> { r.x, r.y, r.z };
+	};
+	auto const unmapScale = [&](glm::vec3 const & v)
+	{
+		if(options.sourceCoordinateSystem == LoadOptions::Gamestudio)
+			return std::array<float, 3> { v.x, v.y, v.z };
+		else
+			return std::array<float, 3> { v.x, v.z, v.y };
+	};
+	//! Returns the minimum and maximum corner of a box in Gamestudio coordinates.
+	auto const unmapBounds = [&](glm::vec3 const & a, glm::vec3 const & b)
+	{
+		auto const corner1 = unmapVec(a);
+		auto const corner2 = unmapVec(b);
+		std::array<std::array<float, 3>, 2> bounds;
+		for(size_t i = 0; i < 3; i++)
+		{
+			bounds[0][i] = std::min(corner1[i], corner2[i]);
+			bounds[1][i] = std::max(corner1[i], corner2[i]);
+		}
+		return bounds;
+	};
+
+	auto const align = [&](uint32_t remainder = 0)
+	{
+		if(options.align_arrays())
+			w.align(16, remainder % 16);
+	};
+	auto const beginList = [&]()
+	{
+		align();
+		LIST list;
+		list.offset = w.tell();
+		list.length = 0;
+		return list;
+	};
+	auto const endList = [&](LIST & list)
+	{
+		list.length = w.tell() - list.offset;
+	};
+
+	// Find the textures and materials that are still in use
+	std::vector<bool> keepTextures(level.textures.size(), not options.strip_textures());
+	std::vector<bool> keepMaterials(level.materials.size(), not options.strip_materials());
+	for(auto const & block : level.blocks)
+	{
+		for(auto const & skin : block.skins)
+		{
+			if(skin.texture < keepTextures.size())
+				keepTextures[skin.texture] = true;
+			if(skin.material < keepMaterials.size())
+				keepMaterials[skin.material] = true;
+		}
+	}
+	for(auto const & obj : level.objects)
+	{
+		if(auto const * ent = std::get_if<Entity>(&obj))
+		{
+			for(size_t i = 0; i < level.materials.size(); i++)
+			{
+				if(level.materials[i].name == ent->material)
+					keepMaterials[i] = true;
+			}
+		}
+	}
+	auto const textureRemap = compact(keepTextures);
+	auto const materialRemap = compact(keepMaterials);
+
+	WMB_HEADER header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.version.data(), "WMB7", 4);
+	w.write(header);
+
+	// Write textures
+	{
+		header.textures = beginList();
+
+		uint32_t count = 0;
+		for(auto const keep : keepTextures)
+			count += keep ? 1 : 0;
+		w.write(count);
+
+		uint32_t const offsetTable = w.tell();
+		for(size_t i = 0; i < count; i++)
+			w.write(uint32_t(0));
+
+		uint32_t index = 0;
+		for(size_t i = 0; i < level.textures.size(); i++)
+		{
+			if(not keepTextures[i])
+				continue;
+			auto const & texture = level.textures[i];
+
+			// the pixel data follows the TEXTURE struct directly
+			align(16 - sizeof(TEXTURE) % 16);
+			w.patch(offsetTable + 4 * index, w.tell() - header.textures.offset);
+			index++;
+
+			TEXTURE tex;
+			memset(&tex, 0, sizeof tex);
+			tex.name = toChars<16>(texture.name);
+			tex.width = texture.width;
+			tex.height = texture.height;
+
+			// Uncompressed DDS files are loaded with a raw format, they are
+			// written back as the DDS file they came from.
+			bool const ddsFile = storesDDSFile(texture);
+			if(texture.format == Texture::DDS or texture.compression != BlockCompression::None or ddsFile)
+			{
+				// DDS images store the size of the image content as the
+				// width. Loaded DDS files are written back unchanged, block
+				// compressed textures get wrapped into a new DDS image.
+				ByteView blob;
+				std::vector<std::byte> encoded;
+				if(ddsFile)
+					blob = ByteView { texture.storage->data(), texture.storage->size() };
+				else if(texture.format == Texture::DDS and texture.compression == BlockCompression::None)
+					blob = texture.level(0);
+				else
+				{
+					encoded = encodeDDS(texture);
+					blob = ByteView { encoded.data(), encoded.size() };
+				}
+
+				tex.width = blob.size();
+				tex.type = uint32_t(Texture::DDS) | (texture.hasMipMaps ? 8 : 0);
+				w.write(tex);
+				w.write(blob.data(), blob.size());
+			}
+			else
+			{
+				size_t const levelCount = rawLevelCount(texture);
+				tex.type = uint32_t(texture.format) | (levelCount > 1 ? 8 : 0);
+				w.write(tex);
+				for(size_t i = 0; i < levelCount; i++)
+				{
+					auto const mip = texture.level(i);
+					w.write(mip.data(), mip.size());
+				}
+			}
+		}
+
+		endList(header.textures);
+	}
+
+	// Write materials
+	{
+		header.materials = beginList();
+		for(size_t i = 0; i < level.materials.size(); i++)
+		{
+			if(not keepMaterials[i])
+				continue;
+			MATERIAL_INFO info;
+			memset(&info, 0, sizeof info);
+			if(level.materials[i].isDefault)
+				memcpy(info.material.data(), "\0def", 4);
+			else
+				info.material = toChars<20>(level.materials[i].name);
+			w.write(info);
+		}
+		endList(header.materials);
+	}
+
+	// Write blocks
+	{
+		header.blocks = beginList();
+		w.write(uint32_t(level.blocks.size()));
+		for(auto const & block : level.blocks)
+		{
+			BLOCK bl;
+			memset(&bl, 0, sizeof bl);
+			auto const bounds = unmapBounds(block.bbMin, block.bbMax);
+			bl.fMins = bounds[0];
+			bl.fMaxs = bounds[1];
+			bl.lNumVerts = block.vertices.size();
+			bl.lNumTris = block.triangles.size();
+			bl.lNumSkins = block.skins.size();
+			w.write(bl);
+
+			for(auto const & vert : block.vertices)
+			{
+				auto const pos = unmapVec(vert.position);
+				VERTEX v;
+				v.x = pos[0];
+				v.y = pos[1];
+				v.z = pos[2];
+				v.tu = vert.uv.x;
+				v.tv = vert.uv.y;
+				v.su = vert.lightmap.x;
+				v.sv = vert.lightmap.y;
+				w.write(v);
+			}
+
+			for(auto const & tris : block.triangles)
+			{
+				TRIANGLE t;
+				t.v1 = tris.v1;
+				if(options.sourceCoordinateSystem == LoadOptions::OpenGL)
+				{
+					// restore winding order
+					t.v2 = tris.v3;
+					t.v3 = tris.v2;
+				}
+				else
+				{
+					t.v2 = tris.v2;
+					t.v3 = tris.v3;
+				}
+				t.skin = tris.skin;
+				t.unused = 0;
+				w.write(t);
+			}
+
+			for(auto const & skin : block.skins)
+			{
+				SKIN s;
+				s.texture = (skin.texture < textureRemap.size()) ? uint16_t(textureRemap[skin.texture]) : skin.texture;
+				s.lightmap = skin.lightmap;
+				s.material = (skin.material < materialRemap.size()) ? uint32_t(materialRemap[skin.material]) : skin.material;
+				s.ambient = skin.ambient;
+				s.albedo = skin.albedo;
+				s.flags = skin.flags.to_ulong();
+				w.write(s);
+			}
+		}
+		endList(header.blocks);
+	}
+
+	// Write BSP tree, the records are copied because their layout is not
+	// known for sure
+	if(level.bspLists)
+	{
+		auto const & lists = *level.bspLists;
+		for(auto [list, data] : { std::pair(&header.bsp_nodes, &lists.nodes), std::pair(&header.bsp_leafs, &lists.leafs),
+		                          std::pair(&header.bsp_blocks, &lists.blocks), std::pair(&header.pvs, &lists.pvs) })
+		{
+			if(data->empty() and list == &header.pvs)
+				continue;
+			*list = beginList();
+			w.write(*data);
+			endList(*list);
+		}
+	}
+
+	// Write objects
+	{
+		header.objects = beginList();
+
+		// The info object keeps its place in the list, the object indices
+		// of entities and terrain lightmaps count it.
+		size_t const infoIndex = std::min(level.infoIndex.value_or(level.objects.size()), level.objects.size());
+		uint32_t const count = level.objects.size() + 1;
+		w.write(count);
+
+		uint32_t const offsetTable = w.tell();
+		for(size_t i = 0; i < count; i++)
+			w.write(uint32_t(0));
+
+		auto const beginObject = [&](size_t slot, OBJECT_TYPE type)
+		{
+			w.patch(offsetTable + 4 * slot, w.tell() - header.objects.offset);
+			w.write(type);
+		};
+
+		auto const writeInfo = [&]()
+		{
+			auto const & info = level.info;
+
+			WMB_INFO inf;
+			memset(&inf, 0, sizeof inf);
+			inf.azimuth = info.azimuth;
+			inf.elevation = info.elevation;
+			inf.flags = 0x7F;
+			inf.gamma = uint8_t(std::lround(glm::clamp(info.gamma, 0.0f, 1.0f) * 255.0f));
+			inf.LMapSize = (info.lightMapSize >= 1024) ? 2 : (info.lightMapSize >= 512) ? 1 : 0;
+			inf.dwSunColor = fromColor(info.sunColor);
+			inf.dwAmbientColor = fromColor(info.ambientColor);
+			for(size_t i = 0; i < 4; i++)
+				inf.dwFogColor[i] = fromColor(info.fogColor[i]);
+
+			beginObject(infoIndex, OBJECT_TYPE::Info);
+			w.write(inf);
+		};
+
+		for(size_t i = 0; i < level.objects.size(); i++)
+		{
+			if(i == infoIndex)
+				writeInfo();
+
+			size_t const slot = (i < infoIndex) ? i : i + 1;
+			auto const & obj = level.objects[i];
+			if(auto const * pos = std::get_if<Position>(&obj))
+			{
+				WMB_POSITION p;
+				memset(&p, 0, sizeof p);
+				p.origin = unmapVec(pos->origin);
+				p.angle = { pos->angle.pan, pos->angle.tilt, pos->angle.roll };
+				p.name = toChars<20>(pos->name);
+
+				beginObject(slot, OBJECT_TYPE::Position);
+				w.write(p);
+			}
+			else if(auto const * light = std::get_if<Light>(&obj))
+			{
+				WMB_LIGHT l;
+				l.origin = unmapVec(light->origin);
+				l.red = light->color.x;
+				l.green = light->color.y;
+				l.blue = light->color.z;
+				l.range = light->range;
+				l.flags = light->flags.to_ulong();
+
+				beginObject(slot, OBJECT_TYPE::Light);
+				w.write(l);
+			}
+			else if(auto const * snd = std::get_if<Sound>(&obj))
+			{
+				WMB_SOUND s;
+				memset(&s, 0, sizeof s);
+				s.origin = unmapVec(snd->origin);
+				s.volume = snd->volume;
+				s.range = snd->range;
+				s.flags = snd->flags.to_ulong();
+				s.filename = toChars<33>(snd->fileName);
+
+				beginObject(slot, OBJECT_TYPE::Sound);
+				w.write(s);
+			}
+			else if(auto const * path = std::get_if<Path>(&obj))
+			{
+				WMB_PATH p;
+				memset(&p, 0, sizeof p);
+				p.name = toChars<20>(path->name);
+				p.fNumPoints = path->nodes.size();
+				p.num_edges = path->edges.size();
+
+				beginObject(slot, OBJECT_TYPE::Path);
+				w.write(p);
+				for(auto const & node : path->nodes)
+					w.write(unmapVec(node.position));
+				for(auto const & node : path->nodes)
+					w.write(node.skills);
+				for(auto const & edge : path->edges)
+				{
+					PATH_EDGE e;
+					e.fNode1 = edge.node1 + 1;
+					e.fNode2 = edge.node2 + 1;
+					e.fLength = edge.length;
+					e.fBezier = edge.bezier;
+					e.fWeight = edge.weight;
+					e.fSkill = edge.skill;
+					w.write(e);
+				}
+			}
+			else if(auto const * ent = std::get_if<Entity>(&obj))
+			{
+				if(ent->isOldEntity)
+				{
+					WMB_OLD_ENTITY e;
+					memset(&e, 0, sizeof e);
+					e.origin = unmapVec(ent->origin);
+					e.angle = { ent->angle.pan, ent->angle.tilt, ent->angle.roll };
+					e.scale = unmapScale(ent->scale);
+					e.name = toChars<20>(ent->name);
+					e.filename = toChars<13>(ent->fileName);
+					e.action = toChars<20>(ent->action);
+					for(size_t k = 0; k < e.skill.size(); k++)
+						e.skill[k] = ent->skill[k];
+					e.flags = ent->flags.to_ulong();
+					e.ambient = ent->ambient;
+
+					beginObject(slot, OBJECT_TYPE::OldEntity);
+					w.write(e);
+				}
+				else
+				{
+					WMB_ENTITY e;
+					memset(&e, 0, sizeof e);
+					e.origin = unmapVec(ent->origin);
+					e.angle = { ent->angle.pan, ent->angle.tilt, ent->angle.roll };
+					e.scale = unmapScale(ent->scale);
+					e.name = toChars<33>(ent->name);
+					e.filename = toChars<33>(ent->fileName);
+					e.action = toChars<33>(ent->action);
+					e.skill = ent->skill;
+					e.flags = ent->flags.to_ulong();
+					e.ambient = ent->ambient;
+					e.albedo = ent->albedo;
+					e.path = ent->path ? int32_t(*ent->path + 1) : 0;
+					e.entity2 = ent->attachedEntity ? uint32_t(*ent->attachedEntity + 1) : 0;
+					e.material = toChars<33>(ent->material);
+					e.string1 = toChars<33>(ent->string1);
+					e.string2 = toChars<33>(ent->string2);
+
+					beginObject(slot, OBJECT_TYPE::Entity);
+					w.write(e);
+				}
+			}
+			else if(auto const * region = std::get_if<Region>(&obj))
+			{
+				REGION r;
+				memset(&r, 0, sizeof r);
+				r.min = { region->minimum.x, region->minimum.y, region->minimum.z };
+				r.max = { region->maximum.x, region->maximum.y, region->maximum.z };
+				r.name = toChars<32>(region->name);
+
+				beginObject(slot, OBJECT_TYPE::Region);
+				w.write(r);
+			}
+		}
+
+		if(infoIndex == level.objects.size())
+			writeInfo();
+
+		endList(header.objects);
+	}
+
+	// Write lightmaps
+	if(not level.lightmaps.empty())
+	{
+		header.lightmaps = beginList();
+		for(auto const & lm : level.lightmaps)
+			w.write(lm.data);
+		endList(header.lightmaps);
+	}
+
+	// Write terrain lightmaps
+	if(not level.terrain_lightmaps.empty())
+	{
+		header.lightmaps_terrain = beginList();
+		w.write(uint32_t(level.terrain_lightmaps.size()));
+		for(auto const & lm : level.terrain_lightmaps)
+		{
+			LIGHTMAP_TERRAIN obj;
+			obj.object = lm.object.value_or(0);
+			obj.width = lm.width;
+			obj.height = lm.height;
+			w.write(obj);
+			w.write(lm.data);
+		}
+		endList(header.lightmaps_terrain);
+	}
+
+	w.patch(0, header);
+
+	return w.close();
+}
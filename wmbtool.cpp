@@ -0,0 +1,853 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include "wmb.hpp"
+#include "wmb_bake.hpp"
+#include "wmb_compress.hpp"
+#include "wmb_cull.hpp"
+#include "wmb_lights.hpp"
+#include "wmb_lod.hpp"
+#include "wmb_meshlets.hpp"
+#include "wmb_parallel.hpp"
+using namespace WMB;
+
+namespace fs = std::filesystem;
+
+/*
+ * Batch tool for whole directory trees of WMB files. Every file is a job
+ * on a work stealing pool, the results are written as JSON to stdout.
+ *
+ *   wmbtool info      probe the files without loading them
+ *   wmbtool stats     load the files and count their contents
+ *   wmbtool validate  load the files and check all indices
+ *   wmbtool strip     save the files without unused textures and materials
+ *   wmbtool bake      save welded and block compressed copies of the files
+ *   wmbtool lights    time the light assignment for blocks and a cluster grid
+ *   wmbtool cull      time the frustum culling of the block bounds
+ *   wmbtool meshlets  time the meshlet generation for all blocks
+ *   wmbtool lods      time the simplification and count the remaining triangles
+ *   wmbtool lightmaps bake the lightmaps again and save the files
+ */
+
+struct Arguments
+{
+	std::string command;
+	std::vector<fs::path> inputs;
+	fs::path output;        // output directory for strip, bake and lightmaps
+	unsigned threads = 0;   // 0 = one per core
+	size_t memory = 1024;   // memory budget in MiB
+	bool quiet = false;     // no summary on stderr
+};
+
+struct Job
+{
+	fs::path path;
+	fs::path relative; // relative to the input root, used for the output
+	size_t size = 0;
+};
+
+struct Result
+{
+	bool ok = false;
+	double seconds = 0.0;
+	std::string fields; // command specific JSON members
+	std::vector<std::string> errors;
+};
+
+//! Appends JSON members to a string.
+struct JsonFields
+{
+	std::string & out;
+
+	//! Length of the valid UTF-8 sequence of more than one byte at the
+	//! given position, 0 if there is none.
+	static size_t sequenceLength(std::string const & str, size_t i)
+	{
+		auto const byte = [&](size_t k) { return static_cast<unsigned char>(str[k]); };
+		unsigned char const lead = byte(i);
+		size_t length;
+		uint32_t code;
+		if((lead & 0xE0) == 0xC0)
+		{
+			length = 2;
+			code = lead & 0x1F;
+		}
+		else if((lead & 0xF0) == 0xE0)
+		{
+			length = 3;
+			code = lead & 0x0F;
+		}
+		else if((lead & 0xF8) == 0xF0)
+		{
+			length = 4;
+			code = lead & 0x07;
+		}
+		else
+		{
+			return 0;
+		}
+		if(i + length > str.size())
+			return 0;
+		for(size_t k = 1; k < length; k++)
+		{
+			if((byte(i + k) & 0xC0) != 0x80)
+				return 0;
+			code = (code << 6) | (byte(i + k) & 0x3F);
+		}
+		// overlong forms, surrogates and code points past U+10FFFF
+		static uint32_t const smallest[] = { 0, 0, 0x80, 0x800, 0x10000 };
+		if(code < smallest[length] or (code >= 0xD800 and code <= 0xDFFF) or code > 0x10FFFF)
+			return 0;
+		return length;
+	}
+
+	//! Quotes a string as JSON. Bytes that are not part of valid UTF-8,
+	//! like the ANSI characters of level names, are escaped as \u00XX.
+	static std::string quote(std::string const & str)
+	{
+		std::ostringstream ss;
+		ss << '"';
+		for(size_t i = 0; i < str.size(); i++)
+		{
+			char const c = str[i];
+			switch(c)
+			{
+				case '"':  ss << "\\\""; break;
+				case '\\': ss << "\\\\"; break;
+				case '\n': ss << "\\n"; break;
+				case '\t': ss << "\\t"; break;
+				default:
+				{
+					auto const byte = static_cast<unsigned char>(c);
+					size_t const length = (byte >= 0x80) ? sequenceLength(str, i) : 1;
+					if(byte < 0x20 or length == 0)
+						ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(byte) << std::dec;
+					else
+					{
+						ss << str.substr(i, length);
+						i += length - 1;
+					}
+				}
+			}
+		}
+		ss << '"';
+		return ss.str();
+	}
+
+	void raw(std::string const & key, std::string const & value)
+	{
+		out += ", " + quote(key) + ": " + value;
+	}
+
+	void add(std::string const & key, std::string const & value) { raw(key, quote(value)); }
+	void add(std::string const & key, char const * value) { raw(key, quote(value)); }
+	void add(std::string const & key, bool value) { raw(key, value ? "true" : "false"); }
+	void add(std::string const & key, size_t value) { raw(key, std::to_string(value)); }
+
+	void add(std::string const & key, glm::vec3 const & v)
+	{
+		std::ostringstream ss;
+		ss << "[" << v.x << ", " << v.y << ", " << v.z << "]";
+		raw(key, ss.str());
+	}
+};
+
+static void usage()
+{
+	std::cout << "Usage: wmbtool <info|stats|validate|strip|bake|lights|cull|meshlets|lods|lightmaps> [options] <file or directory>..." << std::endl
+	          << "Options:" << std::endl
+	          << "  -o <dir>      output directory for strip, bake and lightmaps" << std::endl
+	          << "  -j <threads>  number of worker threads, default is one per core" << std::endl
+	          << "  -m <MiB>      memory budget for the files in flight, default is 1024" << std::endl
+	          << "  -q            do not print the summary to stderr" << std::endl;
+}
+
+static bool writesFiles(std::string const & command)
+{
+	return command == "strip" or command == "bake" or command == "lightmaps";
+}
+
+static std::optional<Arguments> parseArguments(int argc, char ** argv)
+{
+	if(argc < 3)
+		return std::nullopt;
+
+	Arguments args;
+	args.command = argv[1];
+	if(args.command != "info" and args.command != "stats" and args.command != "validate" and args.command != "strip" and args.command != "bake" and args.command != "lights" and args.command != "cull" and args.command != "meshlets" and args.command != "lods" and args.command != "lightmaps")
+		return std::nullopt;
+
+	for(int i = 2; i < argc; i++)
+	{
+		std::string const arg = argv[i];
+		bool const hasValue = (i + 1 < argc);
+		try
+		{
+			if(arg == "-o" and hasValue)
+				args.output = argv[++i];
+			else if(arg == "-j" and hasValue)
+				args.threads = std::stoul(argv[++i]);
+			else if(arg == "-m" and hasValue)
+				args.memory = std::stoul(argv[++i]);
+			else if(arg == "-q")
+				args.quiet = true;
+			else if(not arg.empty() and arg[0] == '-')
+				return std::nullopt;
+			else
+				args.inputs.push_back(arg);
+		}
+		catch(std::logic_error const &) // invalid_argument and out_of_range from stoul
+		{
+			return std::nullopt;
+		}
+	}
+
+	if(args.inputs.empty())
+		return std::nullopt;
+	if(writesFiles(args.command) and args.output.empty())
+		return std::nullopt;
+	return args;
+}
+
+static bool isWmbFile(fs::path const & path)
+{
+	auto ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(std::tolower(c)); });
+	return ext == ".wmb";
+}
+
+static std::vector<Job> collectJobs(std::vector<fs::path> const & inputs)
+{
+	std::vector<Job> jobs;
+	for(auto const & input : inputs)
+	{
+		std::error_code ec;
+		if(fs::is_directory(input, ec))
+		{
+			for(auto it = fs::recursive_directory_iterator(input, ec); it != fs::recursive_directory_iterator(); it.increment(ec))
+			{
+				if(ec)
+					break;
+				if(it->is_regular_file(ec) and isWmbFile(it->path()))
+					jobs.push_back(Job { it->path(), fs::relative(it->path(), input, ec), 0 });
+			}
+		}
+		else
+		{
+			jobs.push_back(Job { input, input.filename(), 0 });
+		}
+	}
+
+	for(auto & job : jobs)
+	{
+		std::error_code ec;
+		job.size = fs::file_size(job.path, ec);
+		if(ec)
+			job.size = 0;
+	}
+
+	std::sort(jobs.begin(), jobs.end(), [](Job const & a, Job const & b) { return a.path < b.path; });
+	return jobs;
+}
+
+//! Rough amount of memory a job needs while it runs.
+static size_t estimateMemory(std::string const & command, size_t fileSize)
+{
+	if(command == "info")
+		return 64 * 1024;
+	if(command == "bake")
+		return 3 * fileSize; // level, RGBA copies and compressed blocks
+	return 2 * fileSize;
+}
+
+static void info(Job const & job, Result & result)
+{
+	auto const probe = WMB::probe(job.path.string());
+	if(not probe)
+	{
+		result.errors.push_back("not a valid WMB7 file");
+		return;
+	}
+
+	JsonFields json { result.fields };
+	json.add("textures", probe->textureCount);
+	json.add("materials", probe->materialCount);
+	json.add("blocks", probe->blockCount);
+	json.add("objects", probe->objectCount);
+	json.add("lightmaps", probe->lightmapCount);
+	json.add("terrainLightmaps", probe->terrainLightmapCount);
+	json.add("vertices", probe->vertexCount);
+	json.add("triangles", probe->triangleCount);
+	json.add("skins", probe->skinCount);
+	json.add("bsp", probe->hasBsp);
+	if(probe->blockCount > 0)
+	{
+		json.add("min", probe->bbMin);
+		json.add("max", probe->bbMax);
+	}
+	if(probe->info)
+		json.add("lightMapSize", size_t(probe->info->lightMapSize));
+	result.ok = true;
+}
+
+//! Loads the file after probing it, the loader reads truncated files
+//! with zeros in place of the missing data.
+static std::optional<Level> loadLevel(Job const & job, LoadOptions const & options, Result & result)
+{
+	std::optional<Level> level;
+	if(WMB::probe(job.path.string(), options))
+		level = WMB::load(job.path.string(), options);
+	if(not level)
+		result.errors.push_back("not a valid WMB7 file");
+	return level;
+}
+
+static std::string textureFormatName(Texture const & tex)
+{
+	switch(tex.compression)
+	{
+		case BlockCompression::BC1: return "BC1";
+		case BlockCompression::BC2: return "BC2";
+		case BlockCompression::BC3: return "BC3";
+		case BlockCompression::BC4: return "BC4";
+		case BlockCompression::BC5: return "BC5";
+		case BlockCompression::BC7: return "BC7";
+		default: break;
+	}
+	switch(tex.format)
+	{
+		case Texture::RGBA8888: return "RGBA8888";
+		case Texture::RGB888:   return "RGB888";
+		case Texture::RGB565:   return "RGB565";
+		case Texture::DDS:      return "DDS";
+		default:                return "unknown";
+	}
+}
+
+static void stats(Job const & job, Result & result)
+{
+	auto const level = loadLevel(job, LoadOptions(), result);
+	if(not level)
+		return;
+
+	size_t vertices = 0, triangles = 0, skins = 0;
+	for(auto const & block : level->blocks)
+	{
+		vertices += block.vertices.size();
+		triangles += block.triangles.size();
+		skins += block.skins.size();
+	}
+
+	std::map<std::string, size_t> textureBytes;
+	for(auto const & tex : level->textures)
+	{
+		size_t bytes = 0;
+		for(size_t i = 0; i < tex.levelCount(); i++)
+			bytes += tex.level(i).size();
+		textureBytes[textureFormatName(tex)] += bytes;
+	}
+
+	size_t lightmapBytes = 0;
+	for(auto const & lm : level->lightmaps)
+		lightmapBytes += lm.data.size();
+	for(auto const & lm : level->terrain_lightmaps)
+		lightmapBytes += lm.data.size();
+
+	std::map<std::string, size_t> objects;
+	for(auto const & obj : level->objects)
+	{
+		static char const * const names[] = { "position", "light", "sound", "path", "entity", "region" };
+		objects[names[obj.index()]]++;
+	}
+
+	JsonFields json { result.fields };
+	json.add("textures", level->textures.size());
+	json.add("materials", level->materials.size());
+	json.add("blocks", level->blocks.size());
+	json.add("vertices", vertices);
+	json.add("triangles", triangles);
+	json.add("skins", skins);
+	json.add("lightmaps", level->lightmaps.size());
+	json.add("terrainLightmaps", level->terrain_lightmaps.size());
+	json.add("lightmapBytes", lightmapBytes);
+
+	std::string members;
+	for(auto const & entry : textureBytes)
+		members += (members.empty() ? "" : ", ") + JsonFields::quote(entry.first) + ": " + std::to_string(entry.second);
+	json.raw("textureBytes", "{" + members + "}");
+
+	members.clear();
+	for(auto const & entry : objects)
+		members += (members.empty() ? "" : ", ") + JsonFields::quote(entry.first) + ": " + std::to_string(entry.second);
+	json.raw("objects", "{" + members + "}");
+
+	if(level->bsp)
+	{
+		json.add("bspNodes", level->bsp->nodes.size());
+		json.add("bspLeafs", level->bsp->leafs.size());
+	}
+	result.ok = true;
+}
+
+static void validate(Job const & job, Result & result)
+{
+	auto const level = loadLevel(job, LoadOptions(), result);
+	if(not level)
+		return;
+
+	auto const error = [&](std::string const & message)
+	{
+		// the first few errors are enough to find the problem
+		if(result.errors.size() < 16)
+			result.errors.push_back(message);
+	};
+
+	for(size_t b = 0; b < level->blocks.size(); b++)
+	{
+		auto const & block = level->blocks[b];
+		std::string const where = "block " + std::to_string(b) + ": ";
+
+		for(size_t t = 0; t < block.triangles.size(); t++)
+		{
+			auto const & tri = block.triangles[t];
+			if(tri.v1 >= block.vertices.size() or tri.v2 >= block.vertices.size() or tri.v3 >= block.vertices.size())
+				error(where + "triangle " + std::to_string(t) + " references a missing vertex");
+			if(tri.skin >= block.skins.size())
+				error(where + "triangle " + std::to_string(t) + " references a missing skin");
+		}
+
+		for(size_t s = 0; s < block.skins.size(); s++)
+		{
+			auto const & skin = block.skins[s];
+			if(skin.texture >= level->textures.size())
+				error(where + "skin " + std::to_string(s) + " references a missing texture");
+			if(skin.material >= level->materials.size())
+				error(where + "skin " + std::to_string(s) + " references a missing material");
+			if(not skin.isFlat() and not skin.isSky() and not level->lightmaps.empty() and skin.lightmap >= level->lightmaps.size())
+				error(where + "skin " + std::to_string(s) + " references a missing lightmap");
+		}
+
+		if(block.bbMin.x > block.bbMax.x or block.bbMin.y > block.bbMax.y or block.bbMin.z > block.bbMax.z)
+			error(where + "has an inverted bounding box");
+	}
+
+	size_t paths = 0;
+	for(auto const & obj : level->objects)
+		paths += std::holds_alternative<Path>(obj) ? 1 : 0;
+
+	for(size_t i = 0; i < level->objects.size(); i++)
+	{
+		std::string const where = "object " + std::to_string(i) + ": ";
+		if(auto const * ent = std::get_if<Entity>(&level->objects[i]))
+		{
+			if(ent->path and *ent->path >= paths)
+				error(where + "entity '" + ent->name + "' references a missing path");
+			if(ent->attachedEntity and *ent->attachedEntity >= level->objects.size())
+				error(where + "entity '" + ent->name + "' references a missing entity");
+		}
+		else if(auto const * path = std::get_if<Path>(&level->objects[i]))
+		{
+			if(path->nodes.empty())
+				error(where + "path '" + path->name + "' has no nodes");
+		}
+	}
+
+	for(auto const & lm : level->terrain_lightmaps)
+	{
+		if(lm.object and *lm.object >= level->objects.size() + 1)
+			error("terrain lightmap references a missing object");
+	}
+
+	JsonFields json { result.fields };
+	json.add("bsp", bool(level->bspLists));
+	result.ok = result.errors.empty();
+}
+
+static bool createParent(fs::path const & target, Result & result)
+{
+	std::error_code ec;
+	fs::create_directories(target.parent_path(), ec);
+	if(ec)
+	{
+		result.errors.push_back("cannot create '" + target.parent_path().string() + "': " + ec.message());
+		return false;
+	}
+	return true;
+}
+
+static void strip(Job const & job, fs::path const & target, Result & result)
+{
+	auto const level = loadLevel(job, LoadOptions(), result);
+	if(not level)
+		return;
+	if(not createParent(target, result))
+		return;
+
+	SaveOptions options;
+	options.flags.set(SaveOptions::STRIP_TEXTURES);
+	options.flags.set(SaveOptions::STRIP_MATERIALS);
+	if(not WMB::save(*level, target.string(), options))
+	{
+		result.errors.push_back("cannot write '" + target.string() + "'");
+		return;
+	}
+
+	std::error_code ec;
+	JsonFields json { result.fields };
+	json.add("output", target.string());
+	json.add("outputBytes", size_t(fs::file_size(target, ec)));
+	result.ok = true;
+}
+
+static void bake(Job const & job, fs::path const & target, Result & result)
+{
+	LoadOptions loadOptions;
+	loadOptions.weld = WeldOptions();
+
+	auto level = loadLevel(job, loadOptions, result);
+	if(not level)
+		return;
+	if(not createParent(target, result))
+		return;
+
+	// The files are already processed in parallel
+	CompressOptions compressOptions;
+	compressOptions.quality = CompressOptions::High;
+	compressOptions.compressLightmaps = false; // WMB7 can only store BGR lightmaps
+	compressOptions.threads = 1;
+	if(not WMB::compress(*level, compressOptions))
+	{
+		result.errors.push_back("cannot compress the textures");
+		return;
+	}
+
+	SaveOptions options;
+	options.flags.set(SaveOptions::STRIP_TEXTURES);
+	options.flags.set(SaveOptions::STRIP_MATERIALS);
+	options.flags.set(SaveOptions::ALIGN_ARRAYS);
+	if(not WMB::save(*level, target.string(), options))
+	{
+		result.errors.push_back("cannot write '" + target.string() + "'");
+		return;
+	}
+
+	std::error_code ec;
+	JsonFields json { result.fields };
+	json.add("output", target.string());
+	json.add("outputBytes", size_t(fs::file_size(target, ec)));
+	result.ok = true;
+}
+
+static void lights(Job const & job, Result & result)
+{
+	auto const level = loadLevel(job, LoadOptions(), result);
+	if(not level)
+		return;
+
+	LightAssignmentOptions options;
+	options.gridSize = glm::uvec3(16, 16, 16);
+	options.threads = 1; // the files are already processed in parallel
+
+	auto const table = buildBoundsTable(*level);
+	auto const begin = std::chrono::steady_clock::now();
+	auto const assignment = assignLights(*level, table, options);
+	double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	JsonFields json { result.fields };
+	json.add("lights", assignment.lights.size());
+	json.add("blocks", level->blocks.size());
+	json.add("blockLights", assignment.blockLights.size());
+	json.add("cellLights", assignment.cellLights.size());
+	json.raw("assignSeconds", std::to_string(seconds));
+	result.ok = true;
+}
+
+static void cull(Job const & job, Result & result)
+{
+	auto const level = loadLevel(job, LoadOptions(), result);
+	if(not level)
+		return;
+
+	auto const table = buildBoundsTable(*level);
+	glm::vec3 minimum(std::numeric_limits<float>::max());
+	glm::vec3 maximum(-std::numeric_limits<float>::max());
+	for(auto const & block : level->blocks)
+	{
+		minimum = glm::min(minimum, block.bbMin);
+		maximum = glm::max(maximum, block.bbMax);
+	}
+
+	// A frustum around the middle half of the level, so some of the
+	// blocks are inside, some cross a plane and some are outside.
+	glm::vec3 const center = 0.5f * (minimum + maximum);
+	glm::vec3 const extent = 0.25f * (maximum - minimum);
+	Frustum frustum;
+	for(int axis = 0; axis < 3; axis++)
+	{
+		glm::vec4 plane(0.0f);
+		plane[axis] = 1.0f;
+		plane.w = extent[axis] - center[axis];
+		frustum.planes[2 * axis + 0] = plane;
+		plane[axis] = -1.0f;
+		plane.w = extent[axis] + center[axis];
+		frustum.planes[2 * axis + 1] = plane;
+	}
+
+	size_t const repetitions = 1000;
+	CullMask visible;
+	auto const begin = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < repetitions; i++)
+		cullFrustum(table, frustum, visible);
+	double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	size_t visibleCount = 0;
+	for(size_t i = 0; i < table.count; i++)
+		visibleCount += (visible[i / 64] >> (i % 64)) & 1;
+
+	JsonFields json { result.fields };
+	json.add("blocks", table.count);
+	json.add("visible", visibleCount);
+	json.raw("cullMicroseconds", std::to_string(seconds * 1e6 / repetitions));
+	json.raw("blocksPerMicrosecond", std::to_string(seconds > 0.0 ? table.count * repetitions / (seconds * 1e6) : 0.0));
+	result.ok = true;
+}
+
+static void meshlets(Job const & job, Result & result)
+{
+	auto const level = loadLevel(job, LoadOptions(), result);
+	if(not level)
+		return;
+
+	MeshletOptions options;
+	options.threads = 1; // the files are already processed in parallel
+
+	auto const begin = std::chrono::steady_clock::now();
+	auto const blocks = buildMeshlets(*level, options);
+	double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	size_t meshletCount = 0;
+	size_t triangleCount = 0;
+	for(auto const & block : blocks)
+	{
+		meshletCount += block.meshlets.size();
+		triangleCount += block.triangles.size() / 3;
+	}
+
+	JsonFields json { result.fields };
+	json.add("blocks", level->blocks.size());
+	json.add("meshlets", meshletCount);
+	json.add("triangles", triangleCount);
+	json.raw("buildSeconds", std::to_string(seconds));
+	result.ok = true;
+}
+
+static void lods(Job const & job, Result & result)
+{
+	auto const level = loadLevel(job, LoadOptions(), result);
+	if(not level)
+		return;
+
+	LodOptions options;
+	options.threads = 1; // the files are already processed in parallel
+
+	auto const begin = std::chrono::steady_clock::now();
+	auto const blocks = buildLods(*level, options);
+	double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	size_t triangleCount = 0;
+	for(auto const & block : level->blocks)
+		triangleCount += block.triangles.size();
+
+	JsonFields json { result.fields };
+	json.add("triangles", triangleCount);
+	for(size_t i = 0; i < options.ratios.size(); i++)
+	{
+		size_t remaining = 0;
+		float error = 0.0f;
+		for(auto const & block : blocks)
+		{
+			remaining += block[i].triangles.size();
+			error = std::max(error, block[i].error);
+		}
+		json.add("lod" + std::to_string(i + 1) + "Triangles", remaining);
+		json.raw("lod" + std::to_string(i + 1) + "Error", std::to_string(error));
+	}
+	json.raw("buildSeconds", std::to_string(seconds));
+	result.ok = true;
+}
+
+static void lightmaps(Job const & job, fs::path const & target, Result & result)
+{
+	auto level = loadLevel(job, LoadOptions(), result);
+	if(not level)
+		return;
+	if(not createParent(target, result))
+		return;
+
+	BakeOptions options;
+	options.threads = 1; // the files are already processed in parallel
+
+	auto const begin = std::chrono::steady_clock::now();
+	auto const stats = bakeLightmaps(*level, options);
+	double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	if(not WMB::save(*level, target.string()))
+	{
+		result.errors.push_back("cannot write '" + target.string() + "'");
+		return;
+	}
+
+	std::error_code ec;
+	JsonFields json { result.fields };
+	json.add("lightmaps", stats.lightmaps);
+	json.add("texels", stats.texels);
+	json.add("rays", stats.rays);
+	json.raw("bakeSeconds", std::to_string(seconds));
+	json.add("output", target.string());
+	json.add("outputBytes", size_t(fs::file_size(target, ec)));
+	result.ok = true;
+}
+
+int main(int argc, char ** argv)
+{
+	auto const args = parseArguments(argc, argv);
+	if(not args) {
+		usage();
+		return 1;
+	}
+
+	auto const jobs = collectJobs(args->inputs);
+	std::vector<Result> results(jobs.size());
+
+	// Inputs from different directories can map to the same output file,
+	// none of them is written then
+	if(writesFiles(args->command))
+	{
+		std::map<fs::path, std::vector<size_t>> targets;
+		for(size_t i = 0; i < jobs.size(); i++)
+			targets[jobs[i].relative.lexically_normal()].push_back(i);
+		for(auto const & [relative, indices] : targets)
+		{
+			if(indices.size() < 2)
+				continue;
+			for(auto const index : indices)
+				results[index].errors.push_back("output '" + (args->output / relative).string() + "' is the same for " + std::to_string(indices.size()) + " inputs");
+		}
+	}
+
+	// Large files are started first, so they do not end up at the tail
+	std::vector<size_t> order(jobs.size());
+	for(size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return jobs[a].size > jobs[b].size; });
+
+	auto const start = std::chrono::steady_clock::now();
+	unsigned threads;
+	{
+		WMB::detail::WorkStealingPool pool(args->threads);
+		WMB::detail::ByteBudget budget(args->memory * 1024 * 1024);
+		threads = pool.size();
+
+		for(auto const index : order)
+		{
+			if(not results[index].errors.empty())
+				continue;
+			pool.submit([&, index]()
+			{
+				auto const & job = jobs[index];
+				auto & result = results[index];
+
+				size_t const reserved = budget.acquire(estimateMemory(args->command, job.size));
+				auto const begin = std::chrono::steady_clock::now();
+
+				fs::path const target = args->output / job.relative;
+				if(args->command == "info")
+					info(job, result);
+				else if(args->command == "stats")
+					stats(job, result);
+				else if(args->command == "validate")
+					validate(job, result);
+				else if(args->command == "strip")
+					strip(job, target, result);
+				else if(args->command == "bake")
+					bake(job, target, result);
+				else if(args->command == "lights")
+					lights(job, result);
+				else if(args->command == "cull")
+					cull(job, result);
+				else if(args->command == "meshlets")
+					meshlets(job, result);
+				else if(args->command == "lods")
+					lods(job, result);
+				else if(args->command == "lightmaps")
+					lightmaps(job, target, result);
+
+				result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+				budget.release(reserved);
+			});
+		}
+		pool.wait();
+	}
+	double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t failed = 0;
+	size_t bytes = 0;
+
+	std::cout << "{" << std::endl;
+	std::cout << "  \"command\": " << JsonFields::quote(args->command) << "," << std::endl;
+	std::cout << "  \"files\": [";
+	for(size_t i = 0; i < jobs.size(); i++)
+	{
+		auto const & job = jobs[i];
+		auto const & result = results[i];
+		failed += result.ok ? 0 : 1;
+		bytes += job.size;
+
+		std::string fields;
+		JsonFields json { fields };
+		json.add("bytes", job.size);
+		json.add("ok", result.ok);
+		json.raw("seconds", std::to_string(result.seconds));
+		fields += result.fields;
+		if(not result.errors.empty())
+		{
+			std::string list;
+			for(auto const & error : result.errors)
+				list += (list.empty() ? "" : ", ") + JsonFields::quote(error);
+			json.raw("errors", "[" + list + "]");
+		}
+
+		std::cout << (i > 0 ? "," : "") << std::endl
+		          << "    { \"path\": " << JsonFields::quote(job.path.string()) << fields << " }";
+	}
+	std::cout << std::endl << "  ]," << std::endl;
+
+	double const megabytes = bytes / (1024.0 * 1024.0);
+	std::cout << "  \"summary\": { "
+	          << "\"files\": " << jobs.size() << ", "
+	          << "\"failed\": " << failed << ", "
+	          << "\"bytes\": " << bytes << ", "
+	          << "\"threads\": " << threads << ", "
+	          << "\"seconds\": " << seconds << ", "
+	          << "\"filesPerSecond\": " << (seconds > 0 ? jobs.size() / seconds : 0.0) << ", "
+	          << "\"megabytesPerSecond\": " << (seconds > 0 ? megabytes / seconds : 0.0)
+	          << " }" << std::endl;
+	std::cout << "}" << std::endl;
+
+	if(not args->quiet)
+	{
+		std::cerr << "wmbtool " << args->command << ": " << jobs.size() << " files, " << failed << " failed, "
+		          << std::fixed << std::setprecision(1) << megabytes << " MiB in " << std::setprecision(3) << seconds << " s ("
+		          << std::setprecision(1) << (seconds > 0 ? megabytes / seconds : 0.0) << " MiB/s, "
+		          << threads << " threads)" << std::endl;
+	}
+
+	return (failed > 0) ? 2 : 0;
+}
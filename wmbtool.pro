@@ -0,0 +1,8 @@
+TEMPLATE = app
+TARGET = wmbtool
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+SOURCES += wmbtool.cpp
+
+include(wmb.pri)